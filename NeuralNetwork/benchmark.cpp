@@ -0,0 +1,310 @@
+#include "neural_scaler.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+	Throughput of the neural net and the scaler built on it:
+	forward passes and training steps for each batch size, the time spent in each layer,
+	and whole page NeuralScale timings on a synthetic score page.
+	Each figure is the rate over as many runs as fit in the given number of seconds.
+*/
+
+namespace {
+	using net=neural_net::net<>;
+	using clock=std::chrono::steady_clock;
+	using scaler=ScoreProcessor::neural_scaler;
+
+	std::vector<size_t> parse_csv(char const* str)
+	{
+		std::vector<size_t> ret;
+		while(1)
+		{
+			char* end;
+			auto const val=std::strtoull(str,&end,10);
+			if(end==str||val==0)
+			{
+				throw std::invalid_argument("Invalid values");
+			}
+			ret.push_back(static_cast<size_t>(val));
+			if(*end=='\0')
+			{
+				return ret;
+			}
+			if(*end!=',')
+			{
+				throw std::invalid_argument("Invalid input");
+			}
+			str=end+1;
+		}
+	}
+
+	//runs f until seconds have passed, and returns how many times per second it ran
+	template<typename Func>
+	double rate(double seconds,Func&& f)
+	{
+		//once to warm caches and fault in memory
+		f();
+		size_t runs=0;
+		auto const start=clock::now();
+		std::chrono::duration<double> elapsed;
+		do
+		{
+			f();
+			++runs;
+			elapsed=clock::now()-start;
+		} while(elapsed.count()<seconds);
+		return runs/elapsed.count();
+	}
+
+	std::vector<float> random_values(size_t count,std::mt19937& gen)
+	{
+		std::uniform_real_distribution<float> dist(0,1);
+		std::vector<float> ret(count);
+		for(auto& v:ret)
+		{
+			v=dist(gen);
+		}
+		return ret;
+	}
+
+	//small weights keep the activations away from where the clipped activation is flat, as in a trained net
+	net make_net(std::vector<size_t> const& sizes,std::mt19937& gen)
+	{
+		net ret(sizes);
+		std::normal_distribution<float> dist(0,0.1f);
+		auto& layers=ret.layers();
+		for(size_t i=1;i<layers.size();++i)
+		{
+			auto const limit=layers[i].neuron_count()*layers[i-1].neuron_count();
+			for(size_t j=0;j<limit;++j)
+			{
+				layers[i].weights()[j]=dist(gen);
+			}
+			for(size_t j=0;j<layers[i].neuron_count();++j)
+			{
+				layers[i].biases()[j]=dist(gen)+0.5f;
+			}
+		}
+		return ret;
+	}
+
+	//staves, stems, note heads and beams, on a white page the size of an A4 scan at 150 dpi
+	cil::CImg<unsigned char> synthetic_page(std::mt19937& gen)
+	{
+		cil::CImg<unsigned char> page(1240,1754,1,1,255);
+		unsigned char const black=0;
+		unsigned char const grey=96;
+		auto pick=[&gen](int lo,int hi)
+		{
+			return std::uniform_int_distribution<int>(lo,hi)(gen);
+		};
+		for(int staff=120;staff+60<page.height()-100;staff+=150)
+		{
+			for(int line=0;line<5;++line)
+			{
+				page.draw_rectangle(80,staff+line*12,page.width()-80,staff+line*12+1,&black);
+			}
+			for(int x=140;x<page.width()-120;x+=pick(28,60))
+			{
+				int const y=staff+pick(-2,10)*6;
+				page.draw_ellipse(x,y,7,5,-20,&black);
+				bool const up=y>staff+24;
+				page.draw_rectangle(up?x+6:x-7,up?y-40:y,up?x+7:x-6,up?y:y+40,&black);
+				if(pick(0,3)==0)
+				{
+					page.draw_rectangle(x+6,y-40,x+40,y-35,&grey);
+				}
+			}
+		}
+		return page;
+	}
+
+	void print_rate(char const* what,size_t batch,double per_second)
+	{
+		std::cout<<std::setw(28)<<std::left<<what<<std::setw(8)<<std::right<<batch<<std::setw(16)<<std::fixed<<std::setprecision(0)<<per_second<<'\n';
+	}
+
+	void forward(net const& n,std::vector<size_t> const& batches,double seconds,std::mt19937& gen)
+	{
+		auto const in_count=n.layers().front().neuron_count();
+		auto const out_count=n.layers().back().neuron_count();
+		std::cout<<"\nForward pass"<<std::setw(24)<<"batch"<<std::setw(16)<<"patches/s"<<'\n';
+		{
+			auto const input=random_values(in_count,gen);
+			auto results=n.feed_forward_store(input.data());
+			print_rate("  one at a time (stored)",1,rate(seconds,[&]()
+			{
+				n.feed_forward_store(results,input.data());
+			}));
+		}
+		for(auto const batch:batches)
+		{
+			auto const input=random_values(batch*in_count,gen);
+			std::vector<float> output(batch*out_count);
+			auto ws=n.make_workspace(batch);
+			print_rate("  batched",batch,batch*rate(seconds,[&]()
+			{
+				n.feed_forward(ws,output.data(),input.data(),batch);
+			}));
+		}
+	}
+
+	void training(net n,std::vector<size_t> const& batches,double seconds,std::mt19937& gen)
+	{
+		auto const in_count=n.layers().front().neuron_count();
+		auto const out_count=n.layers().back().neuron_count();
+		std::cout<<"\nTraining"<<std::setw(28)<<"batch"<<std::setw(16)<<"samples/s"<<'\n';
+		{
+			auto const input=random_values(in_count,gen);
+			auto const answer=random_values(out_count,gen);
+			auto results=n.feed_forward_store(input.data());
+			neural_net::delta_t deltas(n.layers());
+			auto gradients=neural_net::zeroed_layers(n.layers());
+			print_rate("  one at a time (grads)",1,rate(seconds,[&]()
+			{
+				n.feed_forward_store(results,input.data());
+				n.calculate_deltas(deltas,results,answer.data());
+				n.calculate_grads(gradients.data(),deltas,results);
+			}));
+		}
+		for(auto const rule:{neural_net::update_rule::sgd,neural_net::update_rule::adam})
+		{
+			for(auto const batch:batches)
+			{
+				auto const input=random_values(batch*in_count,gen);
+				auto const answers=random_values(batch*out_count,gen);
+				neural_net::training_workspace ws(n.layers(),batch);
+				auto gradients=neural_net::zeroed_layers(n.layers());
+				//a rate small enough that the weights barely move over the runs
+				neural_net::optimizer opt(n.layers(),rule,1e-6f);
+				print_rate(rule==neural_net::update_rule::sgd?"  batched, sgd":"  batched, adam",batch,batch*rate(seconds,[&]()
+				{
+					for(size_t i=1;i<gradients.size();++i)
+					{
+						auto const nc=gradients[i].neuron_count();
+						std::fill_n(gradients[i].weights(),nc*n.layers()[i-1].neuron_count(),0.0f);
+						std::fill_n(gradients[i].biases(),nc,0.0f);
+					}
+					n.accumulate_gradients(gradients,ws,input.data(),answers.data(),batch);
+					opt.update(n.layers(),gradients,batch);
+				}));
+			}
+		}
+	}
+
+	/*
+		Each layer is timed as a net of its own, fed by the layer before it.
+		Its training time covers the output deltas and the gradients of the layer,
+		but not passing the deltas back through the layers before it.
+	*/
+	void per_layer(std::vector<size_t> const& sizes,size_t batch,double seconds,std::mt19937& gen)
+	{
+		std::string const title="\nPer layer, us per batch of "+std::to_string(batch);
+		std::cout<<std::setw(29)<<std::left<<title<<std::right<<std::setw(15)<<"forward"<<std::setw(16)<<"training"<<'\n';
+		for(size_t i=1;i<sizes.size();++i)
+		{
+			auto n=make_net({sizes[i-1],sizes[i]},gen);
+			auto const input=random_values(batch*sizes[i-1],gen);
+			auto const answers=random_values(batch*sizes[i],gen);
+			std::vector<float> output(batch*sizes[i]);
+			auto ws=n.make_workspace(batch);
+			double const forward_rate=rate(seconds,[&]()
+			{
+				n.feed_forward(ws,output.data(),input.data(),batch);
+			});
+			neural_net::training_workspace tws(n.layers(),batch);
+			auto gradients=neural_net::zeroed_layers(n.layers());
+			double const training_rate=rate(seconds,[&]()
+			{
+				n.accumulate_gradients(gradients,tws,input.data(),answers.data(),batch);
+			});
+			std::string const name="  "+std::to_string(sizes[i-1])+" -> "+std::to_string(sizes[i]);
+			std::cout<<std::setw(28)<<std::left<<name<<std::right<<std::setprecision(1)
+				<<std::setw(16)<<1e6/forward_rate<<std::setw(16)<<1e6/training_rate<<'\n';
+		}
+	}
+
+	void page(net const& n,unsigned int scale,size_t batch,double seconds,std::mt19937& gen)
+	{
+		auto const img=synthetic_page(gen);
+		std::cout<<"\nNeuralScale of a "<<img.width()<<'x'<<img.height()<<" page by "<<scale<<std::setw(12)<<"threads"<<std::setw(16)<<"ms/page"<<'\n';
+		scaler full(scale,n);
+		full.batch_size(static_cast<unsigned int>(batch));
+		scaler int8=full;
+		int8.quantize(neural_net::weight_format::int8);
+		scaler fp16=full;
+		fp16.quantize(neural_net::weight_format::fp16);
+		std::pair<char const*,scaler const*> const scalers[]={{"  fp32",&full},{"  int8",&int8},{"  fp16",&fp16}};
+		auto const all=std::max(1U,std::thread::hardware_concurrency());
+		for(auto const& s:scalers)
+		{
+			for(auto const threads:{1U,all})
+			{
+				double const per_second=rate(seconds,[&]()
+				{
+					s.second->get_smart_scale(img,static_cast<float>(scale),threads);
+				});
+				std::cout<<std::setw(28)<<std::left<<s.first<<std::right<<std::setw(8)<<threads
+					<<std::setw(16)<<std::setprecision(1)<<1e3/per_second<<'\n';
+				if(all==1)
+				{
+					break;
+				}
+			}
+		}
+	}
+}
+
+int main(int argc,char** argv)
+{
+	if(argc>1&&(!std::strcmp(argv[1],"-h")||!std::strcmp(argv[1],"--help")))
+	{
+		std::cout<<
+			"Benchmarks the neural net and the scaler built on it.\n"
+			"First arg is CSV of layer heights (first and last values are squared), def 12,256,128,4\n"
+			"Second arg is CSV of batch sizes, def 1,16,64,256\n"
+			"Third arg is the scale factor of the page timings, def 2\n"
+			"Fourth arg is seconds spent on each measurement, def 1\n";
+		return 0;
+	}
+#ifndef NDEBUG
+	std::cout<<"Unoptimized build, timings will not be representative; build the Benchmark configuration.\n";
+#endif
+	try
+	{
+		auto sizes=parse_csv(argc>1?argv[1]:"12,256,128,4");
+		if(sizes.size()<2)
+		{
+			throw std::invalid_argument("Need at least 2 layers");
+		}
+		sizes.front()*=sizes.front();
+		sizes.back()*=sizes.back();
+		auto const batches=parse_csv(argc>2?argv[2]:"1,16,64,256");
+		unsigned int const scale=argc>3?static_cast<unsigned int>(std::strtoul(argv[3],nullptr,10)):2;
+		double const seconds=argc>4?std::strtod(argv[4],nullptr):1;
+		std::mt19937 gen(5489);
+		auto const n=make_net(sizes,gen);
+		std::cout<<"Layers";
+		for(auto const s:sizes)
+		{
+			std::cout<<' '<<s;
+		}
+		std::cout<<'\n';
+		forward(n,batches,seconds,gen);
+		training(n,batches,seconds,gen);
+		per_layer(sizes,batches.back(),seconds,gen);
+		page(n,scale,batches.back(),seconds,gen);
+	}
+	catch(std::exception const& err)
+	{
+		std::cout<<err.what()<<'\n';
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,314 @@
+#ifndef CONV_NET_H
+#define CONV_NET_H
+#include "neural_net.h"
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+namespace neural_net {
+
+	/*
+		out_channels filters of kernel x kernel x in_channels, applied without padding.
+		Weights are stored [out][ky][kx][in], so that row ky of a filter lines up with kernel*in_channels
+		consecutive values of a plane that keeps the channels of each pixel together.
+	*/
+	struct conv_layer {
+	private:
+		size_t _kernel;
+		size_t _in_channels;
+		size_t _out_channels;
+		std::unique_ptr<DataType[]> _weights;
+		std::unique_ptr<DataType[]> _biases;
+	public:
+		conv_layer(size_t kernel,size_t in_channels,size_t out_channels):
+			_kernel(kernel),_in_channels(in_channels),_out_channels(out_channels),
+			_weights(new DataType[out_channels*kernel*kernel*in_channels]),
+			_biases(new DataType[out_channels])
+		{
+			if(kernel%2==0)
+			{
+				throw std::invalid_argument("Kernel size must be odd");
+			}
+		}
+		conv_layer(conv_layer&&)=default;
+		conv_layer& operator=(conv_layer&&)=default;
+		size_t kernel() const
+		{
+			return _kernel;
+		}
+		size_t in_channels() const
+		{
+			return _in_channels;
+		}
+		size_t out_channels() const
+		{
+			return _out_channels;
+		}
+		//values in one filter
+		size_t filter_size() const
+		{
+			return _kernel*_kernel*_in_channels;
+		}
+		//pixels lost from each side of a plane
+		size_t radius() const
+		{
+			return _kernel/2;
+		}
+		DataType* weights()
+		{
+			return _weights.get();
+		}
+		DataType const* weights() const
+		{
+			return _weights.get();
+		}
+		DataType* biases()
+		{
+			return _biases.get();
+		}
+		DataType const* biases() const
+		{
+			return _biases.get();
+		}
+	};
+
+	/*
+		Scratch space for a conv_net run over planes of up to height x width input pixels.
+		Not safe to share between threads; each thread should have its own.
+	*/
+	struct conv_workspace {
+	private:
+		size_t _height;
+		size_t _width;
+		std::unique_ptr<DataType[]> _planes[2];
+		std::unique_ptr<DataType[]> _columns;
+	public:
+		//pixels of an output row gathered at once for the product with the filters
+		static constexpr size_t chunk=64;
+		conv_workspace():_height(0),_width(0)
+		{}
+		conv_workspace(std::vector<conv_layer> const& layers,size_t height,size_t width):_height(height),_width(width)
+		{
+			size_t widest_plane=0;
+			size_t widest_filter=0;
+			for(size_t i=0;i<layers.size();++i)
+			{
+				auto const& l=layers[i];
+				widest_filter=std::max(widest_filter,l.filter_size());
+				height-=2*l.radius();
+				width-=2*l.radius();
+				if(i+1<layers.size())
+				{
+					widest_plane=std::max(widest_plane,height*width*l.out_channels());
+				}
+			}
+			for(auto& plane:_planes)
+			{
+				plane.reset(new DataType[widest_plane]);
+			}
+			_columns.reset(new DataType[chunk*widest_filter]);
+		}
+		size_t height() const
+		{
+			return _height;
+		}
+		size_t width() const
+		{
+			return _width;
+		}
+		DataType* plane(size_t i)
+		{
+			return _planes[i%2].get();
+		}
+		DataType* columns()
+		{
+			return _columns.get();
+		}
+	};
+
+	/*
+		A stack of convolutions, with the activation function applied after each.
+		Each layer only sees the pixels within its radius, so running the net over a plane
+		computes every output pixel while sharing the work of overlapping windows.
+	*/
+	template<typename ActivationFunc=clipped_leaky_relu_t<>>
+	class conv_net:private ActivationFunc {
+		std::vector<conv_layer> _layers;
+	public:
+		conv_net()=default;
+		explicit conv_net(std::vector<conv_layer>&& layers):_layers(std::move(layers))
+		{
+			if(_layers.empty())
+			{
+				throw std::invalid_argument("Convolutional net needs a layer");
+			}
+			for(size_t i=1;i<_layers.size();++i)
+			{
+				if(_layers[i].in_channels()!=_layers[i-1].out_channels())
+				{
+					throw std::invalid_argument("Channels of consecutive layers do not match");
+				}
+			}
+		}
+		std::vector<conv_layer>& layers()
+		{
+			return _layers;
+		}
+		std::vector<conv_layer> const& layers() const
+		{
+			return _layers;
+		}
+		size_t in_channels() const
+		{
+			return _layers.front().in_channels();
+		}
+		size_t out_channels() const
+		{
+			return _layers.back().out_channels();
+		}
+		//how far the input of each output pixel reaches on any side
+		size_t radius() const
+		{
+			size_t r=0;
+			for(auto const& l:_layers)
+			{
+				r+=l.radius();
+			}
+			return r;
+		}
+
+		conv_net& randomize()
+		{
+			std::random_device rd;
+			std::mt19937 gen(rd());
+			std::normal_distribution<DataType> urd(0,1);
+			for(auto& l:_layers)
+			{
+				auto const limit=l.out_channels()*l.filter_size();
+				for(size_t j=0;j<limit;++j)
+				{
+					l.weights()[j]=urd(gen);
+				}
+				for(size_t j=0;j<l.out_channels();++j)
+				{
+					l.biases()[j]=urd(gen);
+				}
+			}
+			return *this;
+		}
+
+		conv_workspace make_workspace(size_t height,size_t width) const
+		{
+			return conv_workspace(_layers,height,width);
+		}
+
+		/*
+			Runs the net over a height x width plane of input, with the channels of each pixel together,
+			and writes the (height-2*radius()) x (width-2*radius()) pixels of the last layer to output the same way.
+			The plane must fit in ws.
+		*/
+		void feed_forward(conv_workspace& ws,DataType* const output,DataType const* const input,size_t height,size_t width) const
+		{
+			assert(height<=ws.height()&&width<=ws.width());
+			assert(height>2*radius()&&width>2*radius());
+			DataType const* src=input;
+			for(size_t i=0;i<_layers.size();++i)
+			{
+				auto const& l=_layers[i];
+				auto const k=l.kernel();
+				auto const in_channels=l.in_channels();
+				auto const out_channels=l.out_channels();
+				auto const filter_size=l.filter_size();
+				auto const row_size=k*in_channels;
+				auto const out_height=height-k+1;
+				auto const out_width=width-k+1;
+				DataType* const dst=i+1==_layers.size()?output:ws.plane(i);
+				auto const columns=ws.columns();
+				for(size_t y=0;y<out_height;++y)
+				{
+					for(size_t x0=0;x0<out_width;x0+=conv_workspace::chunk)
+					{
+						size_t const count=std::min(conv_workspace::chunk,out_width-x0);
+						//each window becomes one row of filter_size values
+						for(size_t x=0;x<count;++x)
+						{
+							auto const column=columns+x*filter_size;
+							for(size_t dy=0;dy<k;++dy)
+							{
+								std::memcpy(column+dy*row_size,src+((y+dy)*width+x0+x)*in_channels,row_size*sizeof(DataType));
+							}
+						}
+						auto const out=dst+(y*out_width+x0)*out_channels;
+						layer_batch(out,out,l.weights(),l.biases(),columns,out_channels,filter_size,count,static_cast<ActivationFunc const&>(*this));
+					}
+				}
+				height=out_height;
+				width=out_width;
+				src=dst;
+			}
+		}
+
+		template<typename Stream>
+		void save(Stream& file) const
+		{
+			auto bwrite=[&](auto a)
+			{
+				file.write(reinterpret_cast<char const*>(&a),sizeof(decltype(a)));
+			};
+			auto bwrite_row=[&](auto const* a,size_t count)
+			{
+				file.write(reinterpret_cast<char const*>(a),count*sizeof(decltype(*a)));
+			};
+			bwrite(uint64_t{_layers.size()});
+			for(auto const& l:_layers)
+			{
+				bwrite(uint64_t{l.kernel()});
+				bwrite(uint64_t{l.in_channels()});
+				bwrite(uint64_t{l.out_channels()});
+			}
+			for(auto const& l:_layers)
+			{
+				bwrite_row(l.biases(),l.out_channels());
+				bwrite_row(l.weights(),l.out_channels()*l.filter_size());
+			}
+		}
+
+		template<typename Stream>
+		void load(Stream& src)
+		{
+			auto bread=[&](auto* a,size_t count)
+			{
+				if(!src.read(reinterpret_cast<char*>(a),count*sizeof(*a)))
+				{
+					throw std::runtime_error("Convolutional net ended early");
+				}
+			};
+			auto read_size=[&]()
+			{
+				uint64_t size;
+				bread(&size,1);
+				if(size==0||size>std::numeric_limits<uint32_t>::max())
+				{
+					throw std::invalid_argument("Net sizes too large.");
+				}
+				return static_cast<size_t>(size);
+			};
+			auto const layer_count=read_size();
+			std::vector<conv_layer> layers;
+			layers.reserve(layer_count);
+			for(size_t i=0;i<layer_count;++i)
+			{
+				auto const kernel=read_size();
+				auto const in_channels=read_size();
+				auto const out_channels=read_size();
+				layers.emplace_back(kernel,in_channels,out_channels);
+			}
+			for(auto& l:layers)
+			{
+				bread(l.biases(),l.out_channels());
+				bread(l.weights(),l.out_channels()*l.filter_size());
+			}
+			*this=conv_net(std::move(layers));
+		}
+	};
+}
+#endif
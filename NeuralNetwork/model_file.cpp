@@ -0,0 +1,230 @@
+#include "neural_scaler.h"
+#include "model_file.h"
+#include <cstring>
+#include <fstream>
+#include <limits>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+namespace ScoreProcessor {
+	namespace model_file {
+		mapping::mapping(char const* path) noexcept:_data(nullptr),_size(0)
+		{
+#ifdef _WIN32
+			HANDLE const file=CreateFileA(path,GENERIC_READ,FILE_SHARE_READ,nullptr,OPEN_EXISTING,FILE_FLAG_RANDOM_ACCESS,nullptr);
+			if(file==INVALID_HANDLE_VALUE)
+			{
+				return;
+			}
+			LARGE_INTEGER size;
+			if(GetFileSizeEx(file,&size)&&size.QuadPart>0&&static_cast<unsigned long long>(size.QuadPart)<=SIZE_MAX)
+			{
+				if(HANDLE const map=CreateFileMappingA(file,nullptr,PAGE_READONLY,0,0,nullptr))
+				{
+					//the view keeps the mapping and file alive on its own
+					_data=static_cast<unsigned char const*>(MapViewOfFile(map,FILE_MAP_READ,0,0,0));
+					if(_data)
+					{
+						_size=static_cast<std::size_t>(size.QuadPart);
+					}
+					CloseHandle(map);
+				}
+			}
+			CloseHandle(file);
+#else
+			int const file=open(path,O_RDONLY);
+			if(file<0)
+			{
+				return;
+			}
+			struct stat info;
+			if(fstat(file,&info)==0&&info.st_size>0)
+			{
+				void* const view=mmap(nullptr,static_cast<std::size_t>(info.st_size),PROT_READ,MAP_SHARED,file,0);
+				if(view!=MAP_FAILED)
+				{
+					//every weight is read for each batch, so bring them all in now
+					madvise(view,static_cast<std::size_t>(info.st_size),MADV_WILLNEED);
+					_data=static_cast<unsigned char const*>(view);
+					_size=static_cast<std::size_t>(info.st_size);
+				}
+			}
+			close(file);
+#endif
+		}
+
+		mapping::~mapping()
+		{
+			if(_data)
+			{
+#ifdef _WIN32
+				UnmapViewOfFile(_data);
+#else
+				munmap(const_cast<unsigned char*>(_data),_size);
+#endif
+			}
+		}
+
+		bool is_model_file(char const* path)
+		{
+			std::ifstream file(path,std::ios::in|std::ios::binary);
+			char start[sizeof(magic)];
+			return file.read(start,sizeof(start))&&std::memcmp(start,magic,sizeof(magic))==0;
+		}
+	}
+
+	namespace {
+		std::uint64_t align_up(std::uint64_t offset)
+		{
+			return (offset+model_file::alignment-1)/model_file::alignment*model_file::alignment;
+		}
+	}
+
+	void neural_scaler::save_mappable(char const* path) const
+	{
+		if(_quantized||_conv)
+		{
+			throw std::logic_error("Only fp32 fully connected scalers can be saved as model files");
+		}
+		auto const& layers=_net.layers();
+		model_file::header head;
+		std::memcpy(head.magic,model_file::magic,sizeof(head.magic));
+		head.version=model_file::version;
+		head.header_size=sizeof(head);
+		head.scale=_nscale;
+		head.layer_count=layers.size();
+		std::vector<model_file::layer_entry> entries(layers.size());
+		std::uint64_t offset=align_up(sizeof(head)+entries.size()*sizeof(model_file::layer_entry));
+		for(size_t i=0;i<layers.size();++i)
+		{
+			auto& entry=entries[i];
+			entry.neurons=layers[i].neuron_count();
+			if(i==0)
+			{
+				entry.biases=0;
+				entry.weights=0;
+				continue;
+			}
+			entry.biases=offset;
+			offset=align_up(offset+entry.neurons*sizeof(float));
+			entry.weights=offset;
+			offset=align_up(offset+entry.neurons*layers[i-1].neuron_count()*sizeof(float));
+		}
+		head.file_size=offset;
+
+		std::ofstream file(path,std::ios::out|std::ios::binary);
+		if(!file)
+		{
+			throw std::runtime_error("Failed to save");
+		}
+		std::uint64_t written=0;
+		auto write=[&](void const* data,std::uint64_t size)
+		{
+			file.write(static_cast<char const*>(data),size);
+			written+=size;
+		};
+		auto pad_to=[&](std::uint64_t to)
+		{
+			char const zeros[model_file::alignment]={};
+			write(zeros,to-written);
+		};
+		write(&head,sizeof(head));
+		write(entries.data(),entries.size()*sizeof(model_file::layer_entry));
+		for(size_t i=1;i<layers.size();++i)
+		{
+			pad_to(entries[i].biases);
+			write(layers[i].biases(),entries[i].neurons*sizeof(float));
+			pad_to(entries[i].weights);
+			write(layers[i].weights(),entries[i].neurons*layers[i-1].neuron_count()*sizeof(float));
+		}
+		pad_to(head.file_size);
+		if(!file)
+		{
+			throw std::runtime_error("Failed to save");
+		}
+	}
+
+	void neural_scaler::load_mappable(char const* path)
+	{
+		auto map=std::make_shared<model_file::mapping>(path);
+		if(!*map)
+		{
+			throw std::runtime_error("Failed to map model file");
+		}
+		auto const data=map->data();
+		auto const size=map->size();
+		model_file::header head;
+		if(size<sizeof(head))
+		{
+			throw std::runtime_error("Model file ended early");
+		}
+		std::memcpy(&head,data,sizeof(head));
+		if(std::memcmp(head.magic,model_file::magic,sizeof(head.magic)))
+		{
+			throw std::invalid_argument("Not a model file");
+		}
+		if(head.version>model_file::version)
+		{
+			throw std::invalid_argument("Model file version too new");
+		}
+		if(head.header_size<sizeof(head)||head.header_size>size||head.file_size>size)
+		{
+			throw std::runtime_error("Model file ended early");
+		}
+		if(head.scale==0||head.scale>std::numeric_limits<unsigned int>::max())
+		{
+			throw std::invalid_argument("Invalid scale factor");
+		}
+		if(head.layer_count<2||head.layer_count>(size-head.header_size)/sizeof(model_file::layer_entry))
+		{
+			throw std::invalid_argument("Invalid layer count");
+		}
+		//a block fits if it lies inside the file and starts where the floats can be used in place
+		auto check_block=[data,size](std::uint64_t offset,std::uint64_t count)
+		{
+			if(offset%model_file::alignment||offset>size||count>(size-offset)/sizeof(float))
+			{
+				throw std::invalid_argument("Model file block out of place");
+			}
+			return reinterpret_cast<float const*>(data+offset);
+		};
+		std::vector<neural_net::layer> layers;
+		layers.reserve(head.layer_count);
+		std::uint64_t previous=0;
+		for(std::uint64_t i=0;i<head.layer_count;++i)
+		{
+			model_file::layer_entry entry;
+			std::memcpy(&entry,data+head.header_size+i*sizeof(entry),sizeof(entry));
+			if(entry.neurons==0||entry.neurons>std::numeric_limits<uint32_t>::max())
+			{
+				throw std::invalid_argument("Net sizes too large.");
+			}
+			if(i==0)
+			{
+				layers.emplace_back(static_cast<size_t>(entry.neurons));
+			}
+			else
+			{
+				auto const biases=check_block(entry.biases,entry.neurons);
+				auto const weights=check_block(entry.weights,entry.neurons*previous);
+				layers.emplace_back(static_cast<size_t>(entry.neurons),weights,biases);
+			}
+			previous=entry.neurons;
+		}
+		neural_net::net<> net;
+		net.layers()=std::move(layers);
+		auto res=assert_dim(static_cast<unsigned int>(head.scale),net);
+		_nscale=static_cast<unsigned int>(head.scale);
+		_in_dim=std::get<1>(res);
+		_out_dim=std::get<0>(res);
+		_net=std::move(net);
+		_quantized.reset();
+		_conv.reset();
+		_mapping=std::move(map);
+	}
+}
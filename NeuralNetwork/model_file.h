@@ -0,0 +1,65 @@
+#ifndef MODEL_FILE_H
+#define MODEL_FILE_H
+#include <cstdint>
+#include <cstddef>
+namespace ScoreProcessor {
+	/*
+		A model file that can be mapped and used in place. All values are little-endian.
+		The header is followed by one layer_entry per layer, and then by the biases and weights of every layer
+		after the first, each block starting on a multiple of alignment bytes from the start of the file.
+	*/
+	namespace model_file {
+		constexpr char magic[8]={'S','S','N','M','O','D','E','L'};
+		//files with a newer version are refused, older ones are read as their version says
+		constexpr std::uint32_t version=1;
+		constexpr std::uint64_t alignment=64;
+
+		struct header {
+			char magic[8];
+			std::uint32_t version;
+			std::uint32_t header_size; //bytes up to the first layer_entry
+			std::uint64_t scale;
+			std::uint64_t layer_count;
+			std::uint64_t file_size;
+		};
+
+		struct layer_entry {
+			std::uint64_t neurons;
+			//offsets from the start of the file, 0 for the first layer, which has neither
+			std::uint64_t biases;
+			std::uint64_t weights;
+		};
+
+		/*
+			A whole file mapped read-only, so its pages are shared with every other process mapping the same file.
+			Empty if the file could not be opened or mapped.
+		*/
+		class mapping {
+			unsigned char const* _data;
+			std::size_t _size;
+		public:
+			explicit mapping(char const* path) noexcept;
+			mapping(mapping const&)=delete;
+			mapping& operator=(mapping const&)=delete;
+			~mapping();
+			unsigned char const* data() const noexcept
+			{
+				return _data;
+			}
+			std::size_t size() const noexcept
+			{
+				return _size;
+			}
+			explicit operator bool() const noexcept
+			{
+				return _data!=nullptr;
+			}
+		};
+
+		/*
+			Whether the file starts with the magic of a mappable model file.
+		*/
+		bool is_model_file(char const* path);
+	}
+}
+#endif
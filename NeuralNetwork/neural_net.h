@@ -13,6 +13,16 @@
 #include <ratio>
 #include <fstream>
 #include <string>
+#include <cstring>
+#include <cmath>
+#include <type_traits>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+//the 8 wide kernels use FMA too; MSVC allows it with /arch:AVX2, which the Release configurations set
+#if defined(__AVX2__)&&(defined(__FMA__)||defined(_MSC_VER))
+#define NEURAL_NET_AVX2
+#endif
 namespace neural_net {
 
 	using DataType=float;
@@ -50,16 +60,55 @@ namespace neural_net {
 		}
 	}
 
+	namespace detail {
+#ifdef NEURAL_NET_AVX2
+		inline float horizontal_sum(__m256 v)
+		{
+			__m128 const half=_mm_add_ps(_mm256_castps256_ps128(v),_mm256_extractf128_ps(v,1));
+			__m128 const quarter=_mm_add_ps(half,_mm_movehl_ps(half,half));
+			return _mm_cvtss_f32(_mm_add_ss(quarter,_mm_shuffle_ps(quarter,quarter,1)));
+		}
+#endif
+	}
+
 	inline DataType dot(DataType const* a,DataType const* b,size_t n)
 	{
 		DataType sum=0;
-		for(size_t i=0;i<n;++i)
+		size_t i=0;
+#ifdef NEURAL_NET_AVX2
+		__m256 acc0=_mm256_setzero_ps();
+		__m256 acc1=_mm256_setzero_ps();
+		for(;i+16<=n;i+=16)
+		{
+			acc0=_mm256_fmadd_ps(_mm256_loadu_ps(a+i),_mm256_loadu_ps(b+i),acc0);
+			acc1=_mm256_fmadd_ps(_mm256_loadu_ps(a+i+8),_mm256_loadu_ps(b+i+8),acc1);
+		}
+		sum=detail::horizontal_sum(_mm256_add_ps(acc0,acc1));
+#endif
+		for(;i<n;++i)
 		{
 			sum+=a[i]*b[i];
 		}
 		return sum;
 	}
 
+	//dst[i]+=a*x[i]
+	inline void axpy(DataType* const dst,DataType const a,DataType const* const x,size_t const n)
+	{
+		size_t i=0;
+#ifdef NEURAL_NET_AVX2
+		__m256 const va=_mm256_set1_ps(a);
+		for(;i+8<=n;i+=8)
+		{
+			_mm256_storeu_ps(dst+i,_mm256_fmadd_ps(va,_mm256_loadu_ps(x+i),_mm256_loadu_ps(dst+i)));
+		}
+#endif
+		for(;i<n;++i)
+		{
+			dst[i]+=a*x[i];
+		}
+	}
+
 	//dst += mat * col
 	inline void matrix_t_col(DataType* const dst,DataType const* const mat,DataType const* const col,size_t const rows,size_t const cols)
 	{
@@ -74,6 +123,71 @@ namespace neural_net {
 		}
 	}
 
+	namespace detail {
+		//dst[s*dst_stride+r] += dot(mat row r,src row s) over k values, for 4 rows and 4 samples
+		//if bias is not null, dst[s*dst_stride+r] = bias[r] + the dot instead
+		inline void matrix_t_batch_4x4(DataType* const dst,size_t const dst_stride,
+			DataType const* const mat,size_t const mat_stride,
+			DataType const* const src,size_t const src_stride,size_t const k,
+			DataType const* const bias=nullptr)
+		{
+			DataType const* m[4]={mat,mat+mat_stride,mat+2*mat_stride,mat+3*mat_stride};
+			DataType const* x[4]={src,src+src_stride,src+2*src_stride,src+3*src_stride};
+			DataType acc[4][4]={};
+			size_t c=0;
+#ifdef NEURAL_NET_AVX2
+			__m256 v[4][4];
+			for(auto& row:v)
+			{
+				for(auto& a:row)
+				{
+					a=_mm256_setzero_ps();
+				}
+			}
+			for(;c+8<=k;c+=8)
+			{
+				__m256 const m0=_mm256_loadu_ps(m[0]+c);
+				__m256 const m1=_mm256_loadu_ps(m[1]+c);
+				__m256 const m2=_mm256_loadu_ps(m[2]+c);
+				__m256 const m3=_mm256_loadu_ps(m[3]+c);
+				for(unsigned int s=0;s<4;++s)
+				{
+					__m256 const xs=_mm256_loadu_ps(x[s]+c);
+					v[s][0]=_mm256_fmadd_ps(m0,xs,v[s][0]);
+					v[s][1]=_mm256_fmadd_ps(m1,xs,v[s][1]);
+					v[s][2]=_mm256_fmadd_ps(m2,xs,v[s][2]);
+					v[s][3]=_mm256_fmadd_ps(m3,xs,v[s][3]);
+				}
+			}
+			for(unsigned int s=0;s<4;++s)
+			{
+				for(unsigned int r=0;r<4;++r)
+				{
+					acc[s][r]=horizontal_sum(v[s][r]);
+				}
+			}
+#endif
+			for(;c<k;++c)
+			{
+				for(unsigned int s=0;s<4;++s)
+				{
+					for(unsigned int r=0;r<4;++r)
+					{
+						acc[s][r]+=m[r][c]*x[s][c];
+					}
+				}
+			}
+			for(unsigned int s=0;s<4;++s)
+			{
+				for(unsigned int r=0;r<4;++r)
+				{
+					auto& d=dst[s*dst_stride+r];
+					d=(bias?bias[r]:d)+acc[s][r];
+				}
+			}
+		}
+	}
+
 	//dst += (mat)T * col
 	inline void matrix_trans_t_col(DataType* const dst,DataType const* const mat,DataType const* const col,size_t const rows,size_t const cols)
 	{
@@ -88,6 +202,24 @@ namespace neural_net {
 		}
 	}
 
+	//dst += (a)T * b, where a holds batch rows of rows values, b holds batch rows of cols values, and dst is rows x cols
+	//the sum of the outer products of each sample
+	inline void outer_batch(DataType* const dst,DataType const* const a,DataType const* const b,size_t const rows,size_t const cols,size_t const batch)
+	{
+		for(size_t r=0;r<rows;++r)
+		{
+			auto const dst_row=dst+r*cols;
+			for(size_t s=0;s<batch;++s)
+			{
+				auto const v=a[s*rows+r];
+				if(v!=0)
+				{
+					axpy(dst_row,v,b+s*cols,cols);
+				}
+			}
+		}
+	}
+
 	inline DataType sigmoid(DataType x)
 	{
 		return 1.0/(1.0+exp(-x));
@@ -138,6 +270,13 @@ namespace neural_net {
 			}
 			return 0;
 		}
+#ifdef NEURAL_NET_AVX2
+		static constexpr bool vectorized=true;
+		inline __m256 operator()(__m256 x) const
+		{
+			return _mm256_and_ps(_mm256_cmp_ps(x,_mm256_setzero_ps(),_CMP_GT_OQ),_mm256_set1_ps(1));
+		}
+#endif
 	};
 	struct relu_t {
 		using derivative=relu_deriv_t;
@@ -149,6 +288,13 @@ namespace neural_net {
 			}
 			return 0;
 		}
+#ifdef NEURAL_NET_AVX2
+		static constexpr bool vectorized=true;
+		inline __m256 operator()(__m256 x) const
+		{
+			return _mm256_max_ps(x,_mm256_setzero_ps());
+		}
+#endif
 	};
 
 	//Leak should be an std::ratio or other class that defines num and den
@@ -162,6 +308,14 @@ namespace neural_net {
 			}
 			return static_cast<DataType>(Leak::num)/Leak::den;
 		}
+#ifdef NEURAL_NET_AVX2
+		static constexpr bool vectorized=true;
+		inline __m256 operator()(__m256 x) const
+		{
+			__m256 const leak=_mm256_set1_ps(static_cast<DataType>(Leak::num)/Leak::den);
+			return _mm256_blendv_ps(leak,_mm256_set1_ps(1),_mm256_cmp_ps(x,_mm256_setzero_ps(),_CMP_GT_OQ));
+		}
+#endif
 	};
 	//Leak should be an std::ratio or other class that defines num and den
 	template<typename Leak=std::ratio<1,32>>
@@ -175,6 +329,14 @@ namespace neural_net {
 			}
 			return (static_cast<DataType>(Leak::num)/Leak::den)*x;
 		}
+#ifdef NEURAL_NET_AVX2
+		static constexpr bool vectorized=true;
+		inline __m256 operator()(__m256 x) const
+		{
+			__m256 const leaked=_mm256_mul_ps(_mm256_set1_ps(static_cast<DataType>(Leak::num)/Leak::den),x);
+			return _mm256_blendv_ps(leaked,x,_mm256_cmp_ps(x,_mm256_setzero_ps(),_CMP_GT_OQ));
+		}
+#endif
 	};
 
 	template<typename Leak,typename Clip>
@@ -189,6 +351,16 @@ namespace neural_net {
 			}
 			return 1;
 		}
+#ifdef NEURAL_NET_AVX2
+		static constexpr bool vectorized=true;
+		inline __m256 operator()(__m256 x) const
+		{
+			__m256 const outside=_mm256_or_ps(
+				_mm256_cmp_ps(x,_mm256_set1_ps(clip),_CMP_GT_OQ),
+				_mm256_cmp_ps(x,_mm256_setzero_ps(),_CMP_LT_OQ));
+			return _mm256_blendv_ps(_mm256_set1_ps(1),_mm256_set1_ps(leak),outside);
+		}
+#endif
 	};
 
 
@@ -210,19 +382,197 @@ namespace neural_net {
 			}
 			return x;
 		}
+#ifdef NEURAL_NET_AVX2
+		static constexpr bool vectorized=true;
+		inline __m256 operator()(__m256 x) const
+		{
+			constexpr DataType off=(1-leak)*clip;
+			__m256 const vleak=_mm256_set1_ps(leak);
+			__m256 const leaked=_mm256_mul_ps(vleak,x);
+			__m256 const clipped=_mm256_add_ps(_mm256_set1_ps(off),_mm256_mul_ps(x,vleak));
+			__m256 const low=_mm256_blendv_ps(x,leaked,_mm256_cmp_ps(x,_mm256_setzero_ps(),_CMP_LT_OQ));
+			return _mm256_blendv_ps(low,clipped,_mm256_cmp_ps(x,_mm256_set1_ps(clip),_CMP_GT_OQ));
+		}
+#endif
 	};
 
+	namespace detail {
+		//whether Func also has an overload that applies it to 8 values at once, which it marks with vectorized=true
+		template<typename Func,typename=void>
+		struct is_vectorized:std::false_type {};
+		template<typename Func>
+		struct is_vectorized<Func,std::void_t<decltype(Func::vectorized)>>:std::bool_constant<Func::vectorized> {};
+	}
+
+	//dst[i]=f(src[i]), 8 at a time for the functors that can
+	template<typename Func>
+	inline void apply(DataType* const dst,DataType const* const src,size_t const n,Func const& f)
+	{
+		size_t i=0;
+#ifdef NEURAL_NET_AVX2
+		if constexpr(detail::is_vectorized<Func>::value)
+		{
+			for(;i+8<=n;i+=8)
+			{
+				_mm256_storeu_ps(dst+i,f(_mm256_loadu_ps(src+i)));
+			}
+		}
+#endif
+		for(;i<n;++i)
+		{
+			dst[i]=f(src[i]);
+		}
+	}
+
+	//dst[i]*=d(z[i])
+	template<typename Deriv>
+	inline void multiply_derivative(DataType* const dst,DataType const* const z,size_t const n,Deriv const& d)
+	{
+		size_t i=0;
+#ifdef NEURAL_NET_AVX2
+		if constexpr(detail::is_vectorized<Deriv>::value)
+		{
+			for(;i+8<=n;i+=8)
+			{
+				_mm256_storeu_ps(dst+i,_mm256_mul_ps(_mm256_loadu_ps(dst+i),d(_mm256_loadu_ps(z+i))));
+			}
+		}
+#endif
+		for(;i<n;++i)
+		{
+			dst[i]*=d(z[i]);
+		}
+	}
+
+	/*
+		out = f(src * (mat)T + biases), where src holds batch rows of cols values and out holds batch rows of rows values.
+		The sums before f are kept in sums, which may be out itself if they are not needed.
+		Every 4 samples get their biases with the first products and f as soon as their products are done,
+		so the sums are only gone over again while they are still in L1.
+	*/
+	template<typename Func>
+	inline void layer_batch(DataType* const sums,DataType* const out,
+		DataType const* const mat,DataType const* const biases,DataType const* const src,
+		size_t const rows,size_t const cols,size_t const batch,Func const& f)
+	{
+		//4 rows of mat and 4 samples at a time, with the shared dimension split so both panels stay in L1
+		constexpr size_t block=512;
+		size_t s=0;
+		for(;s+4<=batch;s+=4)
+		{
+			for(size_t k0=0;k0<cols;k0+=block)
+			{
+				size_t const k=std::min(block,cols-k0);
+				DataType const* const init=k0==0?biases:nullptr;
+				size_t r=0;
+				for(;r+4<=rows;r+=4)
+				{
+					detail::matrix_t_batch_4x4(sums+s*rows+r,rows,mat+r*cols+k0,cols,src+s*cols+k0,cols,k,init?init+r:nullptr);
+				}
+				for(;r<rows;++r)
+				{
+					for(size_t t=s;t<s+4;++t)
+					{
+						auto& d=sums[t*rows+r];
+						d=(init?init[r]:d)+dot(mat+r*cols+k0,src+t*cols+k0,k);
+					}
+				}
+			}
+			apply(out+s*rows,sums+s*rows,4*rows,f);
+		}
+		for(;s<batch;++s)
+		{
+			auto const sum_row=sums+s*rows;
+			for(size_t k0=0;k0<cols;k0+=block)
+			{
+				size_t const k=std::min(block,cols-k0);
+				for(size_t r=0;r<rows;++r)
+				{
+					sum_row[r]=(k0==0?biases[r]:sum_row[r])+dot(mat+r*cols+k0,src+s*cols+k0,k);
+				}
+			}
+			apply(out+s*rows,sum_row,rows,f);
+		}
+	}
+
+	/*
+		dst = (src * mat) * d(z), where src holds batch rows of rows values and dst and z hold batch rows of cols values.
+		Passes the deltas of a layer back through its weights and the derivative of the layer before,
+		doing each sample's row in one go while it is in L1.
+	*/
+	template<typename Deriv>
+	inline void matrix_batch_derivative(DataType* const dst,DataType const* const mat,DataType const* const src,DataType const* const z,
+		size_t const rows,size_t const cols,size_t const batch,Deriv const& d)
+	{
+		for(size_t s=0;s<batch;++s)
+		{
+			auto const dst_row=dst+s*cols;
+			auto const src_row=src+s*rows;
+			std::fill_n(dst_row,cols,DataType(0));
+			for(size_t r=0;r<rows;++r)
+			{
+				if(src_row[r]!=0)
+				{
+					axpy(dst_row,src_row[r],mat+r*cols,cols);
+				}
+			}
+			multiply_derivative(dst_row,z+s*cols,cols,d);
+		}
+	}
+
+	/*
+		delta = (a-answers) * d(z) for the n values of the last layer.
+		Returns the sum of the squared errors.
+	*/
+	template<typename Deriv>
+	inline DataType output_deltas(DataType* const delta,DataType const* const a,DataType const* const answers,DataType const* const z,size_t const n,Deriv const& d)
+	{
+		DataType error=0;
+		size_t i=0;
+#ifdef NEURAL_NET_AVX2
+		if constexpr(detail::is_vectorized<Deriv>::value)
+		{
+			__m256 acc=_mm256_setzero_ps();
+			for(;i+8<=n;i+=8)
+			{
+				__m256 const dc_da=_mm256_sub_ps(_mm256_loadu_ps(a+i),_mm256_loadu_ps(answers+i));
+				acc=_mm256_fmadd_ps(dc_da,dc_da,acc);
+				_mm256_storeu_ps(delta+i,_mm256_mul_ps(dc_da,d(_mm256_loadu_ps(z+i))));
+			}
+			error=detail::horizontal_sum(acc);
+		}
+#endif
+		for(;i<n;++i)
+		{
+			DataType const dc_da=a[i]-answers[i];
+			error+=dc_da*dc_da;
+			delta[i]=dc_da*d(z[i]);
+		}
+		return error;
+	}
+
 	struct layer {
 	private:
-		std::unique_ptr<DataType[]> _weights;
-		std::unique_ptr<DataType[]> _biases;
+		std::unique_ptr<DataType[]> _weight_storage;
+		std::unique_ptr<DataType[]> _bias_storage;
+		DataType* _weights;
+		DataType* _biases;
 		size_t _count;
 	public:
 		inline layer(layer&&)=default;
 		inline layer& operator=(layer&&)=default;
-		inline layer(size_t nodes):_weights(),_biases(),_count(nodes)
+		inline layer(size_t nodes):_weights(nullptr),_biases(nullptr),_count(nodes)
+		{}
+		inline layer(size_t nodes,size_t connections):
+			_weight_storage(new DataType[nodes*connections]),_bias_storage(new DataType[nodes]),
+			_weights(_weight_storage.get()),_biases(_bias_storage.get()),_count(nodes)
 		{}
-		inline layer(size_t nodes,size_t connections):_weights(new DataType[nodes*connections]),_biases(new DataType[nodes]),_count(nodes)
+		/*
+			A layer that uses weights and biases it does not own, such as those in a read-only mapped model file.
+			They must outlive the layer, and are never written through as long as the layer is only used const.
+		*/
+		inline layer(size_t nodes,DataType const* weights,DataType const* biases):
+			_weights(const_cast<DataType*>(weights)),_biases(const_cast<DataType*>(biases)),_count(nodes)
 		{}
 		inline size_t neuron_count() const
 		{
@@ -230,19 +580,19 @@ namespace neural_net {
 		}
 		inline DataType const* weights() const
 		{
-			return _weights.get();
+			return _weights;
 		}
 		inline DataType* weights()
 		{
-			return _weights.get();
+			return _weights;
 		}
 		inline DataType* biases()
 		{
-			return _biases.get();
+			return _biases;
 		}
 		inline DataType const* biases() const
 		{
-			return _biases.get();
+			return _biases;
 		}
 	};
 
@@ -258,6 +608,19 @@ namespace neural_net {
 		return ret;
 	}
 
+	//layers shaped like the given ones, with every weight and bias 0
+	inline std::vector<layer> zeroed_layers(std::vector<layer> const& layers)
+	{
+		auto ret=construct_layers(layers);
+		for(size_t i=1;i<ret.size();++i)
+		{
+			auto const nc=ret[i].neuron_count();
+			std::fill_n(ret[i].weights(),nc*ret[i-1].neuron_count(),DataType(0));
+			std::fill_n(ret[i].biases(),nc,DataType(0));
+		}
+		return ret;
+	}
+
 	struct results:public std::unique_ptr<std::unique_ptr<DataType[]>[]> {
 		using layer_results=std::unique_ptr<DataType[]>;
 		using base=std::unique_ptr<layer_results[]>;
@@ -293,10 +656,204 @@ namespace neural_net {
 		}
 	};
 
+	/*
+		Scratch space for forward passes of batches of up to batch() inputs, sized once from a net's layers.
+		Only activations are kept, alternating between two buffers, so earlier layers are overwritten.
+		Not safe to share between threads; each thread should have its own.
+	*/
+	struct workspace {
+	private:
+		std::unique_ptr<DataType[]> _data;
+		size_t _widest;
+		size_t _batch;
+	public:
+		inline workspace():_widest(0),_batch(0)
+		{}
+		inline workspace(std::vector<layer> const& layers,size_t batch=1):_widest(0),_batch(batch)
+		{
+			//the first layer is the input and the last goes straight to the output
+			for(size_t i=1;i+1<layers.size();++i)
+			{
+				_widest=std::max(_widest,layers[i].neuron_count());
+			}
+			_data.reset(new DataType[2*_widest*_batch]);
+		}
+		inline size_t batch() const
+		{
+			return _batch;
+		}
+		inline size_t widest() const
+		{
+			return _widest;
+		}
+		inline DataType* buffer(size_t i)
+		{
+			return _data.get()+(i%2)*_widest*_batch;
+		}
+	};
+
+	/*
+		Everything a training pass over a batch of up to batch() samples keeps for each layer:
+		the weighted sums, their activations, and the deltas found going backwards.
+		Not safe to share between threads; each thread should have its own.
+	*/
+	struct training_workspace {
+	private:
+		size_t _batch;
+		std::vector<std::unique_ptr<DataType[]>> _sums;
+		std::vector<std::unique_ptr<DataType[]>> _activations;
+		std::vector<std::unique_ptr<DataType[]>> _deltas;
+	public:
+		inline training_workspace():_batch(0)
+		{}
+		inline training_workspace(std::vector<layer> const& layers,size_t batch):_batch(batch)
+		{
+			_sums.resize(layers.size());
+			_activations.resize(layers.size());
+			_deltas.resize(layers.size());
+			_activations[0].reset(new DataType[layers[0].neuron_count()*batch]);
+			for(size_t i=1;i<layers.size();++i)
+			{
+				auto const size=layers[i].neuron_count()*batch;
+				_sums[i].reset(new DataType[size]);
+				_activations[i].reset(new DataType[size]);
+				_deltas[i].reset(new DataType[size]);
+			}
+		}
+		inline size_t batch() const
+		{
+			return _batch;
+		}
+		inline DataType* sums(size_t i)
+		{
+			return _sums[i].get();
+		}
+		inline DataType* activations(size_t i)
+		{
+			return _activations[i].get();
+		}
+		inline DataType* deltas(size_t i)
+		{
+			return _deltas[i].get();
+		}
+	};
+
+	enum class update_rule:unsigned char {
+		sgd,
+		momentum,
+		adam
+	};
+
+	/*
+		Applies gradients to the layers of a net, keeping whatever running state the update rule needs:
+		a velocity per weight for momentum, and the first and second moments for adam.
+	*/
+	class optimizer {
+		update_rule _rule;
+		DataType _learning_rate;
+		DataType _beta1;
+		DataType _beta2;
+		DataType _epsilon;
+		size_t _steps;
+		std::vector<layer> _first;
+		std::vector<layer> _second;
+
+		void apply(DataType* const params,DataType const* const grads,DataType* const first,DataType* const second,size_t const n,DataType const scale) const
+		{
+			switch(_rule)
+			{
+				case update_rule::sgd:
+					axpy(params,-_learning_rate*scale,grads,n);
+					break;
+				case update_rule::momentum:
+					for(size_t j=0;j<n;++j)
+					{
+						first[j]=_beta1*first[j]+grads[j]*scale;
+						params[j]-=_learning_rate*first[j];
+					}
+					break;
+				case update_rule::adam:
+				{
+					DataType const correction1=1-std::pow(_beta1,DataType(_steps));
+					DataType const correction2=1-std::pow(_beta2,DataType(_steps));
+					DataType const step=_learning_rate*std::sqrt(correction2)/correction1;
+					for(size_t j=0;j<n;++j)
+					{
+						DataType const g=grads[j]*scale;
+						first[j]=_beta1*first[j]+(1-_beta1)*g;
+						second[j]=_beta2*second[j]+(1-_beta2)*g*g;
+						params[j]-=step*first[j]/(std::sqrt(second[j])+_epsilon);
+					}
+					break;
+				}
+			}
+		}
+	public:
+		inline optimizer(std::vector<layer> const& layers,update_rule rule,DataType learning_rate,DataType beta1=0.9f,DataType beta2=0.999f,DataType epsilon=1e-8f):
+			_rule(rule),_learning_rate(learning_rate),_beta1(beta1),_beta2(beta2),_epsilon(epsilon),_steps(0)
+		{
+			if(rule!=update_rule::sgd)
+			{
+				_first=zeroed_layers(layers);
+			}
+			if(rule==update_rule::adam)
+			{
+				_second=zeroed_layers(layers);
+			}
+		}
+		inline update_rule rule() const
+		{
+			return _rule;
+		}
+		inline DataType learning_rate() const
+		{
+			return _learning_rate;
+		}
+		inline void learning_rate(DataType rate)
+		{
+			_learning_rate=rate;
+		}
+		/*
+			Takes one step, where gradients hold the sum of the gradients of count samples.
+		*/
+		void update(std::vector<layer>& layers,std::vector<layer> const& gradients,size_t count)
+		{
+			if(count==0)
+			{
+				return;
+			}
+			++_steps;
+			DataType const scale=DataType(1)/count;
+			for(size_t i=1;i<layers.size();++i)
+			{
+				auto const nc=layers[i].neuron_count();
+				auto const weight_count=nc*layers[i-1].neuron_count();
+				auto const state=[&](std::vector<layer>& s,bool weights)->DataType*
+				{
+					if(s.empty())
+					{
+						return nullptr;
+					}
+					return weights?s[i].weights():s[i].biases();
+				};
+				apply(layers[i].weights(),gradients[i].weights(),state(_first,true),state(_second,true),weight_count,scale);
+				apply(layers[i].biases(),gradients[i].biases(),state(_first,false),state(_second,false),nc,scale);
+			}
+		}
+	};
+
 	template<typename ActivationFunc=clipped_leaky_relu_t<>,typename Deriv=typename ActivationFunc::derivative>
 	struct net:private ActivationFunc,private Deriv {
 	private:
 		std::vector<layer> _layers;
+		ActivationFunc const& activation_func() const
+		{
+			return *this;
+		}
+		Deriv const& derivative_func() const
+		{
+			return *this;
+		}
 	public:
 		inline std::vector<layer>& layers()
 		{
@@ -406,16 +963,8 @@ namespace neural_net {
 				auto const nc=weights.neuron_count();
 				auto& dst=ret[i];
 				auto& src=ret[i-1];
-				//initialize with weights
-				//std::copy(weights.biases(),weights.biases()+nc,dst.get());
-				std::memcpy(dst.get()+nc,weights.biases(),nc*sizeof(DataType));
-				//calculate z
-				matrix_t_col(dst.get()+nc,weights.weights(),src.get(),nc,connections);
-				//calculate Act(z)
-				std::transform(dst.get()+nc,dst.get()+size_t{2}*nc,dst.get(),[this](DataType f)
-				{
-					return ActivationFunc::operator()(f);
-				});
+				//z goes after Act(z) in each row of results, and both are written in one pass
+				layer_batch(dst.get()+nc,dst.get(),weights.weights(),weights.biases(),src.get(),nc,connections,1,activation_func());
 				/*for(size_t j=0;j<weights.neuron_count();++j)
 				{
 				auto const weight_row=weights.weights()+j*connections;
@@ -437,6 +986,85 @@ namespace neural_net {
 			return ret;
 		}
 
+		/*
+			Runs batch inputs through the net at once, writing the last layer of each to output.
+			input holds batch rows of the first layer's neuron count, output batch rows of the last layer's.
+			Nothing but the activations is kept, and those only in ws, which must fit the batch.
+		*/
+		void feed_forward(workspace& ws,DataType* const output,DataType const* const input,size_t const batch=1) const
+		{
+			assert(batch<=ws.batch());
+			DataType const* src=input;
+			for(size_t i=1;i<_layers.size();++i)
+			{
+				auto const connections=_layers[i-1].neuron_count();
+				auto const& weights=_layers[i];
+				auto const nc=weights.neuron_count();
+				assert(i+1==_layers.size()||nc<=ws.widest());
+				DataType* const dst=i+1==_layers.size()?output:ws.buffer(i);
+				layer_batch(dst,dst,weights.weights(),weights.biases(),src,nc,connections,batch,activation_func());
+				src=dst;
+			}
+		}
+
+		/*
+			Makes a workspace for this net's layers.
+		*/
+		workspace make_workspace(size_t batch=1) const
+		{
+			return workspace(_layers,batch);
+		}
+
+		/*
+			Runs batch inputs through the net, keeping the sums and activations of every layer in ws.
+		*/
+		void feed_forward_store(training_workspace& ws,DataType const* const input,size_t const batch) const
+		{
+			assert(batch<=ws.batch());
+			std::memcpy(ws.activations(0),input,batch*_layers.front().neuron_count()*sizeof(DataType));
+			for(size_t i=1;i<_layers.size();++i)
+			{
+				auto const connections=_layers[i-1].neuron_count();
+				auto const& weights=_layers[i];
+				auto const nc=weights.neuron_count();
+				layer_batch(ws.sums(i),ws.activations(i),weights.weights(),weights.biases(),ws.activations(i-1),nc,connections,batch,activation_func());
+			}
+		}
+
+		/*
+			Adds the gradients of the squared error of batch samples to gradients, which must be shaped like the net.
+			input and answers hold batch rows of the first and last layers' neuron counts.
+			Returns the sum of the squared errors.
+		*/
+		DataType accumulate_gradients(std::vector<layer>& gradients,training_workspace& ws,DataType const* const input,DataType const* const answers,size_t const batch) const
+		{
+			feed_forward_store(ws,input,batch);
+			size_t const last=_layers.size()-1;
+			auto const out_count=_layers[last].neuron_count();
+			DataType const error=output_deltas(ws.deltas(last),ws.activations(last),answers,ws.sums(last),out_count*batch,derivative_func());
+			for(size_t i=last;i>0;--i)
+			{
+				auto const nc=_layers[i].neuron_count();
+				auto const pnc=_layers[i-1].neuron_count();
+				auto const delta=ws.deltas(i);
+				outer_batch(gradients[i].weights(),delta,ws.activations(i-1),nc,pnc,batch);
+				auto const bias_grads=gradients[i].biases();
+				for(size_t s=0;s<batch;++s)
+				{
+					auto const delta_row=delta+s*nc;
+					for(size_t j=0;j<nc;++j)
+					{
+						bias_grads[j]+=delta_row[j];
+					}
+				}
+				if(i>1)
+				{
+					matrix_batch_derivative(ws.deltas(i-1),_layers[i].weights(),delta,ws.sums(i-1),nc,pnc,batch,derivative_func());
+				}
+			}
+			return error;
+		}
+
 		void update_weights(DataType* weights,DataType* biases,DataType const* activations,DataType const* deltas,size_t far_nodes,size_t near_nodes,DataType learning_rate)
 		{
 			for(size_t j=0;j<far_nodes;++j)
@@ -463,7 +1091,7 @@ namespace neural_net {
 				}
 				for(size_t j=0;j<_layers[i].neuron_count();++j)
 				{
-					_layers[i].biases()[j]-=gradients[j].biases()[j];
+					_layers[i].biases()[j]-=gradients[i].biases()[j];
 				}
 			}
 		}
@@ -531,14 +1159,7 @@ namespace neural_net {
 		{
 			size_t const last=_layers.size()-1;
 			auto const c=_layers[last].neuron_count();
-			for(size_t j=0;j<c;++j)
-			{
-				DataType const a=values[last][j];
-				DataType const dc_da=a-answers[j];
-				DataType const deriv=Deriv::operator()(values[last][j+c]);
-				deltas[last][j]=dc_da*deriv;
-				assert(!std::isnan(deltas[last][j]));
-			}
+			output_deltas(deltas[last].get(),values[last].get(),answers,values[last].get()+c,c,derivative_func());
 			for(size_t i=last;i>1;)
 			{
 				auto const prev=i-1;
@@ -546,15 +1167,8 @@ namespace neural_net {
 				auto& delta=deltas[i];
 				auto const nc=_layers[i].neuron_count();
 				auto const pnc=_layers[prev].neuron_count();
-				//initialize delta_prev to zero
-				std::fill(delta_prev.get(),delta_prev.get()+pnc,0.0f);
-				//calculate first part of delta_prev
-				matrix_trans_t_col(delta_prev.get(),_layers[i].weights(),delta.get(),nc,pnc);
-				//calculate second part of delta_prev
-				for(size_t j=0;j<pnc;++j)
-				{
-					delta_prev[j]*=Deriv::operator()(values[prev][j+pnc]);
-				}
+				//both parts of delta_prev in one pass
+				matrix_batch_derivative(delta_prev.get(),_layers[i].weights(),delta.get(),values[prev].get()+pnc,nc,pnc,1,derivative_func());
 				i=prev;
 			}
 		}
@@ -572,57 +1186,10 @@ namespace neural_net {
 			{
 				return;
 			}
-			auto const out_count=_layers.back().neuron_count();
-			auto const in_count=_layers.front().neuron_count();
-			results res(_layers);
-			delta_t dels(_layers);
-			std::vector<layer> average=construct_layers(_layers),single=construct_layers(_layers);
-			for(size_t i=1;i<average.size();++i)
-			{
-				size_t limit=average[i-1].neuron_count()*average[i].neuron_count();
-				for(size_t j=0;j<limit;++j)
-				{
-					average[i].weights()[j]=0;
-				}
-				for(size_t j=0;j<average[i].neuron_count();++j)
-				{
-					average[i].biases()[j]=0;
-				}
-			}
-			for(size_t n=0;n<num_inputs;++n)
-			{
-				auto const in_offset=in_count*n;
-				auto const out_offset=out_count*n;
-				feed_forward_store(res,input_data+in_offset);
-				calculate_deltas(dels,res,answers+out_offset);
-				calculate_grads(single.data(),dels,res);
-				for(size_t i=1;i<_layers.size();++i)
-				{
-					size_t limit=average[i-1].neuron_count()*average[i].neuron_count();
-					for(size_t j=0;j<limit;++j)
-					{
-						average[i].weights()[j]+=single[i].weights()[j];
-					}
-					for(size_t j=0;j<average[i].neuron_count();++j)
-					{
-						average[i].biases()[j]+=single[i].weights()[j];
-					}
-				}
-			}
-			auto adjustment=learning_rate/num_inputs;
-			for(size_t i=1;i<_layers.size();++i)
-			{
-				size_t limit=average[i-1].neuron_count()*average[i].neuron_count();
-				for(size_t j=0;j<limit;++j)
-				{
-					average[i].weights()[j]*=adjustment;
-				}
-				for(size_t j=0;j<average[i].neuron_count();++j)
-				{
-					average[i].biases()[j]*=adjustment;
-				}
-			}
-			update_weights(average.data());
+			training_workspace ws(_layers,num_inputs);
+			auto gradients=zeroed_layers(_layers);
+			accumulate_gradients(gradients,ws,input_data,answers,num_inputs);
+			update_weights(gradients.data(),learning_rate/num_inputs);
 		}
 		template<typename Stream>
 		auto save(Stream& file) -> typename std::enable_if<!std::is_convertible<Stream,char const*>::value>::type
@@ -2,6 +2,41 @@
 #include <assert.h>
 #include "../ScoreProcessor/lib/threadpool/thread_pool.h"
 namespace ScoreProcessor {
+	namespace {
+		//summed-area table of the pixels of an image that are not pure white
+		class dark_count_table {
+			std::unique_ptr<std::uint32_t[]> _counts;
+			size_t _stride;
+		public:
+			dark_count_table(cil::CImg<unsigned char> const& img):
+				_counts(new std::uint32_t[(size_t{img._width}+1)*(img._height+1)]),
+				_stride(size_t{img._width}+1)
+			{
+				std::fill_n(_counts.get(),_stride,0U);
+				for(size_t y=0;y<img._height;++y)
+				{
+					auto const img_row=img._data+y*img._width;
+					auto const above=_counts.get()+y*_stride;
+					auto const row=above+_stride;
+					row[0]=0;
+					std::uint32_t row_count=0;
+					for(size_t x=0;x<img._width;++x)
+					{
+						row_count+=img_row[x]!=255;
+						row[x+1]=above[x+1]+row_count;
+					}
+				}
+			}
+			//number of dark pixels in [x0,x1)x[y0,y1)
+			std::uint32_t count(size_t x0,size_t y0,size_t x1,size_t y1) const
+			{
+				auto const top=_counts.get()+y0*_stride;
+				auto const bottom=_counts.get()+y1*_stride;
+				return bottom[x1]-bottom[x0]-top[x1]+top[x0];
+			}
+		};
+	}
+
 	cil::CImg<unsigned char> neural_scaler::get_smart_scale(cil::CImg<unsigned char> const& img,float scale,unsigned int num_threads) const
 	{
 		if(scale<1)
@@ -17,6 +52,10 @@ namespace ScoreProcessor {
 		{
 			return img;
 		}
+		if(_conv)
+		{
+			return get_conv_smart_scale(img,scale,num_threads);
+		}
 		struct info {
 			unsigned int padding;
 			unsigned int input_dim;
@@ -36,29 +75,46 @@ namespace ScoreProcessor {
 		unsigned int desired_width=static_cast<unsigned int>(std::round(img._width*scale));
 		unsigned int desired_height=static_cast<unsigned int>(std::round(img._height*scale));
 
+		num_threads=std::max(1U,num_threads);
 		while(true)
 		{
-			Img upscaled(orig._width*s,orig._height*s);
-			struct Scaler {
-			protected:
-				unsigned int output_x;
-			public:
-				Scaler(unsigned int output_x):
-					output_x(output_x)
-				{}
-			private:
-				bool all_white(float const* input,size_t const limit) const
+			//blank input gives blank output, so only tiles whose window has a dark pixel go through the network
+			Img upscaled(orig._width*s,orig._height*s,1,1,255);
+			std::vector<std::pair<unsigned int,unsigned int>> tiles;
+			{
+				dark_count_table const dark(orig);
+				auto const clamp=[](std::ptrdiff_t v,std::ptrdiff_t limit)
 				{
-					for(size_t i=0;i<limit;++i)
+					return static_cast<size_t>(std::min(std::max<std::ptrdiff_t>(v,0),limit));
+				};
+				std::ptrdiff_t const pad=inf.padding;
+				for(unsigned int x=0;x<upscaled._width;x+=o)
+				{
+					std::ptrdiff_t const x_begin=std::ptrdiff_t(x/s)-pad;
+					auto const x0=clamp(x_begin,orig._width);
+					auto const x1=clamp(x_begin+i,orig._width);
+					for(unsigned int y=0;y<upscaled._height;y+=o)
 					{
-						if(input[i]!=1.0f)
+						std::ptrdiff_t const y_begin=std::ptrdiff_t(y/s)-pad;
+						if(dark.count(x0,clamp(y_begin,orig._height),x1,clamp(y_begin+i,orig._height)))
 						{
-							return false;
+							tiles.emplace_back(x,y);
 						}
 					}
-					return true;
 				}
-				void write_to_img(Img& out,float const* in_row,size_t const y,size_t const output_dim) const
+			}
+			//each task takes every step-th tile, so that its buffers are made once per thread
+			struct Scaler {
+			protected:
+				size_t first;
+				size_t step;
+				std::vector<std::pair<unsigned int,unsigned int>> const* tiles;
+			public:
+				Scaler(size_t first,size_t step,std::vector<std::pair<unsigned int,unsigned int>> const* tiles):
+					first(first),step(step),tiles(tiles)
+				{}
+			private:
+				void write_to_img(Img& out,float const* in_row,size_t const output_x,size_t const y,size_t const output_dim) const
 				{
 					auto const out_width=out._width;
 					auto out_row=out._data+out_width*y+output_x;
@@ -85,61 +141,62 @@ namespace ScoreProcessor {
 						}
 					}
 				}
-				void write_to_img(Img& out,size_t const y,size_t const output_dim) const
-				{
-					auto const out_width=out._width;
-					auto out_row=out._data+out_width*y+output_x;
-					size_t const c_limit=std::min<size_t>(out._width-output_x,output_dim);
-					size_t const r_limit=std::min<size_t>(out._height-y,output_dim);
-					auto const out_limit=out_row+r_limit*out_width;
-					for(;out_row<out_limit;out_row+=out_width)
-					{
-						for(size_t c=0;c<c_limit;++c)
-						{
-							out_row[c]=255;
-						}
-					}
-				}
 				void scale(Img& out,Img const& in,neural_scaler const& ns,info const& inf) const
 				{
 					//begin and end are boundaries of box to take values from
 					//start and finish are valid values to take values from
 					using st=std::ptrdiff_t;
-					st const input_x=output_x/inf.scale_factor;
 					st const input_dim=inf.input_dim;
 					st const output_dim=inf.output_dim;
 					st const scale_factor=inf.scale_factor;
 					st const padding=inf.padding;
 					size_t const input_area=size_t{inf.input_dim}*inf.input_dim;
 					size_t const output_area=size_t{inf.output_dim}*inf.output_dim;
-					std::unique_ptr<float[]> input(new float[input_area]);
-					std::unique_ptr<float[]> output(new float[output_area]);
-					st const out_height=out._height;
+					//non-blank windows are gathered and sent through the network together
+					size_t const batch_size=ns.batch_size();
+					std::unique_ptr<float[]> input(new float[input_area*batch_size]);
+					std::unique_ptr<float[]> output(new float[output_area*batch_size]);
+					std::unique_ptr<std::pair<st,st>[]> batch_xy(new std::pair<st,st>[batch_size]);
+					auto ws=ns.make_workspace();
+					size_t batched=0;
+					auto const flush=[&]()
+					{
+						ns.feed_batch(ws,output.get(),input.get(),batched);
+						for(size_t b=0;b<batched;++b)
+						{
+							write_to_img(out,output.get()+b*output_area,batch_xy[b].first,batch_xy[b].second,output_dim);
+						}
+						batched=0;
+					};
 					st const in_height=in._height;
 					st const in_width=in._width;
-					st const x_begin=static_cast<st>(input_x)-padding;
-					st const x_end=x_begin+input_dim;
-					st const x_start=std::max<st>(0,x_begin);
-					st const x_finish=std::min<st>(in_width,x_end);
-					if(x_begin<0)
+					for(size_t t=first;t<tiles->size();t+=step)
 					{
-						auto const amount=-x_begin;
-						for(st y=0;y<input_dim;++y)
+						st const output_x=(*tiles)[t].first;
+						st const y=(*tiles)[t].second;
+						st const input_x=output_x/scale_factor;
+						st const x_begin=input_x-padding;
+						st const x_end=x_begin+input_dim;
+						st const x_start=std::max<st>(0,x_begin);
+						st const x_finish=std::min<st>(in_width,x_end);
+						auto const window=input.get()+batched*input_area;
+						if(x_begin<0)
 						{
-							std::fill_n(input.get()+y*input_dim,amount,1.0f);
+							auto const amount=-x_begin;
+							for(st row=0;row<input_dim;++row)
+							{
+								std::fill_n(window+row*input_dim,amount,1.0f);
+							}
 						}
-					}
-					if(x_end>in_width)
-					{
-						auto const offset=input.get()+in_width-x_begin;
-						auto const count=x_end-in_width;
-						for(st y=0;y<input_dim;++y)
+						if(x_end>in_width)
 						{
-							std::fill_n(offset+y*input_dim,count,1.0f);
+							auto const offset=window+in_width-x_begin;
+							auto const count=x_end-in_width;
+							for(st row=0;row<input_dim;++row)
+							{
+								std::fill_n(offset+row*input_dim,count,1.0f);
+							}
 						}
-					}
-					for(st y=0;y<out_height;y+=output_dim)
-					{
 						st const y_input=y/scale_factor;
 						st const y_begin=y_input-padding;
 						st const y_end=y_begin+input_dim;
@@ -149,7 +206,7 @@ namespace ScoreProcessor {
 							y_start=0;
 							st amount=-y_begin*input_dim;
 							assert(amount<input_dim*input_dim);
-							std::fill_n(input.get(),amount,1.0f);
+							std::fill_n(window,amount,1.0f);
 						}
 						else
 						{
@@ -160,8 +217,8 @@ namespace ScoreProcessor {
 							y_finish=in_height;
 							st offset=(in_height-y_begin)*input_dim;
 							st amount=(y_end-in_height)*input_dim;
-							assert(offset+amount==input_area);
-							std::fill_n(input.get()+offset,amount,1.0f);
+							assert(static_cast<size_t>(offset+amount)==input_area);
+							std::fill_n(window+offset,amount,1.0f);
 						}
 						else
 						{
@@ -170,24 +227,24 @@ namespace ScoreProcessor {
 						for(st y_in=y_start;y_in<y_finish;++y_in)
 						{
 							auto const img_row=in._data+y_in*in_width;
-							auto const in_row=input.get()+(y_in-y_begin)*input_dim-x_begin;
+							auto const in_row=window+(y_in-y_begin)*input_dim-x_begin;
 							for(st x=x_start;x<x_finish;++x)
 							{
-								assert(in_row+x<input.get()+input_dim*input_dim);
+								assert(in_row+x<window+input_dim*input_dim);
 								assert(img_row+x<in._data+in._height*in._width);
 								in_row[x]=img_row[x]/255.0f;
 							}
 						}
-						if(!all_white(input.get(),input_area))
-						{
-							ns.feed(output.get(),input.get());
-							write_to_img(out,output.get(),y,output_dim);
-						}
-						else
+						batch_xy[batched]={output_x,y};
+						if(++batched==batch_size)
 						{
-							write_to_img(out,y,output_dim);
+							flush();
 						}
 					}
+					if(batched)
+					{
+						flush();
+					}
 				}
 			public:
 				void execute(Img* out,Img const* in,neural_scaler const* ns,info const* inf) const
@@ -196,9 +253,9 @@ namespace ScoreProcessor {
 				}
 			};
 			exlib::thread_pool_a<Img*,Img const*,neural_scaler const*,info const*> pool(num_threads,&upscaled,&orig,this,&inf);
-			for(unsigned int x=0;x<upscaled._width;x+=inf.output_dim)
+			for(unsigned int t=0;t<num_threads&&t<tiles.size();++t)
 			{
-				pool.push_back([task=Scaler{x}](Img*out,Img const* in,neural_scaler const* ns,info const* inf) noexcept{
+				pool.push_back([task=Scaler{t,num_threads,&tiles}](Img*out,Img const* in,neural_scaler const* ns,info const* inf) noexcept{
 					task.execute(out,in,ns,inf);
 				});;
 			}
@@ -210,4 +267,125 @@ namespace ScoreProcessor {
 			orig=std::move(upscaled);
 		}
 	}
+
+	cil::CImg<unsigned char> neural_scaler::get_conv_smart_scale(cil::CImg<unsigned char> const& img,float scale,unsigned int num_threads) const
+	{
+		using Img=cil::CImg<unsigned char>;
+		//rows of input run through the net at once
+		static constexpr unsigned int band_height=16;
+		Img orig(img,true);//shared view of image
+		unsigned int desired_width=static_cast<unsigned int>(std::round(img._width*scale));
+		unsigned int desired_height=static_cast<unsigned int>(std::round(img._height*scale));
+		num_threads=std::max(1U,num_threads);
+		while(true)
+		{
+			auto const s=scale_factor();
+			std::ptrdiff_t const radius=_conv->radius();
+			Img upscaled(orig._width*s,orig._height*s,1,1,255);
+			//as with tiles, bands with nothing dark within reach stay white
+			std::vector<unsigned int> bands;
+			{
+				dark_count_table const dark(orig);
+				std::ptrdiff_t const height=orig._height;
+				for(unsigned int y=0;y<orig._height;y+=band_height)
+				{
+					auto const y0=static_cast<size_t>(std::max<std::ptrdiff_t>(std::ptrdiff_t(y)-radius,0));
+					auto const y1=static_cast<size_t>(std::min<std::ptrdiff_t>(y+band_height+radius,height));
+					if(dark.count(0,y0,orig._width,y1))
+					{
+						bands.push_back(y);
+					}
+				}
+			}
+			//each task takes every step-th band, so that its buffers are made once per thread
+			struct BandScaler {
+				size_t first;
+				size_t step;
+				std::vector<unsigned int> const* bands;
+				void scale(Img& out,Img const& in,neural_net::conv_net<> const& net,unsigned int s) const
+				{
+					using st=std::ptrdiff_t;
+					st const radius=net.radius();
+					st const in_width=in._width;
+					st const in_height=in._height;
+					st const plane_width=in_width+2*radius;
+					size_t const plane_height=band_height+2*radius;
+					size_t const channels=size_t{s}*s;
+					std::unique_ptr<float[]> input(new float[plane_height*plane_width]);
+					std::unique_ptr<float[]> output(new float[size_t{band_height}*in_width*channels]);
+					auto ws=net.make_workspace(plane_height,plane_width);
+					for(size_t b=first;b<bands->size();b+=step)
+					{
+						st const y=(*bands)[b];
+						st const rows=std::min<st>(band_height,in_height-y);
+						//outside the image is white
+						for(st row=0;row<rows+2*radius;++row)
+						{
+							auto const plane_row=input.get()+row*plane_width;
+							st const y_in=y+row-radius;
+							if(y_in<0||y_in>=in_height)
+							{
+								std::fill_n(plane_row,plane_width,1.0f);
+								continue;
+							}
+							std::fill_n(plane_row,radius,1.0f);
+							std::fill_n(plane_row+radius+in_width,radius,1.0f);
+							auto const img_row=in._data+y_in*in_width;
+							for(st x=0;x<in_width;++x)
+							{
+								plane_row[radius+x]=img_row[x]/255.0f;
+							}
+						}
+						net.feed_forward(ws,output.get(),input.get(),rows+2*radius,plane_width);
+						//channel dy*s+dx of a pixel is the output pixel at dx,dy in its block
+						for(st row=0;row<rows;++row)
+						{
+							for(unsigned int dy=0;dy<s;++dy)
+							{
+								auto const out_row=out._data+((y+row)*s+dy)*out._width;
+								auto const src=output.get()+row*in_width*channels+dy*s;
+								for(st x=0;x<in_width;++x)
+								{
+									for(unsigned int dx=0;dx<s;++dx)
+									{
+										auto const val=src[x*channels+dx];
+										unsigned char& dst=out_row[x*s+dx];
+										if(val>=1.0f)
+										{
+											dst=255;
+										}
+										else if(val<=0.0f)
+										{
+											dst=0;
+										}
+										else
+										{
+											dst=static_cast<unsigned char>(std::round(val*255));
+										}
+									}
+								}
+							}
+						}
+					}
+				}
+				void execute(Img* out,Img const* in,neural_scaler const* ns) const
+				{
+					scale(*out,*in,*ns->_conv,ns->scale_factor());
+				}
+			};
+			exlib::thread_pool_a<Img*,Img const*,neural_scaler const*> pool(num_threads,&upscaled,&orig,this);
+			for(unsigned int t=0;t<num_threads&&t<bands.size();++t)
+			{
+				pool.push_back([task=BandScaler{t,num_threads,&bands}](Img* out,Img const* in,neural_scaler const* ns) noexcept{
+					task.execute(out,in,ns);
+				});
+			}
+			pool.join();
+			if(upscaled._width>=desired_width)
+			{
+				return upscaled.resize(desired_width,desired_height);
+			}
+			orig=std::move(upscaled);
+		}
+	}
 }
\ No newline at end of file
@@ -2,9 +2,13 @@
 #define NEURAL_SCALER_H
 
 #include "neural_net.h"
+#include "quantized_net.h"
+#include "conv_net.h"
+#include "model_file.h"
 #include <thread>
 #include "../ScoreProcessor/CImg.h"
 #include <type_traits>
+#include <memory>
 namespace ScoreProcessor {
 	template<typename Derived>
 	struct smart_scaler_base {
@@ -26,7 +30,15 @@ namespace ScoreProcessor {
 		unsigned int _nscale;
 		unsigned int _out_dim;
 		unsigned int _in_dim;
+		unsigned int _batch_size=64;
 		neural_net::net<> _net;
+		std::shared_ptr<neural_net::quantized_net<> const> _quantized;
+		std::shared_ptr<neural_net::conv_net<> const> _conv;
+		//holds the weights of _net when it was loaded from a model file
+		std::shared_ptr<model_file::mapping const> _mapping;
+		//mark a saved scaler whose net is quantized or convolutional, in place of the scale that starts an fp32 one
+		static constexpr uint64_t quantized_tag=0x544E415551535353; //"SSSQUANT"
+		static constexpr uint64_t conv_tag=0x4E564E4F43535353; //"SSSCONVN"
 	
 		static unsigned int int_sqrt(size_t a,char const* msg)
 		{
@@ -58,9 +70,42 @@ namespace ScoreProcessor {
 			}
 			return std::tuple<decltype(o),decltype(i),Net&&>(o,i,std::forward<Net>(src));
 		}
+
+		//a convolutional net turns one channel into a scale x scale block of pixels for each input pixel
+		static void assert_channels(unsigned int s,neural_net::conv_net<> const& src)
+		{
+			if(src.in_channels()!=1)
+			{
+				throw std::invalid_argument("Convolutional net must take one channel");
+			}
+			if(src.out_channels()!=size_t{s}*s)
+			{
+				throw std::invalid_argument("Convolutional net must output the square of the scale factor in channels");
+			}
+		}
+		void set_conv(unsigned int scale,neural_net::conv_net<>&& src)
+		{
+			assert_channels(scale,src);
+			_nscale=scale;
+			_out_dim=scale;
+			_in_dim=static_cast<unsigned int>(2*src.radius()+1);
+			_net=neural_net::net<>();
+			_quantized.reset();
+			_mapping.reset();
+			_conv=std::make_shared<neural_net::conv_net<>>(std::move(src));
+		}
 	public:
+		/*
+			A net that can be written to. If the weights are those of a mapped model file,
+			they are copied out of it first.
+		*/
 		auto& net()
 		{
+			if(_mapping)
+			{
+				_net=neural_net::net<>(_net);
+				_mapping.reset();
+			}
 			return _net;
 		}
 		auto const& net() const
@@ -81,7 +126,42 @@ namespace ScoreProcessor {
 			_out_dim=std::get<0>(res);
 			_in_dim=std::get<1>(res);
 		}
+		/*
+			A scaler that runs a convolutional net densely over the image instead of a net over each tile.
+			input_dim is then the receptive field of each pixel, and output_dim the scale factor.
+		*/
+		inline neural_scaler(unsigned int scale,neural_net::conv_net<>&& src)
+		{
+			set_conv(scale,std::move(src));
+		}
+		/*
+			Replaces the weights used for scaling with a quantized copy of the net.
+			The fp32 net is kept, unless the scaler was loaded from a quantized file, in which case there is none.
+		*/
+		inline void quantize(neural_net::weight_format format)
+		{
+			if(_quantized)
+			{
+				throw std::logic_error("Scaler is already quantized");
+			}
+			if(_conv)
+			{
+				throw std::logic_error("Only fully connected scalers can be quantized");
+			}
+			_quantized=std::make_shared<neural_net::quantized_net<>>(_net,format);
+		}
+		inline bool quantized() const
+		{
+			return static_cast<bool>(_quantized);
+		}
+		inline bool convolutional() const
+		{
+			return static_cast<bool>(_conv);
+		}
 		cil::CImg<unsigned char> get_smart_scale(cil::CImg<unsigned char> const& img,float scale,unsigned int num_threads=std::thread::hardware_concurrency()) const;
+	private:
+		cil::CImg<unsigned char> get_conv_smart_scale(cil::CImg<unsigned char> const& img,float scale,unsigned int num_threads) const;
+	public:
 
 	private:
 		struct is_writable_h {
@@ -125,6 +205,20 @@ namespace ScoreProcessor {
 		auto save(Stream& src) -> typename std::enable_if<is_writable<Stream>::value>::type
 		{
 			uint64_t scale=_nscale;
+			if(_conv)
+			{
+				src.write(reinterpret_cast<char const*>(&conv_tag),sizeof(uint64_t));
+				src.write(reinterpret_cast<char const*>(&scale),sizeof(uint64_t));
+				_conv->save(src);
+				return;
+			}
+			if(_quantized)
+			{
+				src.write(reinterpret_cast<char const*>(&quantized_tag),sizeof(uint64_t));
+				src.write(reinterpret_cast<char const*>(&scale),sizeof(uint64_t));
+				_quantized->save(src);
+				return;
+			}
 			src.write(reinterpret_cast<char const*>(&scale),sizeof(uint64_t));
 			_net.save(src);
 		}
@@ -137,21 +231,66 @@ namespace ScoreProcessor {
 			}
 			throw std::runtime_error("Failed to save");
 		}
+		/*
+			Saves the fp32 net of a fully connected scaler as a model file, which load maps instead of reading.
+		*/
+		void save_mappable(char const* path) const;
+	private:
+		void load_mappable(char const* path);
+	public:
 		
 		template<typename Stream>
 		auto load(Stream& src) -> typename std::enable_if<is_readable<Stream>::value>::type
 		{
 			uint64_t scale;
 			src.read(reinterpret_cast<char*>(&scale),sizeof(scale));
+			if(scale==quantized_tag)
+			{
+				src.read(reinterpret_cast<char*>(&scale),sizeof(scale));
+				auto quantized=std::make_shared<neural_net::quantized_net<>>();
+				quantized->load(src);
+				auto res=assert_dim(scale,*quantized);
+				_nscale=static_cast<unsigned int>(scale);
+				_in_dim=std::get<1>(res);
+				_out_dim=std::get<0>(res);
+				_net=neural_net::net<>();
+				_quantized=std::move(quantized);
+				_conv.reset();
+				_mapping.reset();
+				return;
+			}
+			if(scale==conv_tag)
+			{
+				src.read(reinterpret_cast<char*>(&scale),sizeof(scale));
+				if(scale==0||scale>std::numeric_limits<unsigned int>::max())
+				{
+					throw std::invalid_argument("Invalid scale factor");
+				}
+				neural_net::conv_net<> conv;
+				conv.load(src);
+				set_conv(static_cast<unsigned int>(scale),std::move(conv));
+				return;
+			}
 			neural_net::net<> net(src);
 			auto res=assert_dim(scale,net);
 			_nscale=static_cast<unsigned int>(scale);
 			_in_dim=std::get<1>(res);
 			_out_dim=std::get<0>(res);
 			_net=std::move(net);
+			_quantized.reset();
+			_conv.reset();
+			_mapping.reset();
 		}
+		/*
+			Loads a scaler saved by either save or save_mappable.
+			Model files are mapped rather than read, and the net uses their weights in place.
+		*/
 		void load(char const* path)
 		{
+			if(model_file::is_model_file(path))
+			{
+				return load_mappable(path);
+			}
 			std::ifstream e(path,std::ios::in|std::ios::binary);
 			if(e)
 			{
@@ -175,10 +314,59 @@ namespace ScoreProcessor {
 		{
 			return (input_dim()-output_dim()/scale_factor())/2;
 		}
-		inline void feed(float* out,float const* in) const
+		/*
+			How many non-blank patches are gathered to go through the network together.
+		*/
+		inline unsigned int batch_size() const
 		{
-			auto res=_net.feed_forward_store(in);
-			std::memcpy(out,res[_net.layers().size()-1].get(),_net.layers().back().neuron_count()*sizeof(float));
+			return _batch_size;
+		}
+		inline void batch_size(unsigned int size)
+		{
+			_batch_size=std::max(1U,size);
+		}
+		/*
+			Scratch space for feeding patches through whichever net the scaler uses.
+			Patches are only fed to fully connected nets; a convolutional one runs over whole bands of the image.
+		*/
+		struct workspace {
+			neural_net::workspace full;
+			neural_net::quantized_workspace quantized;
+		};
+		/*
+			Workspace for feeding up to batch_size patches at once.
+		*/
+		inline workspace make_workspace(size_t batch) const
+		{
+			workspace ws;
+			if(_quantized)
+			{
+				ws.quantized=_quantized->make_workspace(batch);
+			}
+			else
+			{
+				ws.full=_net.make_workspace(batch);
+			}
+			return ws;
+		}
+		inline workspace make_workspace() const
+		{
+			return make_workspace(_batch_size);
+		}
+		/*
+			Feeds count patches, stored one after another, and writes their outputs one after another.
+			count must be at most the batch size ws was made for.
+		*/
+		inline void feed_batch(workspace& ws,float* out,float const* in,size_t count) const
+		{
+			if(_quantized)
+			{
+				_quantized->feed_forward(ws.quantized,out,in,count);
+			}
+			else
+			{
+				_net.feed_forward(ws.full,out,in,count);
+			}
 		}
 		neural_scaler(char const* path)
 		{
@@ -0,0 +1,623 @@
+#ifndef QUANTIZED_NET_H
+#define QUANTIZED_NET_H
+#include "neural_net.h"
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+//MSVC defines no macro for F16C, but every CPU with AVX2 has it
+#if defined(__F16C__)||(defined(_MSC_VER)&&defined(__AVX2__))
+#define NEURAL_NET_F16C
+#endif
+#if defined(NEURAL_NET_F16C)&&!defined(__AVX2__)
+#include <immintrin.h>
+#endif
+//builds that do not target VNNI check for the AVX-512 form at run time
+#if defined(__AVX2__)&&!(defined(__AVX512VNNI__)&&defined(__AVX512VL__))&&!defined(__AVXVNNI__)
+#define NEURAL_NET_VNNI_DISPATCH
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NEURAL_NET_TARGET_VNNI
+#define NEURAL_NET_FORCEINLINE __forceinline
+#else
+#define NEURAL_NET_TARGET_VNNI __attribute__((target("avx2,fma,avx512vnni,avx512vl")))
+#define NEURAL_NET_FORCEINLINE inline __attribute__((always_inline))
+#endif
+#else
+#define NEURAL_NET_FORCEINLINE inline
+#endif
+namespace neural_net {
+
+	enum class weight_format:std::uint8_t {
+		fp16=1,
+		int8=2
+	};
+
+	//IEEE half precision, rounding to nearest even
+	inline std::uint16_t to_half(float f)
+	{
+		std::uint32_t x;
+		std::memcpy(&x,&f,sizeof(x));
+		std::uint16_t const sign=(x>>16)&0x8000;
+		std::uint32_t const abs=x&0x7FFFFFFF;
+		if(abs>=0x7F800000) //inf or nan
+		{
+			return sign|0x7C00|(abs>0x7F800000?0x200:0);
+		}
+		if(abs>=0x477FF000) //rounds past the largest half
+		{
+			return sign|0x7C00;
+		}
+		if(abs<0x38800000) //subnormal half, or zero
+		{
+			if(abs<0x33000000)
+			{
+				return sign;
+			}
+			std::uint32_t const exponent=abs>>23;
+			std::uint32_t const mantissa=(abs&0x7FFFFF)|0x800000;
+			std::uint32_t const shift=126-exponent;
+			std::uint32_t const half=mantissa>>shift;
+			std::uint32_t const rest=mantissa&((1U<<shift)-1);
+			std::uint32_t const middle=1U<<(shift-1);
+			return sign|(half+(rest>middle||(rest==middle&&(half&1))));
+		}
+		std::uint32_t const rebased=abs-0x38000000;
+		std::uint32_t const rest=rebased&0x1FFF;
+		std::uint32_t half=rebased>>13;
+		half+=rest>0x1000||(rest==0x1000&&(half&1));
+		return sign|static_cast<std::uint16_t>(half);
+	}
+
+	inline float from_half(std::uint16_t h)
+	{
+		std::uint32_t const sign=std::uint32_t(h&0x8000)<<16;
+		std::uint32_t const exponent=(h>>10)&0x1F;
+		std::uint32_t mantissa=h&0x3FF;
+		std::uint32_t x;
+		if(exponent==0x1F)
+		{
+			x=sign|0x7F800000|(mantissa<<13);
+		}
+		else if(exponent!=0)
+		{
+			x=sign|((exponent+112)<<23)|(mantissa<<13);
+		}
+		else if(mantissa==0)
+		{
+			x=sign;
+		}
+		else
+		{
+			//normalize the subnormal
+			std::uint32_t e=113;
+			while(!(mantissa&0x400))
+			{
+				mantissa<<=1;
+				--e;
+			}
+			x=sign|(e<<23)|((mantissa&0x3FF)<<13);
+		}
+		float f;
+		std::memcpy(&f,&x,sizeof(f));
+		return f;
+	}
+
+	//dst[i]=from_half(src[i])
+	inline void from_half(float* dst,std::uint16_t const* src,size_t n)
+	{
+		size_t i=0;
+#ifdef NEURAL_NET_F16C
+		for(;i+8<=n;i+=8)
+		{
+			_mm256_storeu_ps(dst+i,_mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<__m128i const*>(src+i))));
+		}
+#endif
+		for(;i<n;++i)
+		{
+			dst[i]=from_half(src[i]);
+		}
+	}
+
+	//int8 rows are padded with zeros to a multiple of this, so the products need no tail
+	constexpr size_t int8_alignment=32;
+
+	inline size_t int8_stride(size_t cols)
+	{
+		return (cols+int8_alignment-1)/int8_alignment*int8_alignment;
+	}
+
+	namespace detail {
+#ifdef __AVX2__
+		//acc+=abs_a*signed_b summed in groups of 4, where signed_b has a's sign moved onto b
+		//u8*s8 products are summed in pairs; with both limited to [-127,127] the pairs cannot saturate
+		struct accumulate {
+			static __m256i apply(__m256i acc,__m256i abs_a,__m256i signed_b)
+			{
+#if defined(__AVX512VNNI__)&&defined(__AVX512VL__)
+				return _mm256_dpbusd_epi32(acc,abs_a,signed_b);
+#elif defined(__AVXVNNI__)
+				return _mm256_dpbusd_avx_epi32(acc,abs_a,signed_b);
+#else
+				return _mm256_add_epi32(acc,_mm256_madd_epi16(_mm256_maddubs_epi16(abs_a,signed_b),_mm256_set1_epi16(1)));
+#endif
+			}
+		};
+
+#ifdef NEURAL_NET_VNNI_DISPATCH
+		struct vnni_accumulate {
+			NEURAL_NET_TARGET_VNNI static __m256i apply(__m256i acc,__m256i abs_a,__m256i signed_b)
+			{
+				return _mm256_dpbusd_epi32(acc,abs_a,signed_b);
+			}
+		};
+
+		//whether the CPU and OS support AVX-512 VNNI on 256 bit registers
+		inline bool has_vnni()
+		{
+#ifdef _MSC_VER
+			static bool const has=[]()
+			{
+				int info[4];
+				__cpuid(info,0);
+				if(info[0]<7)
+				{
+					return false;
+				}
+				__cpuid(info,1);
+				bool const os_saves=(unsigned(info[2])>>27)&1;
+				__cpuidex(info,7,0);
+				bool const vnni=(unsigned(info[2])>>11)&1;
+				bool const vl=(unsigned(info[1])>>31)&1;
+				//the OS must save the ymm, opmask and zmm registers
+				return os_saves&&vnni&&vl&&(_xgetbv(0)&0xE6)==0xE6;
+			}();
+#else
+			static bool const has=__builtin_cpu_supports("avx512vnni")&&__builtin_cpu_supports("avx512vl");
+#endif
+			return has;
+		}
+#endif
+
+		inline std::int32_t horizontal_sum(__m256i v)
+		{
+			__m128i quad=_mm_add_epi32(_mm256_castsi256_si128(v),_mm256_extracti128_si256(v,1));
+			quad=_mm_add_epi32(quad,_mm_shuffle_epi32(quad,_MM_SHUFFLE(1,0,3,2)));
+			quad=_mm_add_epi32(quad,_mm_shuffle_epi32(quad,_MM_SHUFFLE(2,3,0,1)));
+			return _mm_cvtsi128_si32(quad);
+		}
+
+		template<typename Accumulate>
+		NEURAL_NET_FORCEINLINE std::int32_t dot(std::int8_t const* a,std::int8_t const* b,size_t n)
+		{
+			__m256i acc=_mm256_setzero_si256();
+			for(size_t i=0;i<n;i+=32)
+			{
+				__m256i const va=_mm256_loadu_si256(reinterpret_cast<__m256i const*>(a+i));
+				__m256i const vb=_mm256_loadu_si256(reinterpret_cast<__m256i const*>(b+i));
+				acc=Accumulate::apply(acc,_mm256_sign_epi8(va,va),_mm256_sign_epi8(vb,va));
+			}
+			return horizontal_sum(acc);
+		}
+
+		template<typename Accumulate>
+		NEURAL_NET_FORCEINLINE void dot4(std::int32_t* out,std::int8_t const* a,std::int8_t const* b,size_t n)
+		{
+			__m256i acc0=_mm256_setzero_si256();
+			__m256i acc1=_mm256_setzero_si256();
+			__m256i acc2=_mm256_setzero_si256();
+			__m256i acc3=_mm256_setzero_si256();
+			for(size_t i=0;i<n;i+=32)
+			{
+				__m256i const va=_mm256_loadu_si256(reinterpret_cast<__m256i const*>(a+i));
+				__m256i const abs_a=_mm256_sign_epi8(va,va);
+				auto const load=[=](size_t s)
+				{
+					return _mm256_sign_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(b+s*n+i)),va);
+				};
+				acc0=Accumulate::apply(acc0,abs_a,load(0));
+				acc1=Accumulate::apply(acc1,abs_a,load(1));
+				acc2=Accumulate::apply(acc2,abs_a,load(2));
+				acc3=Accumulate::apply(acc3,abs_a,load(3));
+			}
+			out[0]=horizontal_sum(acc0);
+			out[1]=horizontal_sum(acc1);
+			out[2]=horizontal_sum(acc2);
+			out[3]=horizontal_sum(acc3);
+		}
+
+#ifdef NEURAL_NET_VNNI_DISPATCH
+		NEURAL_NET_TARGET_VNNI inline std::int32_t dot_vnni(std::int8_t const* a,std::int8_t const* b,size_t n)
+		{
+			return dot<vnni_accumulate>(a,b,n);
+		}
+
+		NEURAL_NET_TARGET_VNNI inline void dot4_vnni(std::int32_t* out,std::int8_t const* a,std::int8_t const* b,size_t n)
+		{
+			dot4<vnni_accumulate>(out,a,b,n);
+		}
+#endif
+#endif
+	}
+
+	//n must be a multiple of int8_alignment
+	inline std::int32_t dot(std::int8_t const* a,std::int8_t const* b,size_t n)
+	{
+		assert(n%int8_alignment==0);
+#ifdef __AVX2__
+#ifdef NEURAL_NET_VNNI_DISPATCH
+		if(detail::has_vnni())
+		{
+			return detail::dot_vnni(a,b,n);
+		}
+#endif
+		return detail::dot<detail::accumulate>(a,b,n);
+#else
+		std::int32_t sum=0;
+		for(size_t i=0;i<n;++i)
+		{
+			sum+=std::int32_t(a[i])*b[i];
+		}
+		return sum;
+#endif
+	}
+
+	//out[s]=dot(a,b+s*n,n) for s in [0,4), sharing the loads of a
+	inline void dot4(std::int32_t* out,std::int8_t const* a,std::int8_t const* b,size_t n)
+	{
+		assert(n%int8_alignment==0);
+#ifdef __AVX2__
+#ifdef NEURAL_NET_VNNI_DISPATCH
+		if(detail::has_vnni())
+		{
+			detail::dot4_vnni(out,a,b,n);
+			return;
+		}
+#endif
+		detail::dot4<detail::accumulate>(out,a,b,n);
+#else
+		for(size_t s=0;s<4;++s)
+		{
+			out[s]=dot(a,b+s*n,n);
+		}
+#endif
+	}
+
+	/*
+		Scratch space for forward passes of a quantized_net, for batches of up to batch() inputs.
+		Not safe to share between threads; each thread should have its own.
+	*/
+	struct quantized_workspace {
+	private:
+		workspace _activations;
+		std::unique_ptr<std::int8_t[]> _quantized;
+		std::unique_ptr<float[]> _scales;
+		std::unique_ptr<float[]> _row;
+	public:
+		quantized_workspace()=default;
+		quantized_workspace(std::vector<layer> const& layers,size_t batch):
+			_activations(layers,batch)
+		{
+			size_t widest_input=0;
+			for(size_t i=0;i+1<layers.size();++i)
+			{
+				widest_input=std::max(widest_input,layers[i].neuron_count());
+			}
+			_quantized.reset(new std::int8_t[int8_stride(widest_input)*batch]);
+			_scales.reset(new float[batch]);
+			_row.reset(new float[widest_input]);
+		}
+		size_t batch() const
+		{
+			return _activations.batch();
+		}
+		workspace& activations()
+		{
+			return _activations;
+		}
+		std::int8_t* quantized()
+		{
+			return _quantized.get();
+		}
+		float* scales()
+		{
+			return _scales.get();
+		}
+		float* row()
+		{
+			return _row.get();
+		}
+	};
+
+	/*
+		An inference only copy of a net, with weights stored as fp16 or as int8 with one scale per layer.
+		int8 layers also quantize their input per sample, so the products are done in integers.
+	*/
+	template<typename ActivationFunc=clipped_leaky_relu_t<>>
+	class quantized_net:private ActivationFunc {
+		struct qlayer {
+			float scale; //int8 weight w stands for w*scale
+			std::unique_ptr<float[]> biases;
+			std::unique_ptr<std::int8_t[]> weights8;
+			std::unique_ptr<std::uint16_t[]> weights16;
+		};
+		weight_format _format;
+		std::vector<layer> _shape; //neuron counts only, to size workspaces
+		std::vector<qlayer> _layers;
+
+		void init_shape(std::vector<size_t> const& sizes)
+		{
+			_shape.clear();
+			_shape.reserve(sizes.size());
+			for(auto s:sizes)
+			{
+				_shape.emplace_back(s);
+			}
+			_layers.clear();
+			_layers.resize(sizes.size());
+			for(size_t i=1;i<sizes.size();++i)
+			{
+				auto& l=_layers[i];
+				l.scale=1;
+				l.biases.reset(new float[sizes[i]]);
+				if(_format==weight_format::int8)
+				{
+					l.weights8.reset(new std::int8_t[sizes[i]*int8_stride(sizes[i-1])]());
+				}
+				else
+				{
+					l.weights16.reset(new std::uint16_t[sizes[i]*sizes[i-1]]);
+				}
+			}
+		}
+
+		//writes the quantized rows of src into q, padded to int8_stride(cols), and the scale of each into scales
+		static void quantize_rows(std::int8_t* q,float* scales,float const* src,size_t cols,size_t rows)
+		{
+			auto const stride=int8_stride(cols);
+			for(size_t r=0;r<rows;++r)
+			{
+				auto const row=src+r*cols;
+				float max=0;
+				for(size_t c=0;c<cols;++c)
+				{
+					max=std::max(max,std::abs(row[c]));
+				}
+				float const scale=max/127;
+				float const inverse=max>0?127/max:0;
+				auto const qrow=q+r*stride;
+				for(size_t c=0;c<cols;++c)
+				{
+					qrow[c]=static_cast<std::int8_t>(std::lround(row[c]*inverse));
+				}
+				std::fill(qrow+cols,qrow+stride,std::int8_t(0));
+				scales[r]=scale;
+			}
+		}
+	public:
+		quantized_net():_format(weight_format::int8)
+		{}
+		template<typename Deriv>
+		quantized_net(net<ActivationFunc,Deriv> const& src,weight_format format):_format(format)
+		{
+			auto const& layers=src.layers();
+			std::vector<size_t> sizes;
+			for(auto const& l:layers)
+			{
+				sizes.push_back(l.neuron_count());
+			}
+			init_shape(sizes);
+			for(size_t i=1;i<layers.size();++i)
+			{
+				auto const count=sizes[i]*sizes[i-1];
+				auto const w=layers[i].weights();
+				auto& l=_layers[i];
+				std::memcpy(l.biases.get(),layers[i].biases(),sizes[i]*sizeof(float));
+				if(format==weight_format::int8)
+				{
+					float max=0;
+					for(size_t j=0;j<count;++j)
+					{
+						max=std::max(max,std::abs(w[j]));
+					}
+					l.scale=max>0?max/127:1;
+					auto const cols=sizes[i-1];
+					auto const stride=int8_stride(cols);
+					for(size_t r=0;r<sizes[i];++r)
+					{
+						for(size_t c=0;c<cols;++c)
+						{
+							l.weights8[r*stride+c]=static_cast<std::int8_t>(std::lround(w[r*cols+c]/l.scale));
+						}
+					}
+				}
+				else
+				{
+					for(size_t j=0;j<count;++j)
+					{
+						l.weights16[j]=to_half(w[j]);
+					}
+				}
+			}
+		}
+
+		weight_format format() const
+		{
+			return _format;
+		}
+
+		/*
+			The neuron count of each layer; the layers hold no weights.
+		*/
+		std::vector<layer> const& layers() const
+		{
+			return _shape;
+		}
+
+		quantized_workspace make_workspace(size_t batch=1) const
+		{
+			return quantized_workspace(_shape,batch);
+		}
+
+		/*
+			Same as net::feed_forward, using the quantized weights.
+		*/
+		void feed_forward(quantized_workspace& ws,float* const output,float const* const input,size_t const batch=1) const
+		{
+			assert(batch<=ws.batch());
+			float const* src=input;
+			for(size_t i=1;i<_layers.size();++i)
+			{
+				auto const cols=_shape[i-1].neuron_count();
+				auto const rows=_shape[i].neuron_count();
+				auto const& l=_layers[i];
+				float* const dst=i+1==_layers.size()?output:ws.activations().buffer(i);
+				if(_format==weight_format::int8)
+				{
+					auto const q=ws.quantized();
+					auto const scales=ws.scales();
+					auto const stride=int8_stride(cols);
+					quantize_rows(q,scales,src,cols,batch);
+					for(size_t r=0;r<rows;++r)
+					{
+						auto const wrow=l.weights8.get()+r*stride;
+						auto const activate=[&](size_t s,std::int32_t sum)
+						{
+							dst[s*rows+r]=ActivationFunc::operator()(l.biases[r]+sum*(l.scale*scales[s]));
+						};
+						size_t s=0;
+						for(;s+4<=batch;s+=4)
+						{
+							std::int32_t sums[4];
+							dot4(sums,wrow,q+s*stride,stride);
+							for(size_t j=0;j<4;++j)
+							{
+								activate(s+j,sums[j]);
+							}
+						}
+						for(;s<batch;++s)
+						{
+							activate(s,dot(wrow,q+s*stride,stride));
+						}
+					}
+				}
+				else
+				{
+					auto const row=ws.row();
+					for(size_t r=0;r<rows;++r)
+					{
+						from_half(row,l.weights16.get()+r*cols,cols);
+						for(size_t s=0;s<batch;++s)
+						{
+							dst[s*rows+r]=ActivationFunc::operator()(l.biases[r]+dot(row,src+s*cols,cols));
+						}
+					}
+				}
+				src=dst;
+			}
+		}
+
+		template<typename Stream>
+		void save(Stream& file) const
+		{
+			auto bwrite=[&](auto a)
+			{
+				file.write(reinterpret_cast<char const*>(&a),sizeof(decltype(a)));
+			};
+			auto bwrite_row=[&](auto const* a,size_t count)
+			{
+				file.write(reinterpret_cast<char const*>(a),count*sizeof(decltype(*a)));
+			};
+			bwrite(static_cast<std::uint8_t>(_format));
+			bwrite(uint64_t{_shape.size()});
+			for(auto const& l:_shape)
+			{
+				bwrite(uint64_t{l.neuron_count()});
+			}
+			for(size_t i=1;i<_layers.size();++i)
+			{
+				auto const rows=_shape[i].neuron_count();
+				auto const count=rows*_shape[i-1].neuron_count();
+				auto const& l=_layers[i];
+				bwrite(l.scale);
+				bwrite_row(l.biases.get(),rows);
+				if(_format==weight_format::int8)
+				{
+					//the padding is not saved
+					auto const cols=_shape[i-1].neuron_count();
+					for(size_t r=0;r<rows;++r)
+					{
+						bwrite_row(l.weights8.get()+r*int8_stride(cols),cols);
+					}
+				}
+				else
+				{
+					bwrite_row(l.weights16.get(),count);
+				}
+			}
+		}
+
+		template<typename Stream>
+		void load(Stream& src)
+		{
+			auto bread=[&](auto& a)
+			{
+				if(!src.read(reinterpret_cast<char*>(&a),sizeof(a)))
+				{
+					throw std::runtime_error("Quantized net ended early");
+				}
+			};
+			auto bread_row=[&](auto* a,size_t count)
+			{
+				if(!src.read(reinterpret_cast<char*>(a),count*sizeof(*a)))
+				{
+					throw std::runtime_error("Quantized net ended early");
+				}
+			};
+			std::uint8_t format;
+			bread(format);
+			if(format!=std::uint8_t(weight_format::int8)&&format!=std::uint8_t(weight_format::fp16))
+			{
+				throw std::runtime_error("Unknown weight format");
+			}
+			uint64_t layer_count;
+			bread(layer_count);
+			if(layer_count<=1||layer_count>std::numeric_limits<uint32_t>::max())
+			{
+				throw std::runtime_error("Invalid number of layers; must be >= 2");
+			}
+			std::vector<size_t> sizes(static_cast<size_t>(layer_count));
+			for(auto& s:sizes)
+			{
+				uint64_t size;
+				bread(size);
+				if(size==0||size>std::numeric_limits<uint32_t>::max())
+				{
+					throw std::invalid_argument("Net sizes too large.");
+				}
+				s=static_cast<size_t>(size);
+			}
+			_format=weight_format(format);
+			init_shape(sizes);
+			for(size_t i=1;i<sizes.size();++i)
+			{
+				auto const count=sizes[i]*sizes[i-1];
+				auto& l=_layers[i];
+				bread(l.scale);
+				bread_row(l.biases.get(),sizes[i]);
+				if(_format==weight_format::int8)
+				{
+					for(size_t r=0;r<sizes[i];++r)
+					{
+						bread_row(l.weights8.get()+r*int8_stride(sizes[i-1]),sizes[i-1]);
+					}
+				}
+				else
+				{
+					bread_row(l.weights16.get(),count);
+				}
+			}
+		}
+	};
+}
+#endif
@@ -54,5 +54,20 @@ namespace SProcUnitTests {
 			auto res=sr.make_filename("random_name.png",10);
 			Assert::AreEqual(exp,res);
 		}
+		TM(into_buffer)
+		{
+			SaveRules sr("%p/out/%f_%2.%x");
+			std::string input="some/dir/name.tif";
+			std::string out;
+			sr.make_filename(out,input,4294967295u);
+			std::string exp="some/dir/out/name_4294967295.tif";
+			Assert::AreEqual(exp,out);
+			Assert::IsTrue(out.size()<=sr.size_estimate(input.size()));
+			auto const data=out.data();
+			sr.make_filename(out,std::string("a/b.png"),3);
+			std::string exp2="a/out/b_03.png";
+			Assert::AreEqual(exp2,out);
+			Assert::IsTrue(data==out.data());
+		}
 	};
 }
\ No newline at end of file
@@ -84,11 +84,13 @@
 #include <memory>
 #include <string>
 #include <exception>
-#include <varargs.h>
+#include <cstdarg>
 #include "support.h"
 #include <random>
-#include "lib\exstring\exfiles.h"
+#include "lib/exstring/exfiles.h"
 #include <filesystem>
+#include <mutex>
+#include <map>
 // Detect/configure OS variables.
 //
 // Define 'cimg_OS' to: '0' for an unknown OS (will try to minize library dependencies).
@@ -178,6 +180,7 @@
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <dirent.h>
 #include <fnmatch.h>
 #elif cimg_OS==2
@@ -56888,6 +56891,41 @@ res(x,y,z,c)=max_val;
 			return CImg<T>().load_jpeg(filename);
 		}
 
+		//! Load image from a JPEG file, decoded at a reduced size.
+		/**
+		   \param filename Filename, as a C-string.
+		   \param scale_denom Called with the full width and height of the image, returns the denominator of the decoded size.
+		   libjpeg can decode directly at 1/2, 1/4 and 1/8 of the size.
+		   \param[in,out] gray_from_color If not null, a color image is decoded straight to its luma channel, and this is set to whether that happened.
+		**/
+		template<typename ScaleDenom>
+		CImg<T>& load_jpeg(const char *const filename,ScaleDenom scale_denom,bool *const gray_from_color=0)
+		{
+			return _load_jpeg(0,filename,0,0,scale_denom,gray_from_color);
+		}
+
+		//! Load image from JPEG data in memory.
+		/**
+		   \param buffer Start of the file contents.
+		   \param size Size of the file contents, in bytes.
+		   \param scale_denom As for load_jpeg(const char*,ScaleDenom,bool*).
+		   \param[in,out] gray_from_color As for load_jpeg(const char*,ScaleDenom,bool*).
+		**/
+		template<typename ScaleDenom>
+		CImg<T>& load_jpeg(const unsigned char *const buffer,const size_t size,ScaleDenom scale_denom,bool *const gray_from_color=0)
+		{
+			return _load_jpeg(0,0,buffer,size,scale_denom,gray_from_color);
+		}
+
+		//! Load image from JPEG data in memory \overloading.
+		CImg<T>& load_jpeg(const unsigned char *const buffer,const size_t size)
+		{
+			return _load_jpeg(0,0,buffer,size,[](unsigned int,unsigned int)
+			{
+				return 1U;
+			});
+		}
+
 		//! Load image from a JPEG file \overloading.
 		CImg<T>& load_jpeg(std::FILE *const file)
 		{
@@ -56921,40 +56959,62 @@ res(x,y,z,c)=max_val;
 
 		CImg<T>& _load_jpeg(std::FILE *const file,const char *const filename)
 		{
-			if(!file&&!filename)
+			return _load_jpeg(file,filename,0,0,[](unsigned int,unsigned int)
+			{
+				return 1U;
+			});
+		}
+
+		template<typename ScaleDenom>
+		CImg<T>& _load_jpeg(std::FILE *const file,const char *const filename,
+			const unsigned char *const memory,const size_t memory_size,
+			ScaleDenom scale_denom,bool *const gray_from_color=0)
+		{
+			if(!file&&!filename&&!memory)
 				throw CImgArgumentException(_cimg_instance
 					"load_jpeg(): Specified filename is (null).",
 					cimg_instance);
 
 #ifndef cimg_use_jpeg
-			if(file)
+			if(gray_from_color) *gray_from_color=false;
+			cimg::unused(memory_size);
+			if(file||memory)
 				throw CImgIOException(_cimg_instance
-					"load_jpeg(): Unable to load data from '(FILE*)' unless libjpeg is enabled.",
+					"load_jpeg(): Unable to load data from '(FILE*)' or memory unless libjpeg is enabled.",
 					cimg_instance);
 			else return load_other(filename);
 #else
 
-			std::FILE *const nfile=file?file:cimg::fopen(filename,"rb");
+			std::FILE *const nfile=memory?0:file?file:cimg::fopen(filename,"rb");
 			struct jpeg_decompress_struct cinfo;
 			struct _cimg_error_mgr jerr;
 			cinfo.err=jpeg_std_error(&jerr.original);
 			jerr.original.error_exit=_cimg_jpeg_error_exit;
 			if(setjmp(jerr.setjmp_buffer))
 			{ // JPEG error
-				if(!file) cimg::fclose(nfile);
+				if(nfile&&!file) cimg::fclose(nfile);
 				throw CImgIOException(_cimg_instance
 					"load_jpeg(): Error message returned by libjpeg: %s.",
 					cimg_instance,jerr.message);
 			}
 
 			jpeg_create_decompress(&cinfo);
-			jpeg_stdio_src(&cinfo,nfile);
+			if(memory) jpeg_mem_src(&cinfo,(unsigned char*)memory,(unsigned long)memory_size);
+			else jpeg_stdio_src(&cinfo,nfile);
 			jpeg_read_header(&cinfo,TRUE);
+			cinfo.scale_num=1;
+			cinfo.scale_denom=scale_denom(cinfo.image_width,cinfo.image_height);
+			if(gray_from_color)
+			{
+				// The luma plane is already stored, so the color conversion is skipped entirely.
+				*gray_from_color=cinfo.jpeg_color_space==JCS_YCbCr;
+				if(*gray_from_color) cinfo.out_color_space=JCS_GRAYSCALE;
+			}
 			jpeg_start_decompress(&cinfo);
 
 			if(cinfo.output_components!=1&&cinfo.output_components!=3&&cinfo.output_components!=4)
 			{
-				if(!file)
+				if(filename&&!file)
 				{
 					cimg::fclose(nfile);
 					return load_other(filename);
@@ -56962,7 +57022,7 @@ res(x,y,z,c)=max_val;
 				else
 					throw CImgIOException(_cimg_instance
 						"load_jpeg(): Failed to load JPEG data from file '%s'.",
-						cimg_instance,filename?filename:"(FILE*)");
+						cimg_instance,filename?filename:memory?"(memory)":"(FILE*)");
 			}
 			CImg<ucharT> buffer(cinfo.output_width*cinfo.output_components);
 			JSAMPROW row_pointer[1];
@@ -56972,7 +57032,7 @@ res(x,y,z,c)=max_val;
 			}
 			catch(...)
 			{
-				if(!file) cimg::fclose(nfile); throw;
+				if(nfile&&!file) cimg::fclose(nfile); throw;
 			}
 			T *ptr_r=_data,*ptr_g=_data+1UL*_width*_height,*ptr_b=_data+2UL*_width*_height,
 				*ptr_a=_data+3UL*_width*_height;
@@ -56983,7 +57043,7 @@ res(x,y,z,c)=max_val;
 				{
 					cimg::warn(_cimg_instance
 						"load_jpeg(): Incomplete data in file '%s'.",
-						cimg_instance,filename?filename:"(FILE*)");
+						cimg_instance,filename?filename:memory?"(memory)":"(FILE*)");
 					break;
 				}
 				const unsigned char *ptrs=buffer._data;
@@ -57016,7 +57076,7 @@ res(x,y,z,c)=max_val;
 			}
 			jpeg_finish_decompress(&cinfo);
 			jpeg_destroy_decompress(&cinfo);
-			if(!file) cimg::fclose(nfile);
+			if(nfile&&!file) cimg::fclose(nfile);
 			return *this;
 #endif
 		}
@@ -57111,10 +57171,12 @@ res(x,y,z,c)=max_val;
 		/**
 		   \param filename Filename, as a C-string.
 		   \param[out] bits_per_pixel Number of bits per pixels used to store pixel values in the image file.
+		   \param[in,out] gray_from_color If not null, a color image is decoded straight to the mean of its color channels, without alpha,
+		   and this is set to whether that happened.
 		**/
-		CImg<T>& load_png(const char *const filename,unsigned int *const bits_per_pixel=0)
+		CImg<T>& load_png(const char *const filename,unsigned int *const bits_per_pixel=0,bool *const gray_from_color=0)
 		{
-			return _load_png(0,filename,bits_per_pixel);
+			return _load_png(0,filename,bits_per_pixel,gray_from_color);
 		}
 
 		//! Load image from a PNG file \newinstance.
@@ -57129,6 +57191,36 @@ res(x,y,z,c)=max_val;
 			return _load_png(file,0,bits_per_pixel);
 		}
 
+		//! Load image from PNG data in memory.
+		/**
+		   \param buffer Start of the file contents.
+		   \param size Size of the file contents, in bytes.
+		   \param[out] bits_per_pixel As for load_png(const char*,unsigned int*,bool*).
+		   \param[in,out] gray_from_color As for load_png(const char*,unsigned int*,bool*).
+		**/
+		CImg<T>& load_png(const unsigned char *const buffer,const size_t size,
+			unsigned int *const bits_per_pixel=0,bool *const gray_from_color=0)
+		{
+			return _load_png(0,0,bits_per_pixel,gray_from_color,buffer,size);
+		}
+
+#ifdef cimg_use_png
+		// Read callback for libpng, consuming the front of the remaining data.
+		struct _cimg_png_buffer {
+			const unsigned char *ptr;
+			size_t size;
+		};
+
+		static void _cimg_png_read_buffer(png_structp png_ptr,png_bytep data,png_size_t length)
+		{
+			_cimg_png_buffer *const source=(_cimg_png_buffer*)png_get_io_ptr(png_ptr);
+			if(length>source->size) png_error(png_ptr,"Read past the end of the data");
+			std::memcpy(data,source->ptr,length);
+			source->ptr+=length;
+			source->size-=length;
+		}
+#endif
+
 		//! Load image from a PNG file \newinstance.
 		static CImg<T> get_load_png(std::FILE *const file,unsigned int *const bits_per_pixel=0)
 		{
@@ -57136,35 +57228,45 @@ res(x,y,z,c)=max_val;
 		}
 
 		// (Note: Most of this function has been written by Eric Fausett)
-		CImg<T>& _load_png(std::FILE *const file,const char *const filename,unsigned int *const bits_per_pixel)
+		CImg<T>& _load_png(std::FILE *const file,const char *const filename,unsigned int *const bits_per_pixel,bool *const gray_from_color=0,
+			const unsigned char *const memory=0,const size_t memory_size=0)
 		{
-			if(!file&&!filename)
+			if(!file&&!filename&&!memory)
 				throw CImgArgumentException(_cimg_instance
 					"load_png(): Specified filename is (null).",
 					cimg_instance);
 
 #ifndef cimg_use_png
 			cimg::unused(bits_per_pixel);
-			if(file)
+			if(gray_from_color) *gray_from_color=false;
+			cimg::unused(memory_size);
+			if(file||memory)
 				throw CImgIOException(_cimg_instance
-					"load_png(): Unable to load data from '(FILE*)' unless libpng is enabled.",
+					"load_png(): Unable to load data from '(FILE*)' or memory unless libpng is enabled.",
 					cimg_instance);
 
 			else return load_other(filename);
 #else
 	  // Open file and check for PNG validity
 #if defined __GNUC__
-			const char *volatile nfilename=filename; // Use 'volatile' to avoid (wrong) g++ warning.
-			std::FILE *volatile nfile=file?file:cimg::fopen(nfilename,"rb");
+			const char *volatile nfilename=filename?filename:memory?"(memory)":0; // Use 'volatile' to avoid (wrong) g++ warning.
+			std::FILE *volatile nfile=memory?0:file?file:cimg::fopen(nfilename,"rb");
 #else
-			const char *nfilename=filename;
-			std::FILE *nfile=file?file:cimg::fopen(nfilename,"rb");
+			const char *nfilename=filename?filename:memory?"(memory)":0;
+			std::FILE *nfile=memory?0:file?file:cimg::fopen(nfilename,"rb");
 #endif
 			unsigned char pngCheck[8]={0};
-			cimg::fread(pngCheck,8,(std::FILE*)nfile);
+			_cimg_png_buffer source={memory,memory_size};
+			if(memory)
+			{
+				if(memory_size>=8) std::memcpy(pngCheck,memory,8);
+				source.ptr+=8;
+				source.size-=std::min(memory_size,(size_t)8);
+			}
+			else cimg::fread(pngCheck,8,(std::FILE*)nfile);
 			if(png_sig_cmp(pngCheck,0,8))
 			{
-				if(!file) cimg::fclose(nfile);
+				if(nfile&&!file) cimg::fclose(nfile);
 				throw CImgIOException(_cimg_instance
 					"load_png(): Invalid PNG file '%s'.",
 					cimg_instance,
@@ -57177,7 +57279,7 @@ res(x,y,z,c)=max_val;
 			png_structp png_ptr=png_create_read_struct(PNG_LIBPNG_VER_STRING,user_error_ptr,user_error_fn,user_warning_fn);
 			if(!png_ptr)
 			{
-				if(!file) cimg::fclose(nfile);
+				if(nfile&&!file) cimg::fclose(nfile);
 				throw CImgIOException(_cimg_instance
 					"load_png(): Failed to initialize 'png_ptr' structure for file '%s'.",
 					cimg_instance,
@@ -57186,7 +57288,7 @@ res(x,y,z,c)=max_val;
 			png_infop info_ptr=png_create_info_struct(png_ptr);
 			if(!info_ptr)
 			{
-				if(!file) cimg::fclose(nfile);
+				if(nfile&&!file) cimg::fclose(nfile);
 				png_destroy_read_struct(&png_ptr,(png_infopp)0,(png_infopp)0);
 				throw CImgIOException(_cimg_instance
 					"load_png(): Failed to initialize 'info_ptr' structure for file '%s'.",
@@ -57196,7 +57298,7 @@ res(x,y,z,c)=max_val;
 			png_infop end_info=png_create_info_struct(png_ptr);
 			if(!end_info)
 			{
-				if(!file) cimg::fclose(nfile);
+				if(nfile&&!file) cimg::fclose(nfile);
 				png_destroy_read_struct(&png_ptr,&info_ptr,(png_infopp)0);
 				throw CImgIOException(_cimg_instance
 					"load_png(): Failed to initialize 'end_info' structure for file '%s'.",
@@ -57207,14 +57309,15 @@ res(x,y,z,c)=max_val;
 			// Error handling callback for png file reading
 			if(setjmp(png_jmpbuf(png_ptr)))
 			{
-				if(!file) cimg::fclose((std::FILE*)nfile);
+				if(nfile&&!file) cimg::fclose((std::FILE*)nfile);
 				png_destroy_read_struct(&png_ptr,&end_info,(png_infopp)0);
 				throw CImgIOException(_cimg_instance
 					"load_png(): Encountered unknown fatal error in libpng for file '%s'.",
 					cimg_instance,
 					nfilename?nfilename:"(FILE*)");
 			}
-			png_init_io(png_ptr,nfile);
+			if(memory) png_set_read_fn(png_ptr,&source,_cimg_png_read_buffer);
+			else png_init_io(png_ptr,nfile);
 			png_set_sig_bytes(png_ptr,8);
 
 			// Get PNG Header Info up to data block
@@ -57224,6 +57327,8 @@ res(x,y,z,c)=max_val;
 			bool is_gray=false;
 			png_get_IHDR(png_ptr,info_ptr,&W,&H,&bit_depth,&color_type,&interlace_type,(int*)0,(int*)0);
 			if(bits_per_pixel) *bits_per_pixel=(unsigned int)bit_depth;
+			const bool to_gray=gray_from_color&&(color_type&PNG_COLOR_MASK_COLOR);
+			if(gray_from_color) *gray_from_color=to_gray;
 
 			// Transforms to unify image data
 			if(color_type==PNG_COLOR_TYPE_PALETTE)
@@ -57249,13 +57354,21 @@ res(x,y,z,c)=max_val;
 				color_type|=PNG_COLOR_MASK_COLOR;
 				is_gray=true;
 			}
+			if(to_gray)
+			{
+				// Equal weights, to approximate a plain average of the channels.
+				png_set_rgb_to_gray_fixed(png_ptr,1,33333,33333);
+				if(color_type&PNG_COLOR_MASK_ALPHA) png_set_strip_alpha(png_ptr);
+				color_type=PNG_COLOR_TYPE_GRAY;
+				is_gray=true;
+			}
 			if(color_type==PNG_COLOR_TYPE_RGB)
 				png_set_filler(png_ptr,0xffffU,PNG_FILLER_AFTER);
 
 			png_read_update_info(png_ptr,info_ptr);
 			if(bit_depth!=8&&bit_depth!=16)
 			{
-				if(!file) cimg::fclose(nfile);
+				if(nfile&&!file) cimg::fclose(nfile);
 				png_destroy_read_struct(&png_ptr,&end_info,(png_infopp)0);
 				throw CImgIOException(_cimg_instance
 					"load_png(): Invalid bit depth %u in file '%s'.",
@@ -57263,17 +57376,18 @@ res(x,y,z,c)=max_val;
 					bit_depth,nfilename?nfilename:"(FILE*)");
 			}
 			const int byte_depth=bit_depth>>3;
+			const unsigned int samples=to_gray?1:4;
 
 			// Allocate Memory for Image Read
 			png_bytep *const imgData=new png_bytep[H];
-			for(unsigned int row=0; row<H; ++row) imgData[row]=new png_byte[(size_t)byte_depth*4*W];
+			for(unsigned int row=0; row<H; ++row) imgData[row]=new png_byte[(size_t)byte_depth*samples*W];
 			png_read_image(png_ptr,imgData);
 			png_read_end(png_ptr,end_info);
 
 			// Read pixel data
-			if(color_type!=PNG_COLOR_TYPE_RGB&&color_type!=PNG_COLOR_TYPE_RGB_ALPHA)
+			if(!to_gray&&color_type!=PNG_COLOR_TYPE_RGB&&color_type!=PNG_COLOR_TYPE_RGB_ALPHA)
 			{
-				if(!file) cimg::fclose(nfile);
+				if(nfile&&!file) cimg::fclose(nfile);
 				png_destroy_read_struct(&png_ptr,&end_info,(png_infopp)0);
 				throw CImgIOException(_cimg_instance
 					"load_png(): Invalid color coding type %u in file '%s'.",
@@ -57287,7 +57401,7 @@ res(x,y,z,c)=max_val;
 			}
 			catch(...)
 			{
-				if(!file) cimg::fclose(nfile); throw;
+				if(nfile&&!file) cimg::fclose(nfile); throw;
 			}
 			T
 				*ptr_r=data(0,0,0,0),
@@ -57304,6 +57418,7 @@ res(x,y,z,c)=max_val;
 						cimg_forX(*this,x)
 						{
 							*(ptr_r++)=(T)*(ptrs++);
+							if(to_gray) continue;
 							if(ptr_g) *(ptr_g++)=(T)*(ptrs++); else ++ptrs;
 							if(ptr_b) *(ptr_b++)=(T)*(ptrs++); else ++ptrs;
 							if(ptr_a) *(ptr_a++)=(T)*(ptrs++); else ++ptrs;
@@ -57315,10 +57430,11 @@ res(x,y,z,c)=max_val;
 					cimg_forY(*this,y)
 					{
 						const unsigned short *ptrs=(unsigned short*)(imgData[y]);
-						if(!cimg::endianness()) cimg::invert_endianness(ptrs,4*_width);
+						if(!cimg::endianness()) cimg::invert_endianness(ptrs,samples*_width);
 						cimg_forX(*this,x)
 						{
 							*(ptr_r++)=(T)*(ptrs++);
+							if(to_gray) continue;
 							if(ptr_g) *(ptr_g++)=(T)*(ptrs++); else ++ptrs;
 							if(ptr_b) *(ptr_b++)=(T)*(ptrs++); else ++ptrs;
 							if(ptr_a) *(ptr_a++)=(T)*(ptrs++); else ++ptrs;
@@ -57331,7 +57447,7 @@ res(x,y,z,c)=max_val;
 			// Deallocate Image Read Memory
 			cimg_forY(*this,n) delete[] imgData[n];
 			delete[] imgData;
-			if(!file) cimg::fclose(nfile);
+			if(nfile&&!file) cimg::fclose(nfile);
 			return *this;
 #endif
 		}
@@ -57833,6 +57949,8 @@ res(x,y,z,c)=max_val;
 		   \param step_frame Step value of frame reading.
 		   \param[out] voxel_size Voxel size, as stored in the filename.
 		   \param[out] description Description, as stored in the filename.
+		   \param[in,out] gray_from_color If not null and a single frame is read, a color image in an 8 bit layout
+		   is decoded straight to the mean of its color channels, without alpha, and this is set to whether that happened.
 		   \note
 		   - libtiff support is enabled by defining the precompilation
 			directive \c cimg_use_tif.
@@ -57846,7 +57964,8 @@ res(x,y,z,c)=max_val;
 			const unsigned int first_frame=0,const unsigned int last_frame=~0U,
 			const unsigned int step_frame=1,
 			float *const voxel_size=0,
-			CImg<charT> *const description=0)
+			CImg<charT> *const description=0,
+			bool *const gray_from_color=0)
 		{
 			if(!filename)
 				throw CImgArgumentException(_cimg_instance
@@ -57858,6 +57977,7 @@ res(x,y,z,c)=max_val;
 				nstep_frame=step_frame?step_frame:1;
 			unsigned int nlast_frame=first_frame<last_frame?last_frame:first_frame;
 
+			if(gray_from_color) *gray_from_color=false;
 #ifndef cimg_use_tiff
 			cimg::unused(voxel_size,description);
 			if(nfirst_frame||nlast_frame!=~0U||nstep_frame>1)
@@ -57886,9 +58006,11 @@ res(x,y,z,c)=max_val;
 				if(nlast_frame>=nb_images) nlast_frame=nb_images-1;
 				TIFFSetDirectory(tif,0);
 				CImg<T> frame;
+				// Only a single frame is decoded to gray, so frames are never mixed with color ones.
+				bool *const frame_gray=nfirst_frame==nlast_frame?gray_from_color:0;
 				for(unsigned int l=nfirst_frame; l<=nlast_frame; l+=nstep_frame)
 				{
-					frame._load_tiff(tif,l,voxel_size,description);
+					frame._load_tiff(tif,l,voxel_size,description,frame_gray);
 					if(l==nfirst_frame)
 						assign(frame._width,frame._height,1+(nlast_frame-nfirst_frame)/nstep_frame,frame._spectrum);
 					if(frame._width>_width||frame._height>_height||frame._spectrum>_spectrum)
@@ -58004,6 +58126,35 @@ res(x,y,z,c)=max_val;
 			}
 		}
 
+		// Averages the first three samples of each pixel into a single channel.
+		void _load_tiff_contig_gray(TIFF *const tif,const uint16 samplesperpixel,const uint32 nx,const uint32 ny)
+		{
+			unsigned char *const buf=(unsigned char*)_TIFFmalloc(TIFFStripSize(tif));
+			if(buf)
+			{
+				uint32 row,rowsperstrip=(uint32)-1;
+				TIFFGetField(tif,TIFFTAG_ROWSPERSTRIP,&rowsperstrip);
+				for(row=0; row<ny; row+=rowsperstrip)
+				{
+					uint32 nrow=(row+rowsperstrip>ny?ny-row:rowsperstrip);
+					tstrip_t strip=TIFFComputeStrip(tif,row,0);
+					if((TIFFReadEncodedStrip(tif,strip,buf,-1))<0)
+					{
+						_TIFFfree(buf); TIFFClose(tif);
+						throw CImgIOException(_cimg_instance
+							"load_tiff(): Invalid strip in file '%s'.",
+							cimg_instance,
+							TIFFFileName(tif));
+					}
+					const unsigned char *ptr=buf;
+					T *ptrd=data(0,row);
+					for(size_t n=(size_t)nrow*nx; n; --n, ptr+=samplesperpixel)
+						*(ptrd++)=(T)((ptr[0]+ptr[1]+ptr[2]+1)/3);
+				}
+				_TIFFfree(buf);
+			}
+		}
+
 		template<typename t>
 		void _load_tiff_separate(TIFF *const tif,const uint16 samplesperpixel,const uint32 nx,const uint32 ny)
 		{
@@ -58035,8 +58186,9 @@ res(x,y,z,c)=max_val;
 		}
 
 		CImg<T>& _load_tiff(TIFF *const tif,const unsigned int directory,
-			float *const voxel_size,CImg<charT> *const description)
+			float *const voxel_size,CImg<charT> *const description,bool *const gray_from_color=0)
 		{
+			if(gray_from_color) *gray_from_color=false;
 			if(!TIFFSetDirectory(tif,directory)) return assign();
 			uint16 samplesperpixel=1,bitspersample=8,photo=0;
 			uint16 sampleformat=1;
@@ -58077,12 +58229,26 @@ res(x,y,z,c)=max_val;
 					CImg<charT>::string(s_description).move_to(*description);
 			}
 			const unsigned int spectrum=!is_spp||photo>=3?(photo>1?3:1):samplesperpixel;
-			assign(nx,ny,1,spectrum);
-
-			if((photo>=3&&sampleformat==1&&
+			const bool is_raster=(photo>=3&&sampleformat==1&&
 				(bitspersample==4||bitspersample==8)&&
 				(samplesperpixel==1||samplesperpixel==3||samplesperpixel==4))||
-				(bitspersample==1&&samplesperpixel==1))
+				(bitspersample==1&&samplesperpixel==1);
+			bool to_gray=false;
+			if(gray_from_color&&spectrum>=3)
+			{
+				uint16 config=PLANARCONFIG_CONTIG;
+				TIFFGetFieldDefaulted(tif,TIFFTAG_PLANARCONFIG,&config);
+				to_gray=is_raster||(photo==PHOTOMETRIC_RGB&&config==PLANARCONFIG_CONTIG&&!TIFFIsTiled(tif)&&
+					bitspersample==8&&sampleformat==SAMPLEFORMAT_UINT);
+				*gray_from_color=to_gray;
+			}
+			assign(nx,ny,1,to_gray?1:spectrum);
+
+			if(to_gray&&!is_raster)
+			{
+				_load_tiff_contig_gray(tif,samplesperpixel,nx,ny);
+			}
+			else if(is_raster)
 			{
 // Special case for unsigned color images.
 				uint32 *const raster=(uint32*)_TIFFmalloc(nx*ny*sizeof(uint32));
@@ -58095,7 +58261,13 @@ res(x,y,z,c)=max_val;
 						cimg::strbuffersize(nx*ny*sizeof(uint32)),filename);
 				}
 				TIFFReadRGBAImage(tif,nx,ny,raster,0);
-				switch(spectrum)
+				if(to_gray)
+					cimg_forXY(*this,x,y)
+					{
+						const uint32 pixel=raster[nx*(ny-1-y)+x];
+						(*this)(x,y,0)=(T)((TIFFGetR(pixel)+TIFFGetG(pixel)+TIFFGetB(pixel)+1)/3);
+					}
+				else switch(spectrum)
 				{
 					case 1:
 						cimg_forXY(*this,x,y)
@@ -61964,8 +62136,61 @@ res(x,y,z,c)=max_val;
 			return _save_png(file,0,bytes_per_pixel);
 		}
 
+		//! Save image as a PNG file, with control over the encoder.
+		/**
+		   \param filename Filename, as a C-string.
+		   \param compression_level zlib level in [0,9], or -1 for the libpng default.
+		   \param filters Set of PNG_FILTER_* flags tried on each row, or -1 for the libpng default.
+		   \param reduce_bilevel Whether an image that is only black and white is written as 1-bit gray.
+		**/
+		const CImg<T>& save_png(const char *const filename,const int compression_level,const int filters,
+			const bool reduce_bilevel) const
+		{
+			return _save_png(0,filename,0,compression_level,filters,reduce_bilevel);
+		}
+
+		//! Save image as a PNG file, with control over the encoder \overloading.
+		const CImg<T>& save_png(std::FILE *const file,const int compression_level,const int filters,
+			const bool reduce_bilevel) const
+		{
+			return _save_png(file,0,0,compression_level,filters,reduce_bilevel);
+		}
+
+		// [internal] Whether the image only holds the values 0 and 255, with all channels equal when it is rgb.
+		bool _is_bilevel() const
+		{
+			if(is_empty()||(_spectrum!=1&&_spectrum!=3)) return false;
+			const ulongT whd=(ulongT)_width*_height*_depth;
+			const T *const pC0=_data;
+			for(ulongT i=0; i<whd; ++i)
+			{
+				const T val=pC0[i];
+				if(val!=(T)0&&val!=(T)255) return false;
+				if(_spectrum==3&&(pC0[i+whd]!=val||pC0[i+2*whd]!=val)) return false;
+			}
+			return true;
+		}
+
+		// [internal] Pack a row of a bilevel image into bits, most significant first, set where the pixel is white (or black if set_black).
+		void _pack_bilevel_row(unsigned char *const ptrd,const unsigned int y,const unsigned int z,const bool set_black) const
+		{
+			const T *ptrs=data(0,y,z,0);
+			const unsigned char on=set_black?0:1;
+			for(unsigned int x=0; x<_width; x+=8)
+			{
+				unsigned char byte=0;
+				const unsigned int end=x+8>_width?_width:x+8;
+				for(unsigned int xx=x; xx<end; ++xx)
+				{
+					byte|=((*(ptrs++)==(T)0?0:1)==on)<<(7-(xx-x));
+				}
+				ptrd[x>>3]=byte;
+			}
+		}
+
 		const CImg<T>& _save_png(std::FILE *const file,const char *const filename,
-			const unsigned int bytes_per_pixel=0) const
+			const unsigned int bytes_per_pixel=0,const int compression_level=-1,const int filters=-1,
+			const bool reduce_bilevel=false) const
 		{
 			if(!file&&!filename)
 				throw CImgArgumentException(_cimg_instance
@@ -61977,7 +62202,7 @@ res(x,y,z,c)=max_val;
 			}
 
 #ifndef cimg_use_png
-			cimg::unused(bytes_per_pixel);
+			cimg::unused(bytes_per_pixel,compression_level,filters,reduce_bilevel);
 			if(!file) return save_other(filename);
 			else throw CImgIOException(_cimg_instance
 				"save_png(): Unable to save data in '(*FILE)' unless libpng is enabled.",
@@ -62045,6 +62270,26 @@ res(x,y,z,c)=max_val;
 					nfilename?nfilename:"(FILE*)");
 			}
 			png_init_io(png_ptr,nfile);
+			if(compression_level>=0) png_set_compression_level(png_ptr,compression_level);
+			if(filters>=0) png_set_filter(png_ptr,PNG_FILTER_TYPE_BASE,filters);
+
+			if(reduce_bilevel&&!bytes_per_pixel&&_is_bilevel())
+			{
+				// 1-bit gray, an eighth of the data to filter and deflate
+				png_set_IHDR(png_ptr,info_ptr,_width,_height,1,PNG_COLOR_TYPE_GRAY,PNG_INTERLACE_NONE,
+					PNG_COMPRESSION_TYPE_DEFAULT,PNG_FILTER_TYPE_DEFAULT);
+				png_write_info(png_ptr,info_ptr);
+				CImg<ucharT> row((_width+7)/8);
+				cimg_forY(*this,y)
+				{
+					_pack_bilevel_row(row._data,y,0,false);
+					png_write_row(png_ptr,row._data);
+				}
+				png_write_end(png_ptr,info_ptr);
+				png_destroy_write_struct(&png_ptr,&info_ptr);
+				if(!file) cimg::fclose(nfile);
+				return *this;
+			}
 
 			const int bit_depth=bytes_per_pixel?(bytes_per_pixel*8):(stmax>=256?16:8);
 
@@ -62726,10 +62971,12 @@ res(x,y,z,c)=max_val;
 		//! Save image as a TIFF file.
 		/**
 		   \param filename Filename, as a C-string.
-		   \param compression_type Type of data compression. Can be <tt>{ 0=None | 1=LZW | 2=JPEG }</tt>.
+		   \param compression_type Type of data compression. Can be <tt>{ 0=None | 1=LZW | 2=JPEG | 3=Deflate | 4=CCITT G4 }</tt>.
+			CCITT G4 only applies to bilevel images, others are saved with LZW.
 		   \param voxel_size Voxel size, to be stored in the filename.
 		   \param description Description, to be stored in the filename.
 		   \param use_bigtiff Allow to save big tiff files (>4Gb).
+		   \param reduce_bilevel Whether an image that is only black and white is saved as 1 bit per pixel.
 		   \note
 		   - libtiff support is enabled by defining the precompilation
 			directive \c cimg_use_tif.
@@ -62741,7 +62988,7 @@ res(x,y,z,c)=max_val;
 		 **/
 		const CImg<T>& save_tiff(const char *const filename,const unsigned int compression_type=0,
 			const float *const voxel_size=0,const char *const description=0,
-			const bool use_bigtiff=true) const
+			const bool use_bigtiff=true,const bool reduce_bilevel=false) const
 		{
 			if(!filename)
 				throw CImgArgumentException(_cimg_instance
@@ -62758,7 +63005,17 @@ res(x,y,z,c)=max_val;
 			TIFF *tif=TIFFOpen(filename,_use_bigtiff?"w8":"w4");
 			if(tif)
 			{
-				cimg_forZ(*this,z) _save_tiff(tif,z,z,compression_type,voxel_size,description);
+				// CCITT group 4 only encodes bilevel pages, anything else falls back to LZW
+				const bool bilevel=(reduce_bilevel||compression_type==4)&&_is_bilevel();
+				if(bilevel)
+				{
+					cimg_forZ(*this,z) _save_tiff_bilevel(tif,z,z,compression_type,voxel_size,description);
+				}
+				else
+				{
+					const unsigned int ct=compression_type==4?1:compression_type;
+					cimg_forZ(*this,z) _save_tiff(tif,z,z,ct,voxel_size,description);
+				}
 				TIFFClose(tif);
 			}
 			else
@@ -62771,7 +63028,7 @@ res(x,y,z,c)=max_val;
 				filename);*/
 			return *this;
 #else
-			cimg::unused(compression_type,voxel_size,description,use_bigtiff);
+			cimg::unused(compression_type,voxel_size,description,use_bigtiff,reduce_bilevel);
 			return save_other(filename);
 #endif
 		}
@@ -62818,7 +63075,7 @@ res(x,y,z,c)=max_val;
 			TIFFSetField(tif,TIFFTAG_BITSPERSAMPLE,bpp);
 			TIFFSetField(tif,TIFFTAG_PLANARCONFIG,PLANARCONFIG_CONTIG);
 			TIFFSetField(tif,TIFFTAG_PHOTOMETRIC,photometric);
-			TIFFSetField(tif,TIFFTAG_COMPRESSION,compression_type==2?COMPRESSION_JPEG:
+			TIFFSetField(tif,TIFFTAG_COMPRESSION,compression_type==3?COMPRESSION_ADOBE_DEFLATE:compression_type==2?COMPRESSION_JPEG:
 				compression_type==1?COMPRESSION_LZW:COMPRESSION_NONE);
 			rowsperstrip=TIFFDefaultStripSize(tif,rowsperstrip);
 			TIFFSetField(tif,TIFFTAG_ROWSPERSTRIP,rowsperstrip);
@@ -62871,6 +63128,52 @@ res(x,y,z,c)=max_val;
 				pixel_type(),filename?filename:"(FILE*)");
 			return *this;
 		}
+
+		// [internal] Save a plane of a bilevel image into a tiff file as 1 bit per pixel
+		const CImg<T>& _save_tiff_bilevel(TIFF *tif,const unsigned int directory,const unsigned int z,
+			const unsigned int compression_type,const float *const voxel_size,
+			const char *const description) const
+		{
+			const char *const filename=TIFFFileName(tif);
+			TIFFSetDirectory(tif,directory);
+			TIFFSetField(tif,TIFFTAG_IMAGEWIDTH,_width);
+			TIFFSetField(tif,TIFFTAG_IMAGELENGTH,_height);
+			if(voxel_size)
+			{
+				const float vx=voxel_size[0],vy=voxel_size[1],vz=voxel_size[2];
+				TIFFSetField(tif,TIFFTAG_RESOLUTIONUNIT,RESUNIT_NONE);
+				TIFFSetField(tif,TIFFTAG_XRESOLUTION,1.0f/vx);
+				TIFFSetField(tif,TIFFTAG_YRESOLUTION,1.0f/vy);
+				CImg<charT> s_description(256);
+				cimg_snprintf(s_description,s_description._width,"VX=%g VY=%g VZ=%g spacing=%g",vx,vy,vz,vz);
+				TIFFSetField(tif,TIFFTAG_IMAGEDESCRIPTION,s_description.data());
+			}
+			if(description) TIFFSetField(tif,TIFFTAG_IMAGEDESCRIPTION,description);
+			TIFFSetField(tif,TIFFTAG_ORIENTATION,ORIENTATION_TOPLEFT);
+			TIFFSetField(tif,TIFFTAG_SAMPLESPERPIXEL,1);
+			TIFFSetField(tif,TIFFTAG_BITSPERSAMPLE,1);
+			TIFFSetField(tif,TIFFTAG_PLANARCONFIG,PLANARCONFIG_CONTIG);
+			// fax style, set bits are black
+			TIFFSetField(tif,TIFFTAG_PHOTOMETRIC,PHOTOMETRIC_MINISWHITE);
+			TIFFSetField(tif,TIFFTAG_COMPRESSION,compression_type==4?COMPRESSION_CCITTFAX4:compression_type==3?COMPRESSION_ADOBE_DEFLATE:
+				compression_type==1?COMPRESSION_LZW:COMPRESSION_NONE);
+			// group 4 codes each row against the one above, so one strip holds the whole page
+			TIFFSetField(tif,TIFFTAG_ROWSPERSTRIP,compression_type==4?(uint32)_height:TIFFDefaultStripSize(tif,(uint32)-1));
+			TIFFSetField(tif,TIFFTAG_FILLORDER,FILLORDER_MSB2LSB);
+			TIFFSetField(tif,TIFFTAG_SOFTWARE,"CImg");
+			CImg<ucharT> row((_width+7)/8);
+			cimg_forY(*this,y)
+			{
+				_pack_bilevel_row(row._data,y,z,true);
+				if(TIFFWriteScanline(tif,row._data,y,0)<0)
+					throw CImgIOException(_cimg_instance
+						"save_tiff(): Invalid scanline writing when saving file '%s'.",
+						cimg_instance,
+						filename?filename:"(FILE*)");
+			}
+			TIFFWriteDirectory(tif);
+			return *this;
+		}
 #endif
 
 	//! Save image as a MINC2 file.
@@ -71307,37 +71610,225 @@ res(x,y,z,c)=max_val;
 		}
 
 		  // End of cimg_library:: namespace
-		inline auto temporary_file_name(char const* base)
+
+		/*
+			How save_image encodes pngs and tiffs.
+			Shared by every save, so it should be set before any processing starts.
+		*/
+		struct encode_options {
+			int png_level=-1; //zlib level in [0,9], -1 for the libpng default
+			int png_filters=-1; //set of PNG_FILTER_* flags, -1 for the libpng default
+			unsigned int tiff_compression=1; //same as the compression_type of save_tiff
+			bool reduce_bilevel=false; //save pages that are only black and white as 1 bit per pixel
+		};
+
+		inline encode_options& encoding()
+		{
+			static encode_options options;
+			return options;
+		}
+
+		/*
+			Whether saved files are flushed to disk before they are put in place.
+			Directory entries are flushed once per directory by sync_output_directories instead of after every save.
+		*/
+		inline bool& sync_outputs()
 		{
-			static auto const path_base = []()
+			static bool sync=false;
+			return sync;
+		}
+
+		namespace detail {
+			struct synced_directories {
+				std::mutex mutex;
+				std::vector<std::filesystem::path> directories;
+			};
+
+			inline synced_directories& output_directories()
 			{
-				auto path = std::filesystem::temp_directory_path();
-				path /= "sproc";
-				std::filesystem::create_directories(path);
-				path /= "";
-				return path;
-			}();
+				static synced_directories dirs;
+				return dirs;
+			}
+
+			inline void sync_file(std::FILE* file)
+			{
+				std::fflush(file);
+#if cimg_OS==2
+				_commit(_fileno(file));
+#elif cimg_OS==1
+				fsync(fileno(file));
+#endif
+			}
+		}
+
+		//flushes the entries of every directory that was saved into since the last call
+		inline void sync_output_directories()
+		{
+			auto& dirs=detail::output_directories();
+			std::lock_guard<std::mutex> lock(dirs.mutex);
+#if cimg_OS==1
+			for(auto const& dir:dirs.directories)
+			{
+				int const fd=::open(dir.c_str(),O_RDONLY|O_DIRECTORY);
+				if(fd>=0)
+				{
+					fsync(fd);
+					::close(fd);
+				}
+			}
+#endif
+			dirs.directories.clear();
+		}
+
+		//a name for a temporary file in the same directory as destination
+		inline std::filesystem::path temporary_file_name(std::filesystem::path const& destination)
+		{
 			thread_local std::mt19937_64 mt{std::random_device{}()};
-			auto path{path_base};
-			for(auto str=base;*str;++str)
+			auto path{destination};
+			path+=".";
+			path+=std::to_string(mt());
+			path+=".sproc";
+			return path;
+		}
+
+		/*
+			The file an output is written to before it replaces the destination.
+			It is made in the destination's directory, so putting it in place is a rename within one filesystem rather than a copy.
+			Where the system allows it, the file has no name until commit, so an interrupted save leaves nothing behind.
+			Writers that open files themselves can ask for a named file and write to path() instead.
+		*/
+		class output_file {
+			std::filesystem::path _destination;
+			std::filesystem::path _temporary; //empty while the file has no name
+			std::FILE* _file;
+			bool _committed;
+		public:
+			output_file(char const* destination,bool named):_destination(destination),_file(nullptr),_committed(false)
 			{
-				if(*str=='\\'||*str=='/')
+				if(named)
 				{
-					path+="@d@";
+					_temporary=temporary_file_name(_destination);
+					return;
 				}
-				else if(*str==':')
-				{ 
-					path+="@c@";
+#if cimg_OS==1&&defined(O_TMPFILE)
+				//linking the file in goes through /proc
+				static bool const can_link=access("/proc/self/fd",X_OK)==0;
+				if(can_link)
+				{
+					auto dir=_destination.parent_path();
+					if(dir.empty())
+					{
+						dir=".";
+					}
+					int const fd=::open(dir.c_str(),O_TMPFILE|O_WRONLY,0666);
+					if(fd>=0)
+					{
+						_file=fdopen(fd,"wb");
+						if(_file)
+						{
+							return;
+						}
+						::close(fd);
+					}
 				}
-				else
+#endif
+				_temporary=temporary_file_name(_destination);
+				_file=cimg::fopen(_temporary.string().c_str(),"wb");
+			}
+
+			output_file(output_file const&)=delete;
+			output_file& operator=(output_file const&)=delete;
+
+			~output_file()
+			{
+				if(_file)
+				{
+					std::fclose(_file);
+				}
+				if(!_committed&&!_temporary.empty())
 				{
-					path+=*str;
+					std::error_code ec;
+					std::filesystem::remove(_temporary,ec);
 				}
 			}
-			path+="_";
-			path+=std::to_string(mt());
-			return path;
-		}
+
+			//the open file, or null if a named file was asked for
+			std::FILE* file() const noexcept
+			{
+				return _file;
+			}
+
+			std::filesystem::path const& path() const noexcept
+			{
+				return _temporary;
+			}
+
+			//puts the written file in place of the destination
+			void commit()
+			{
+				bool const sync=sync_outputs();
+				if(_file)
+				{
+					if(sync)
+					{
+						detail::sync_file(_file);
+					}
+					else
+					{
+						std::fflush(_file);
+					}
+				}
+				else if(sync)
+				{
+					if(std::FILE* const file=std_fopen(_temporary.string().c_str(),"r+b"))
+					{
+						detail::sync_file(file);
+						std::fclose(file);
+					}
+				}
+#if cimg_OS==1&&defined(O_TMPFILE)
+				if(_temporary.empty())
+				{
+					//linkat will not replace an existing file, so link under a temporary name and rename that
+					auto const name=temporary_file_name(_destination);
+					auto const fd_path=std::string("/proc/self/fd/")+std::to_string(fileno(_file));
+					if(linkat(AT_FDCWD,fd_path.c_str(),AT_FDCWD,name.c_str(),AT_SYMLINK_FOLLOW))
+					{
+						throw std::runtime_error(std::string("Failed to save to ")+_destination.string());
+					}
+					_temporary=name;
+				}
+#endif
+				if(_file)
+				{
+					std::fclose(_file);
+					_file=nullptr;
+				}
+				try
+				{
+					std::filesystem::rename(_temporary,_destination);
+				}
+				catch(...)
+				{
+					_committed=true;
+					std::string msg{"Failed to save to "};
+					msg.append(_destination.string());
+					msg.append(". Temporary file saved to ").append(_temporary.string());
+					throw std::runtime_error{msg};
+				}
+				_committed=true;
+				if(sync)
+				{
+					auto& dirs=detail::output_directories();
+					auto dir=std::filesystem::absolute(_destination).parent_path();
+					std::lock_guard<std::mutex> lock(dirs.mutex);
+					if(std::find(dirs.directories.begin(),dirs.directories.end(),dir)==dirs.directories.end())
+					{
+						dirs.directories.push_back(std::move(dir));
+					}
+				}
+			}
+		};
 
 		template<typename T>
 		void save_image(CImg<T> const& img,char const* output,support_type support,int quality=100)
@@ -71352,35 +71843,122 @@ res(x,y,z,c)=max_val;
 			default:
 				throw std::invalid_argument{"Unsupported"};
 			}
-			auto const path=temporary_file_name(output);
-			auto const& path_string=path.string();
-			auto const c_str=path_string.c_str();
+			//libtiff opens its files by name
+			output_file out(output,support==support_type::tiff);
 			switch(support)
 			{
 			case support_type::bmp:
-				img.save_bmp(c_str);
+				img.save_bmp(out.file());
 				break;
 			case support_type::jpeg:
-				img.save_jpeg(c_str,quality);
+				img.save_jpeg(out.file(),quality);
 				break;
 			case support_type::png:
-				img.save_png(c_str);
+			{
+				auto const& enc=encoding();
+				img.save_png(out.file(),enc.png_level,enc.png_filters,enc.reduce_bilevel);
 				break;
+			}
 			case support_type::tiff:
-				img.save_tiff(c_str,1);
+			{
+				auto const& enc=encoding();
+				img.save_tiff(out.path().string().c_str(),enc.tiff_compression,0,0,true,enc.reduce_bilevel);
 			}
-			try
+			}
+			out.commit();
+		}
+
+		/*
+			Saves pages into one multi-page tiff, in order of the numbers they are added with, starting from 0.
+			Pages that arrive early are held until the ones before them are written, so threads can add them in any order.
+			Nothing replaces the destination until commit.
+		*/
+		template<typename T>
+		class tiff_stack {
+			output_file _out;
+#ifdef cimg_use_tiff
+			TIFF* _tif;
+#endif
+			unsigned int _written;
+			std::map<unsigned int,CImg<T>> _pending;
+			std::mutex _mutex;
+
+			void write(CImg<T> const& page)
 			{
-				std::filesystem::rename(path,output);
+#ifdef cimg_use_tiff
+				auto const& enc=encoding();
+				if((enc.reduce_bilevel||enc.tiff_compression==4)&&page._is_bilevel())
+				{
+					page._save_tiff_bilevel(_tif,_written,0,enc.tiff_compression,0,0);
+				}
+				else
+				{
+					page._save_tiff(_tif,_written,0,enc.tiff_compression==4?1:enc.tiff_compression,0,0);
+				}
+				++_written;
+#else
+				cimg::unused(page);
+#endif
 			}
-			catch(...)
+		public:
+			explicit tiff_stack(char const* destination):_out(destination,true),_written(0)
 			{
-				std::string msg{"Failed to save to "};
-				msg.append(output);
-				msg.append(". Temporary file saved to ").append(path.string());
-				throw std::runtime_error{msg};
+#ifdef cimg_use_tiff
+				//a whole book of pages can pass the 4GB limit of classic tiffs
+				_tif=TIFFOpen(_out.path().string().c_str(),"w8");
+				if(!_tif)
+				{
+					throw std::runtime_error(std::string{"Failed to save tiff: "}+destination);
+				}
+#else
+				throw std::runtime_error("Multi-page tiffs need libtiff");
+#endif
 			}
-		}
+
+			tiff_stack(tiff_stack const&)=delete;
+			tiff_stack& operator=(tiff_stack const&)=delete;
+
+			~tiff_stack()
+			{
+#ifdef cimg_use_tiff
+				if(_tif)
+				{
+					TIFFClose(_tif);
+				}
+#endif
+			}
+
+			void add(unsigned int number,CImg<T> page)
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if(number!=_written)
+				{
+					_pending.emplace(number,std::move(page));
+					return;
+				}
+				write(page);
+				for(auto it=_pending.begin();it!=_pending.end()&&it->first==_written;it=_pending.erase(it))
+				{
+					write(it->second);
+				}
+			}
+
+			//the number of pages written so far
+			unsigned int size() const noexcept
+			{
+				return _written;
+			}
+
+			//finishes the file and puts it in place of the destination; pages still waiting on earlier ones are dropped
+			void commit()
+			{
+#ifdef cimg_use_tiff
+				TIFFClose(_tif);
+				_tif=nullptr;
+#endif
+				_out.commit();
+			}
+		};
 		
 		inline std::string number_filename(std::string const& filename,unsigned int number,unsigned int num_digs=0)
 		{
@@ -24,7 +24,7 @@ along with this program. If not, see <https://www.gnu.org/licenses/>.
 #include "shorthand.h"
 #include <assert.h>
 #include <functional>
-#include "lib\exstring\exmath.h"
+#include "lib/exstring/exmath.h"
 #include <array>
 using namespace ImageUtils;
 using namespace std;
@@ -213,7 +213,7 @@ namespace cimg_library {
 			return decltype(acc)({acc[0]+color[0],acc[1]+color[1],acc[2]+color[2]});
 		},std::array<unsigned int,3>({0,0,0}));
 		auto const num_pixels=image._width*image._height;
-		return {unsigned char(c[0]/num_pixels),unsigned char(c[1]/num_pixels),unsigned char(c[2]/num_pixels)};
+		return {static_cast<unsigned char>(c[0]/num_pixels),static_cast<unsigned char>(c[1]/num_pixels),static_cast<unsigned char>(c[2]/num_pixels)};
 	}
 	Grayscale average_gray(cimg_library::CImg<unsigned char> const& image)
 	{
@@ -305,7 +305,7 @@ namespace cimg_library {
 	{
 		return get_map<3,1>(image,[](auto color)
 		{
-			return std::array<unsigned char,1>{unsigned char(std::round((double(color[0])+color[1]+color[2])/3.0f))};
+			return std::array<unsigned char,1>{static_cast<unsigned char>(std::round((double(color[0])+color[1]+color[2])/3.0f))};
 		});
 	}
 
@@ -18,8 +18,13 @@ along with this program. If not, see <https://www.gnu.org/licenses/>.
 #define IMAGE_MATH_H
 #include "CImg.h"
 #include "ImageUtils.h"
+#include "lib/exstring/exmath.h"
 #include <assert.h>
 #include <type_traits>
+#include <array>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #define M_PI	3.14159265358979323846
 #define M_PI_2	1.57079632679489661923
 #define M_PI_4	0.78539816339744830962
@@ -79,11 +84,11 @@ namespace cimg_library {
 		return img;
 	}
 
-	template<unsigned int InputLayers,unsigned int OutputLayers=-1,typename T,typename ArrayToArray>
+	template<unsigned int InputLayers,unsigned int OutputLayers=static_cast<unsigned int>(-1),typename T,typename ArrayToArray>
 	auto get_map(CImg<T> const& img,ArrayToArray func)
 	{
 		std::array<T,InputLayers> input;
-		typedef std::remove_reference<decltype(func(input)[0])>::type R;
+		typedef typename std::remove_reference<decltype(func(input)[0])>::type R;
 		using func_output = decltype(func(input));
 		unsigned int output_layers = OutputLayers;
 		if constexpr (OutputLayers == -1)
@@ -112,7 +117,7 @@ namespace cimg_library {
 		return ret;
 	}
 
-	template<unsigned int InputLayers,unsigned int OutputLayers=-1,typename T,typename ArrayToArray>
+	template<unsigned int InputLayers,unsigned int OutputLayers=static_cast<unsigned int>(-1),typename T,typename ArrayToArray>
 	auto get_map(CImg<T> const& img,ArrayToArray func,ImageUtils::Rectangle<unsigned int> const selection)
 	{
 		std::array<T,InputLayers> input;
@@ -125,14 +130,14 @@ namespace cimg_library {
 		{
 			output_layers = std::tuple_size_v<std::remove_reference_t<func_output>>;
 		}
-		CImg<std::remove_reference<decltype(func(input)[0])>::type> ret(owidth,oheight,1,output_layers);
+		CImg<typename std::remove_reference<decltype(func(input)[0])>::type> ret(owidth,oheight,1,output_layers);
 		auto const isize=size_t(img._width)*img._height;
 		auto const idata=img._data;
-		for(auto y=0U;x<oheight;++x)
+		for(auto y=0U;y<oheight;++y)
 		{
 			auto irow=idata+(y+selection.top)*img._width;
 			auto orow=ret._data+y*owidth;
-			for(auto x=0U;y<owidth;++y)
+			for(auto x=0U;x<owidth;++x)
 			{
 				auto ipix=irow+x+selection.left;
 				auto opix=orow+x;
@@ -293,7 +298,7 @@ namespace cimg_library {
 		return acc;
 	}
 
-	template<unsigned int Numlayers,typename T,typename ArrayRToR,typename R>
+	template<unsigned int NumLayers,typename T,typename ArrayRToR,typename R>
 	R fold(CImg<T>const& img,ArrayRToR func,R acc,ImageUtils::Rectangle<unsigned int> const selection)
 	{
 		unsigned int const width=img._width;
@@ -352,7 +357,7 @@ namespace cimg_library {
 		std::array<T,NumLayers> color;
 		for(unsigned int y=selection.top;y<selection.bottom;++y)
 		{
-			auto const row=y*width+data;
+			auto const row=y*img._width+data;
 			for(unsigned int x=selection.left;x<selection.right;++x)
 			{
 				auto const pix=row+x;
@@ -457,6 +462,48 @@ namespace cimg_library {
 		}
 	}
 
+	/*
+		Replaces every value in [begin,end) with its entry in lut.
+		Returns whether any value changed.
+	*/
+	inline bool apply_lut(unsigned char* begin,unsigned char* end,std::array<unsigned char,256> const& lut)
+	{
+		unsigned char changed=0;
+		//the Release configurations build with /arch:AVX2; other builds only run the loop at the end
+#ifdef __AVX2__
+		//a 256 entry lookup is 16 shuffles of 16 entry tables, each kept where the high nibble selects it
+		__m256i tables[16];
+		for(unsigned int k=0;k<16;++k)
+		{
+			tables[k]=_mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const*>(lut.data()+16*k)));
+		}
+		auto const nibble=_mm256_set1_epi8(0x0F);
+		auto any_change=_mm256_setzero_si256();
+		for(;end-begin>=32;begin+=32)
+		{
+			auto const in=_mm256_loadu_si256(reinterpret_cast<__m256i const*>(begin));
+			auto const low=_mm256_and_si256(in,nibble);
+			auto const high=_mm256_and_si256(_mm256_srli_epi16(in,4),nibble);
+			auto out=_mm256_setzero_si256();
+			for(unsigned int k=0;k<16;++k)
+			{
+				auto const select=_mm256_cmpeq_epi8(high,_mm256_set1_epi8(char(k)));
+				out=_mm256_or_si256(out,_mm256_and_si256(select,_mm256_shuffle_epi8(tables[k],low)));
+			}
+			any_change=_mm256_or_si256(any_change,_mm256_xor_si256(in,out));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(begin),out);
+		}
+		changed=!_mm256_testz_si256(any_change,any_change);
+#endif
+		for(auto it=begin;it!=end;++it)
+		{
+			auto const mapped=lut[*it];
+			changed|=mapped^*it;
+			*it=mapped;
+		}
+		return changed!=0;
+	}
+
 	inline ::cil::CImg<unsigned char> get_gamma(::cil::CImg<unsigned char> const& img,float gamma)
 	{
 		assert(gamma>=0);
@@ -526,14 +573,14 @@ namespace cimg_library {
 		double lower_angle,double upper_angle,
 		unsigned int num_steps,
 		double precision):
-		CImg(num_steps+1,(rmax=hypot(width,height))*2/precision),
+		CImg<CountType>(num_steps+1,(rmax=hypot(width,height))*2/precision),
 		theta_min(lower_angle),
 		angle_dif(upper_angle-lower_angle),
 		angle_steps(num_steps),
 		precision(precision)
 	{
 		CImg<CountType>::fill(0);
-		double step=(_height-1)/precision;
+		double step=(this->_height-1)/precision;
 		for(uint y=0;y<height;++y)
 		{
 			for(uint x=0;x<width;++x)
@@ -545,9 +592,9 @@ namespace cimg_library {
 						double theta=angle_dif*f/angle_steps+theta_min;
 						double r=x*std::cos(theta)+y*std::sin(theta);
 						unsigned int y=((r+rmax)/(2*rmax))*step;
-						auto const inc=this->data()+y*_width+f;
+						auto const inc=this->data()+y*this->_width+f;
 						++(*inc);
-						++(*(inc+_width));
+						++(*(inc+this->_width));
 					}
 				}
 			}
@@ -562,15 +609,15 @@ namespace cimg_library {
 		double precision,
 		signed char threshold)
 		:
-		CImg(num_steps+1,(rmax=hypot(gradient._width,gradient._height))*2/precision),
+		CImg<CountType>(num_steps+1,(rmax=hypot(gradient._width,gradient._height))*2/precision),
 		theta_min(lower_angle),
 		angle_dif(upper_angle-lower_angle),
 		angle_steps(num_steps),
 		precision(precision)
 	{
 		threshold=std::abs(threshold);
-		fill(0);
-		double step=(_height-1)/precision;
+		this->fill(0);
+		double step=(this->_height-1)/precision;
 		signed char const* const data=gradient.data();
 		for(uint y=0;y<gradient._height;++y)
 		{
@@ -584,9 +631,9 @@ namespace cimg_library {
 						double theta=angle_dif*f/angle_steps+theta_min;
 						double r=x*std::cos(theta)+y*std::sin(theta);
 						unsigned int y=((r+rmax)/(2*rmax))*step;
-						unsigned int* const inc=this->data()+y*_width+f;
+						unsigned int* const inc=this->data()+y*this->_width+f;
 						++(*inc);
-						++(*(inc+_width));
+						++(*(inc+this->_width));
 					}
 				}
 			}
@@ -596,7 +643,7 @@ namespace cimg_library {
 	unsigned int& HoughArray<CountType>::operator()(double theta,double r)
 	{
 		unsigned int x=(theta-theta_min)/angle_dif*angle_steps;
-		unsigned int y=((r+rmax)/(2*rmax))/precision*(_height-1);
+		unsigned int y=((r+rmax)/(2*rmax))/precision*(this->_height-1);
 		//printf("%u\t%u\n",x,y);
 		return CImg<unsigned int>::operator()(x,y);
 	}
@@ -604,30 +651,30 @@ namespace cimg_library {
 	template<typename CountType>
 	double HoughArray<CountType>::angle() const
 	{
-		if(empty())
+		if(this->empty())
 		{
 			return 0;
 		}
-		auto max_it=begin();
-		for(auto it=max_it+1;it!=end();++it)
+		auto max_it=this->begin();
+		for(auto it=max_it+1;it!=this->end();++it)
 		{
 			if(*it>* max_it)
 			{
 				max_it=it;
 			}
 		}
-		return (max_it-begin())%_width*angle_dif/angle_steps+theta_min;
+		return (max_it-this->begin())%this->_width*angle_dif/angle_steps+theta_min;
 	}
 
 	template<typename CountType>
 	std::vector<ImageUtils::line_norm<double>> HoughArray<CountType>::top_lines(size_t n) const
 	{
-		exlib::LimitedSet<decltype(begin())> top;
+		exlib::LimitedSet<decltype(this->begin())> top;
 		auto comp=[](auto a,auto b)
 		{
 			return *a>* b;
 		};
-		for(auto it=begin();it!=end();++it)
+		for(auto it=this->begin();it!=this->end();++it)
 		{
 			top.insert(it,comp);
 		}
@@ -636,11 +683,11 @@ namespace cimg_library {
 		auto il=lines.begin();
 		for(auto it:top)
 		{
-			auto d=std::distance(begin(),it);
-			auto x=d%_width;
-			auto y=d/_width;
+			auto d=std::distance(this->begin(),it);
+			auto x=d%this->_width;
+			auto y=d/this->_width;
 			(*il).theta=x*step+theta_min;
-			(*il).r=2*rmax*y*precision/(_height-1)-rmax;
+			(*il).r=2*rmax*y*precision/(this->_height-1)-rmax;
 		}
 		return lines;
 	}
@@ -704,12 +751,12 @@ namespace cimg_library {
 			};
 			auto input_tuple=[size,transform](auto* input_point)
 			{
-				transform(*(input_data+size*InLayers)...);
+				return transform(std::array<U,sizeof...(InLayers)>{{*(input_point+size*InLayers)...}});
 			};
 			output_tuple(output_data)=input_tuple(input_data);
 			for(std::size_t x=1;x<width;++x)
 			{
-				output_tuple(output_data+x)=array_sum(input_tuple(input_data+x),output_tuple(output_data[x-1]));
+				output_tuple(output_data+x)=array_sum(input_tuple(input_data+x),output_tuple(output_data+x-1));
 			}
 			for(std::size_t y=1;y<height;++y)
 			{
@@ -0,0 +1,391 @@
+/*
+Copyright(C) 2017-2018 Edward Xie
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "stdafx.h"
+#include "ImageProbe.h"
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <unordered_set>
+namespace ScoreProcessor {
+	namespace {
+		using byte=unsigned char;
+
+		std::uint32_t read_be(byte const* data,unsigned int bytes)
+		{
+			std::uint32_t value=0;
+			for(unsigned int i=0;i<bytes;++i)
+			{
+				value=(value<<8)|data[i];
+			}
+			return value;
+		}
+
+		std::uint32_t read_le(byte const* data,unsigned int bytes)
+		{
+			std::uint32_t value=0;
+			for(unsigned int i=bytes;i>0;)
+			{
+				--i;
+				value=(value<<8)|data[i];
+			}
+			return value;
+		}
+
+		bool read(std::istream& in,byte* data,std::streamsize n)
+		{
+			return static_cast<bool>(in.read(reinterpret_cast<char*>(data),n));
+		}
+
+		std::optional<image_info> probe_png(std::istream& in)
+		{
+			//the signature has already been checked, IHDR must come first
+			byte ihdr[8+13];
+			if(!read(in,ihdr,sizeof(ihdr))||std::memcmp(ihdr+4,"IHDR",4))
+			{
+				return {};
+			}
+			image_info info;
+			info.format=support_type::png;
+			info.width=read_be(ihdr+8,4);
+			info.height=read_be(ihdr+12,4);
+			info.bit_depth=ihdr[16];
+			byte const color_type=ihdr[17];
+			switch(color_type)
+			{
+				case 0:
+					info.spectrum=1;
+					break;
+				case 2:
+				case 3:
+					info.spectrum=3;
+					break;
+				case 4:
+					info.spectrum=2;
+					break;
+				case 6:
+					info.spectrum=4;
+					break;
+				default:
+					return {};
+			}
+			if(color_type==4||color_type==6)
+			{
+				return info;
+			}
+			//a transparency chunk becomes an alpha channel, and must appear before the image data
+			in.seekg(4,std::ios::cur);
+			byte chunk[8];
+			while(read(in,chunk,sizeof(chunk)))
+			{
+				if(!std::memcmp(chunk+4,"tRNS",4))
+				{
+					++info.spectrum;
+					break;
+				}
+				if(!std::memcmp(chunk+4,"IDAT",4))
+				{
+					break;
+				}
+				in.seekg(std::streamoff(read_be(chunk,4))+4,std::ios::cur);
+			}
+			return info;
+		}
+
+		std::optional<image_info> probe_jpeg(std::istream& in)
+		{
+			//the start of image marker has already been read
+			for(;;)
+			{
+				byte c;
+				do
+				{
+					if(!read(in,&c,1))
+					{
+						return {};
+					}
+				} while(c!=0xFF);
+				do
+				{
+					if(!read(in,&c,1))
+					{
+						return {};
+					}
+				} while(c==0xFF);
+				byte const marker=c;
+				if(marker==0x01||(marker>=0xD0&&marker<=0xD8))
+				{
+					continue;
+				}
+				//start of scan or end of image before any frame header
+				if(marker==0xDA||marker==0xD9)
+				{
+					return {};
+				}
+				byte length[2];
+				if(!read(in,length,2))
+				{
+					return {};
+				}
+				bool const is_frame=marker>=0xC0&&marker<=0xCF&&marker!=0xC4&&marker!=0xC8&&marker!=0xCC;
+				if(is_frame)
+				{
+					byte frame[6];
+					if(!read(in,frame,sizeof(frame)))
+					{
+						return {};
+					}
+					image_info info;
+					info.format=support_type::jpeg;
+					info.bit_depth=frame[0];
+					info.height=read_be(frame+1,2);
+					info.width=read_be(frame+3,2);
+					info.spectrum=frame[5];
+					return info;
+				}
+				in.seekg(std::streamoff(read_be(length,2))-2,std::ios::cur);
+			}
+		}
+
+		std::optional<image_info> probe_bmp(std::istream& in)
+		{
+			//read the same fields as CImg, which always loads bmps as rgb
+			//offsets 2 through 0x1D, after the signature
+			byte header[28];
+			if(!read(in,header,sizeof(header)))
+			{
+				return {};
+			}
+			auto const field=[&](unsigned int offset,unsigned int bytes)
+			{
+				return read_le(header+offset-2,bytes);
+			};
+			image_info info;
+			info.format=support_type::bmp;
+			info.width=field(0x12,4);
+			auto const height=static_cast<std::int32_t>(field(0x16,4));
+			info.height=height<0?0U-static_cast<unsigned int>(height):static_cast<unsigned int>(height);
+			info.spectrum=3;
+			info.bit_depth=field(0x1C,2);
+			return info;
+		}
+
+		//how the directories of a tiff are laid out, either classic or BigTIFF
+		struct tiff_layout {
+			bool big_endian;
+			unsigned int offset_size; //4 or 8, also the size of the value field of an entry
+			std::uint64_t first_directory;
+			std::uint64_t value(byte const* data,unsigned int bytes) const
+			{
+				std::uint64_t value=0;
+				for(unsigned int i=0;i<bytes;++i)
+				{
+					value=(value<<8)|data[big_endian?i:bytes-1-i];
+				}
+				return value;
+			}
+			unsigned int count_size() const
+			{
+				return offset_size==8?8:2;
+			}
+			unsigned int entry_size() const
+			{
+				return 4+2*offset_size;
+			}
+		};
+
+		//reads the header after the byte order mark
+		std::optional<tiff_layout> read_tiff_header(std::istream& in,bool big_endian)
+		{
+			tiff_layout layout;
+			layout.big_endian=big_endian;
+			byte header[14];
+			if(!read(in,header,6))
+			{
+				return {};
+			}
+			switch(layout.value(header,2))
+			{
+				case 42:
+					layout.offset_size=4;
+					layout.first_directory=layout.value(header+2,4);
+					return layout;
+				case 43:
+					if(layout.value(header+2,2)!=8||!read(in,header+6,8))
+					{
+						return {};
+					}
+					layout.offset_size=8;
+					layout.first_directory=layout.value(header+6,8);
+					return layout;
+				default:
+					return {};
+			}
+		}
+
+		std::optional<image_info> probe_tiff(std::istream& in,bool big_endian)
+		{
+			auto const layout=read_tiff_header(in,big_endian);
+			if(!layout)
+			{
+				return {};
+			}
+			in.seekg(layout->first_directory);
+			byte count[8];
+			if(!read(in,count,layout->count_size()))
+			{
+				return {};
+			}
+			image_info info;
+			info.format=support_type::tiff;
+			info.width=0;
+			info.height=0;
+			info.bit_depth=1;
+			unsigned int samples_per_pixel=0;
+			unsigned int photometric=0;
+			std::streamoff bits_offset=-1;
+			auto const field=4+layout->offset_size;
+			for(auto i=layout->value(count,layout->count_size());i>0;--i)
+			{
+				byte entry[20];
+				if(!read(in,entry,layout->entry_size()))
+				{
+					return {};
+				}
+				auto const tag=layout->value(entry,2);
+				auto const type=layout->value(entry+2,2);
+				//short values are left justified in the value field
+				auto const number=static_cast<unsigned int>(type==3?layout->value(entry+field,2):layout->value(entry+field,4));
+				switch(tag)
+				{
+					case 256:
+						info.width=number;
+						break;
+					case 257:
+						info.height=number;
+						break;
+					case 258:
+						//with more samples than fit, the field holds the offset of the list instead
+						if(layout->value(entry+4,layout->offset_size)*2>layout->offset_size)
+						{
+							bits_offset=layout->value(entry+field,layout->offset_size);
+						}
+						else
+						{
+							info.bit_depth=number;
+						}
+						break;
+					case 262:
+						photometric=number;
+						break;
+					case 277:
+						samples_per_pixel=number;
+						break;
+				}
+			}
+			if(info.width==0||info.height==0)
+			{
+				return {};
+			}
+			if(bits_offset>=0)
+			{
+				byte bits[2];
+				in.seekg(bits_offset);
+				if(read(in,bits,2))
+				{
+					info.bit_depth=static_cast<unsigned int>(layout->value(bits,2));
+				}
+			}
+			//same rule as CImg uses to pick the number of channels
+			info.spectrum=samples_per_pixel==0||photometric>=3?(photometric>1?3:1):samples_per_pixel;
+			return info;
+		}
+	}
+
+	unsigned int count_pages(char const* path)
+	{
+		std::ifstream in(path,std::ios::binary);
+		byte mark[2];
+		if(!read(in,mark,2))
+		{
+			return 1;
+		}
+		bool const big_endian=mark[0]=='M'&&mark[1]=='M';
+		if(!big_endian&&!(mark[0]=='I'&&mark[1]=='I'))
+		{
+			return 1;
+		}
+		auto const layout=read_tiff_header(in,big_endian);
+		if(!layout)
+		{
+			return 1;
+		}
+		unsigned int pages=0;
+		auto offset=layout->first_directory;
+		//a broken file can link its directories in a loop
+		std::unordered_set<std::uint64_t> seen;
+		while(offset!=0&&seen.insert(offset).second)
+		{
+			in.seekg(offset);
+			byte count[8];
+			if(!read(in,count,layout->count_size()))
+			{
+				break;
+			}
+			++pages;
+			in.seekg(std::streamoff(layout->value(count,layout->count_size()))*layout->entry_size(),std::ios::cur);
+			byte next[8];
+			if(!read(in,next,layout->offset_size))
+			{
+				break;
+			}
+			offset=layout->value(next,layout->offset_size);
+		}
+		return pages?pages:1;
+	}
+
+	std::optional<image_info> probe_image(char const* path)
+	{
+		std::ifstream in(path,std::ios::binary);
+		if(!in)
+		{
+			return {};
+		}
+		byte magic[8];
+		if(!read(in,magic,2))
+		{
+			return {};
+		}
+		if(magic[0]==0xFF&&magic[1]==0xD8)
+		{
+			return probe_jpeg(in);
+		}
+		if(magic[0]=='B'&&magic[1]=='M')
+		{
+			return probe_bmp(in);
+		}
+		if((magic[0]=='I'&&magic[1]=='I')||(magic[0]=='M'&&magic[1]=='M'))
+		{
+			return probe_tiff(in,magic[0]=='M');
+		}
+		static byte const png_signature[]={0x89,'P','N','G','\r','\n',0x1A,'\n'};
+		if(read(in,magic+2,6)&&!std::memcmp(magic,png_signature,8))
+		{
+			return probe_png(in);
+		}
+		return {};
+	}
+}
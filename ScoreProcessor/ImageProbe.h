@@ -0,0 +1,48 @@
+/*
+Copyright(C) 2017-2018 Edward Xie
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef IMAGE_PROBE_H
+#define IMAGE_PROBE_H
+#include "support.h"
+#include <optional>
+namespace ScoreProcessor {
+	/*
+		What an image file will decode to, as far as its header tells.
+		spectrum is the number of channels CImg produces when loading the file,
+		so palette images count as color and alpha counts as a channel.
+	*/
+	struct image_info {
+		support_type format;
+		unsigned int width;
+		unsigned int height;
+		unsigned int spectrum;
+		unsigned int bit_depth;
+	};
+
+	/*
+		Reads the dimensions of a png, jpeg, bmp or tiff file from its header, without decoding any pixels.
+		The format is found from the contents rather than the extension.
+		Returns nothing if the file cannot be opened or its header is not understood.
+	*/
+	std::optional<image_info> probe_image(char const* path);
+
+	/*
+		Counts the pages of a tiff file by walking its directories, without decoding any of them.
+		Returns 1 for anything that is not a tiff, or whose directories cannot be read.
+	*/
+	unsigned int count_pages(char const* path);
+}
+#endif
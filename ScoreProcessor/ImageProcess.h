@@ -21,18 +21,33 @@ along with this program. If not, see <https://www.gnu.org/licenses/>.
 #include <memory>
 #include <utility>
 #include <string>
-#include "lib\threadpool\thread_pool.h"
-#include "lib\exstring\exstring.h"
+#include "lib/threadpool/thread_pool.h"
+#include "lib/exstring/exstring.h"
 #include <stdexcept>
 #include <regex>
 #include <functional>
-#include "lib\exstring\exmath.h"
-#include "lib\exstring\exfiles.h"
+#include "lib/exstring/exmath.h"
+#include "lib/exstring/exfiles.h"
 #include <fstream>
 #include <filesystem>
 #include <string_view>
 #include "support.h"
+#include "ImageMath.h"
+#include "PageAnalysis.h"
+#include "MappedFile.h"
+#include <array>
+#include <optional>
+#include <cstdint>
 namespace ScoreProcessor {
+	/*
+		The size and interpolation of a resize.
+	*/
+	struct resize_request {
+		unsigned int width;
+		unsigned int height;
+		int interpolation;
+	};
+
 	template<typename T=unsigned char>
 	/*
 		Represents processes done to an image.
@@ -44,7 +59,129 @@ namespace ScoreProcessor {
 		{};
 		//returns true if the image has been modified
 		virtual bool process(Img&) const=0;
+		/*
+			If the process only resizes the image, fills request with what it would do to an image of width by height and returns true.
+			Lets the loader decode a smaller image when the process is first and the format allows it.
+		*/
+		virtual bool requested_resize(unsigned int width,unsigned int height,resize_request& request) const
+		{
+			return false;
+		}
+		/*
+			Returns true if the process reduces a color image to a single channel.
+			Lets the loader decode color files straight to grayscale when the process is first.
+		*/
+		virtual bool discards_color() const
+		{
+			return false;
+		}
 	};
+	/*
+		A process that remaps each channel value without looking at any other pixel.
+		Runs of these in a ProcessList are composed into lookup tables.
+	*/
+	class ToneMapProcess:public ImageProcess<unsigned char> {
+	public:
+		using lut=std::array<unsigned char,256>;
+		//one table per channel
+		using lut_set=std::array<lut,4>;
+		/*
+			Applies this process on top of luts, as it would be applied to an image with the given spectrum.
+			Returns false if the process is not a per channel mapping for that spectrum.
+		*/
+		virtual bool compose(lut_set& luts,unsigned int spectrum) const=0;
+	protected:
+		//the table viewed as a 256x1 image so that the image functions can map it directly
+		static Img lut_image(lut& table)
+		{
+			return Img(table.data(),table.size(),1,1,1,true);
+		}
+	};
+
+	/*
+		Consecutive tone maps composed into one table per channel, so the page is only walked once.
+	*/
+	class ToneMapChain:public ImageProcess<unsigned char> {
+		std::vector<std::unique_ptr<ToneMapProcess>> _maps;
+		struct compiled {
+			ToneMapProcess::lut_set luts;
+			std::array<bool,4> used;
+		};
+		//composed tables for spectrum 1 to 4, empty where some map cannot be expressed as a table
+		std::array<std::optional<compiled>,4> _compiled;
+		void compile()
+		{
+			for(unsigned int spectrum=1;spectrum<=_compiled.size();++spectrum)
+			{
+				auto& slot=_compiled[spectrum-1];
+				slot.emplace();
+				for(auto& table:slot->luts)
+				{
+					for(unsigned int i=0;i<table.size();++i)
+					{
+						table[i]=i;
+					}
+				}
+				for(auto const& map:_maps)
+				{
+					if(!map->compose(slot->luts,spectrum))
+					{
+						slot.reset();
+						break;
+					}
+				}
+				if(slot)
+				{
+					for(unsigned int c=0;c<slot->used.size();++c)
+					{
+						auto const& table=slot->luts[c];
+						bool identity=true;
+						for(unsigned int i=0;i<table.size();++i)
+						{
+							identity&=table[i]==i;
+						}
+						slot->used[c]=c<spectrum&&!identity;
+					}
+				}
+			}
+		}
+	public:
+		ToneMapChain(std::unique_ptr<ToneMapProcess> first)
+		{
+			_maps.push_back(std::move(first));
+			compile();
+		}
+		void push_back(std::unique_ptr<ToneMapProcess> next)
+		{
+			_maps.push_back(std::move(next));
+			compile();
+		}
+		bool process(Img& img) const override
+		{
+			if(img._spectrum>0&&img._spectrum<=_compiled.size()&&_compiled[img._spectrum-1])
+			{
+				auto const& tables=*_compiled[img._spectrum-1];
+				auto const size=std::size_t(img._width)*img._height*img._depth;
+				bool changed=false;
+				for(unsigned int c=0;c<img._spectrum;++c)
+				{
+					if(tables.used[c])
+					{
+						auto const channel=img._data+c*size;
+						changed|=cil::apply_lut(channel,channel+size,tables.luts[c]);
+					}
+				}
+				return changed;
+			}
+			bool changed=false;
+			for(auto const& map:_maps)
+			{
+				changed|=map->process(img);
+			}
+			return changed;
+		}
+	};
+
 	/*
 		Logs to some output.
 	*/
@@ -71,32 +208,19 @@ namespace ScoreProcessor {
 		enum template_symbol {
 			string=-1,i=0,padding_min=0,padding_max=9,x=10,f,p,c,w
 		};
-		struct part {
-			char* data;
-			union {
-				size_t size;
-				unsigned int tmplt;
-			} info;
-			part(part&& o):data(o.data),info(o.info)
-			{
-				o.data=0;
-			}
-			part(unsigned int tmplt):data(0)
-			{
-				info.tmplt=tmplt;
-			}
-			part(exlib::string& str):
-				data(str.data())
-			{
-				info.size=str.size();
-				str.release();
-			}
-			~part()
-			{
-				delete[] data;
-			}
+		/*
+			The template is compiled into a list of instructions, each copying a slice of literals
+			or a piece of the input, or writing the index with symbol digits of padding.
+		*/
+		struct instruction {
+			int symbol;
+			std::uint32_t offset;
+			std::uint32_t size;
 		};
-		std::vector<part> parts;
+		std::vector<instruction> program;
+		std::string literals;
+		size_t fixed_size=0; //most characters written apart from pieces of the input
+		unsigned int input_uses=0; //how many instructions copy a piece of the input
 	public:
 		/*
 			Makes a string out of the input, based on the current template.
@@ -105,6 +229,19 @@ namespace ScoreProcessor {
 		std::string make_filename(String const& input,unsigned int index=1) const;
 
 		std::string make_filename(char const* input,unsigned int index=1) const;
+
+		/*
+			Writes the filename for the input into out, replacing what was there.
+			Only allocates if out does not already have size_estimate of the input in capacity.
+		*/
+		template<typename String>
+		void make_filename(std::string& out,String const& input,unsigned int index=1) const;
+
+		/*
+			An upper bound on the length of any filename made from an input of the given length.
+		*/
+		size_t size_estimate(size_t input_size) const;
+
 		/*
 			%f to match filename
 			%x to match extension
@@ -157,43 +294,11 @@ namespace ScoreProcessor {
 			loud
 		};
 	private:
-
-		class ProcessTaskImg:public exlib::ThreadTask {
-		private:
-			cimg_library::CImg<T>* pimg;
-			ProcessList<T> const* pparent;
-			SaveRules const* output;
-			unsigned int index;
-		public:
-			ProcessTaskImg(cimg_library::CImg<T>* pimg,ProcessList<T> const* pparent,SaveRules const* output,unsigned int index):
-				pimg(pimg),pparent(pparent),output(output),index(index)
-			{}
-			void execute() override
-			{
-				pparent->process(*pimg,output,index);
-			}
-		};
-		class ProcessTaskFName:public exlib::ThreadTask {
-		private:
-			char const* fname;
-			ProcessList<T> const* pparent;
-			SaveRules const* output;
-			unsigned int index;
-			bool move;
-			int quality;
-		public:
-			ProcessTaskFName(char const* fname,ProcessList<T> const* pparent,SaveRules const* output,unsigned int index,bool move,int quality):
-				fname(fname),pparent(pparent),output(output),index(index),move(move),quality(quality)
-			{}
-			void execute() override
-			{
-				pparent->process(fname,output,index,move,quality);
-			}
-		};
 		Log* plog;
 		verbosity vb;
+		bool mapped_input;
 	public:
-		ProcessList(Log* log,verbosity vb):plog(log),vb(vb)
+		ProcessList(Log* log,verbosity vb):plog(log),vb(vb),mapped_input(false)
 		{}
 		ProcessList(Log* log):ProcessList(log,1)
 		{}
@@ -220,17 +325,47 @@ namespace ScoreProcessor {
 			this->vb=vb;
 		}
 
+		bool get_mapped_input() const
+		{
+			return mapped_input;
+		}
+
+		/*
+			Whether jpegs and pngs are decoded from a memory mapping of the input file instead of buffered reads.
+		*/
+		void set_mapped_input(bool mapped_input)
+		{
+			this->mapped_input=mapped_input;
+		}
+
 		/*
 			Adds a process to the list.
 		*/
 		template<typename U,typename... Args>
 		auto add_process(Args&&... args) -> decltype(U(std::forward<Args>(args)...),void())
 		{
-			emplace_back(std::make_unique<U>(std::forward<Args>(args)...));
+			if constexpr(std::is_same<T,unsigned char>::value&&std::is_base_of<ToneMapProcess,U>::value)
+			{
+				//tone maps are merged into the chain before them instead of each walking the page
+				auto map=std::make_unique<U>(std::forward<Args>(args)...);
+				if(!this->empty())
+				{
+					if(auto const chain=dynamic_cast<ToneMapChain*>(this->back().get()))
+					{
+						chain->push_back(std::move(map));
+						return;
+					}
+				}
+				this->emplace_back(std::make_unique<ToneMapChain>(std::move(map)));
+			}
+			else
+			{
+				this->emplace_back(std::make_unique<U>(std::forward<Args>(args)...));
+			}
 		}
 
 		void process_unsafe(cimg_library::CImg<T>& img,char const* output) const;
-		void process_unsafe(char const* input,char const* output,bool move,int quality,bool recurse) const;
+		void process_unsafe(char const* input,char const* output,bool move,int quality,bool recurse,int page=-1) const;
 		/*
 			Processes an image.
 		*/
@@ -256,8 +391,13 @@ namespace ScoreProcessor {
 		/*
 			Processes an image at the given filename, and saves it based on the SaveRules.
 			Pass nullptr to SaveRules if you do not want it saved (useless, but ok).
+			page picks one page of a multi-page tiff, which is never copied or moved as a whole; -1 processes the file as usual.
+		*/
+		void process(char const* filename,SaveRules const* psr,unsigned int index,bool move,int quality,bool recurse,int page=-1) const;
+		/*
+			Processes an image at the given filename and saves it to the output, logging under the given index.
 		*/
-		void process(char const* filename,SaveRules const* psr,unsigned int index,bool move,int quality,bool recurse) const;
+		void process(char const* filename,char const* output,unsigned int index,bool move,int quality,bool recurse,int page) const;
 
 		/*
 			Processes all the images in the vector.
@@ -271,6 +411,7 @@ namespace ScoreProcessor {
 
 		/*
 			Processes all the images in the vector.
+			If pages is given, it holds the page of a multi-page tiff each filename stands for, or -1 for a whole file.
 			Might add iterator version one day.
 		*/
 		template<typename String>
@@ -280,7 +421,22 @@ namespace ScoreProcessor {
 			unsigned int const starting_index,
 			bool move,
 			int quality,
-			bool recurse) const;
+			bool recurse,
+			std::vector<int> const* pages=nullptr) const;
+
+		/*
+			Processes all the images in the vector, saving each to the output of the same position.
+			If pages is given, it holds the page of a multi-page tiff each filename stands for, or -1 for a whole file.
+		*/
+		template<typename String>
+		void process(std::vector<String> const& filenames,
+			std::vector<std::string> const& outputs,
+			unsigned int const num_threads,
+			unsigned int const starting_index,
+			bool move,
+			int quality,
+			bool recurse,
+			std::vector<int> const* pages=nullptr) const;
 
 		/*
 			Processes all the images in the vector.
@@ -303,9 +459,13 @@ namespace ScoreProcessor {
 	template<typename T>
 	void ProcessList<T>::process_unsafe(cimg_library::CImg<T>& img,char const* output) const
 	{
+		page_analysis::scope analysis;
 		for(auto& pprocess:*this)
 		{
-			pprocess->process(img);
+			if(pprocess->process(img))
+			{
+				analysis.invalidate();
+			}
 		}
 		if(output!=nullptr)
 		{
@@ -359,7 +519,7 @@ namespace ScoreProcessor {
 	}
 
 	template<typename T>
-	void ProcessList<T>::process_unsafe(char const* fname,char const* output,bool do_move,int quality,bool recurse) const
+	void ProcessList<T>::process_unsafe(char const* fname,char const* output,bool do_move,int quality,bool recurse,int page) const
 	{
 		using namespace std::filesystem;
 		path in(fname),out(output);
@@ -417,25 +577,57 @@ namespace ScoreProcessor {
 				}
 			}
 		};
-		auto load_s=[fname](cil::CImg<T>&img,auto s)
+		//if gray_from_color is not null, color pngs and tiffs are decoded straight to grayscale, and it is set to whether that happened
+		//maps the input for the jpeg and png decoders if asked to, empty otherwise or if it fails
+		auto map_input=[this,fname](support_type format)
+		{
+			if(mapped_input&&(format==support_type::jpeg||format==support_type::png))
+			{
+				return mapped_file(fname);
+			}
+			return mapped_file();
+		};
+		auto load_s=[fname,map_input,page](cil::CImg<T>&img,auto s,bool* gray_from_color=nullptr)
 		{
+			if(gray_from_color)
+			{
+				*gray_from_color=false;
+			}
 #if OPTION_RESTRICTED
 			try
 			{
 #endif
+				auto const input=map_input(s.first);
 				switch (s.first)
 				{
 				case support_type::bmp:
 					img.load_bmp(fname);
 					break;
 				case support_type::jpeg:
-					img.load_jpeg(fname);
+					if(input)
+					{
+						img.load_jpeg(input.data(), input.size());
+					}
+					else
+					{
+						img.load_jpeg(fname);
+					}
 					break;
 				case support_type::png:
-					img.load_png(fname);
+					if(input)
+					{
+						img.load_png(input.data(), input.size(), nullptr, gray_from_color);
+					}
+					else
+					{
+						img.load_png(fname, nullptr, gray_from_color);
+					}
 					break;
 				case support_type::tiff:
-					img.load_tiff(fname, 0, 0);
+				{
+					unsigned int const frame=page<0?0:page;
+					img.load_tiff(fname, frame, frame, 1, nullptr, nullptr, gray_from_color);
+				}
 				}
 #if OPTION_RESTRICTED
 			}
@@ -483,6 +675,60 @@ namespace ScoreProcessor {
 			}
 #endif
 		};
+		//decodes a jpeg at up to 1/8 size when the first process shrinks it anyway, and finishes that resize
+		//returns false, with the image loaded at full size, if the first process was not done
+		//gray_from_color works as for load_s
+		auto load_jpeg_reduced=[fname,map_input,load_s](cil::CImg<T>& img,auto s,ImageProcess<T> const& first,bool* gray_from_color)
+		{
+			resize_request request;
+			unsigned int denom=1;
+			auto const scale_denom=[&](unsigned int width,unsigned int height)
+			{
+				if(first.requested_resize(width,height,request))
+				{
+					for(unsigned int d=8;d>1;d/=2)
+					{
+						if((width+d-1)/d>=request.width&&(height+d-1)/d>=request.height)
+						{
+							denom=d;
+							break;
+						}
+					}
+				}
+				return denom;
+			};
+#if OPTION_RESTRICTED
+			try
+			{
+#endif
+				auto const input=map_input(support_type::jpeg);
+				if(input)
+				{
+					img.load_jpeg(input.data(),input.size(),scale_denom,gray_from_color);
+				}
+				else
+				{
+					img.load_jpeg(fname,scale_denom,gray_from_color);
+				}
+#if OPTION_RESTRICTED
+			}
+			catch(std::exception const&)
+			{
+				//the file may not be a jpeg after all, so it gets the full size fallbacks of load_s
+				load_s(img,s,gray_from_color);
+				return false;
+			}
+#endif
+			if(denom==1)
+			{
+				return false;
+			}
+			if(img._width!=request.width||img._height!=request.height)
+			{
+				img.resize(request.width,request.height,img._depth,img._spectrum,request.interpolation);
+			}
+			return true;
+		};
 		auto save_s=[output,quality](cil::CImg<T>&img,auto s)
 		{
 			cil::save_image(img,output,s.second,quality);
@@ -491,7 +737,7 @@ namespace ScoreProcessor {
 		{
 			try
 			{
-				std::filesystem::create_directories(out.parent_path());
+				exlib::create_parent_directories(out);
 			}
 			catch (std::exception const& err)
 			{
@@ -500,7 +746,15 @@ namespace ScoreProcessor {
 		}
 		if(this->empty())
 		{
-			if(!exlib::strncmp_nocase(in_ext,out_ext))
+			if(page>=0)
+			{
+				//only this page is wanted, and the file is kept for the others
+				auto s=support();
+				cil::CImg<T> img;
+				load_s(img,s);
+				save_s(img,s);
+			}
+			else if(!exlib::strncmp_nocase(in_ext,out_ext))
 			{
 				copy_or_move();
 			}
@@ -529,19 +783,43 @@ namespace ScoreProcessor {
 			bool edited=false;
 			{
 				cil::CImg<T> img;
-				load_s(img,s);
-				for(auto it=this->begin();it<this->end();++it)
+				auto it=this->begin();
+				//the first process still runs on the decoded image, where it does nothing if the decode already dropped the color
+				bool gray_from_color=false;
+				bool* const to_gray=(*it)->discards_color()?&gray_from_color:nullptr;
+				if(s.first==support_type::jpeg)
+				{
+					if(load_jpeg_reduced(img,s,**it,to_gray))
+					{
+						++it;
+						edited=true;
+					}
+				}
+				else
+				{
+					load_s(img,s,to_gray);
+				}
+				if(gray_from_color)
 				{
-					edited|=(*it)->process(img);
+					edited=true;
 				}
-				if(s.first!=s.second)
+				page_analysis::scope analysis;
+				for(;it<this->end();++it)
+				{
+					if((*it)->process(img))
+					{
+						edited=true;
+						analysis.invalidate();
+					}
+				}
+				if(s.first!=s.second||page>=0)
 				{
 					edited=true;
 				}
 				if(edited)
 				{
 					save_s(img,s);
-					if(do_move&&!std::filesystem::equivalent(in,out))
+					if(do_move&&page<0&&!std::filesystem::equivalent(in,out))
 					{
 						remove(in);
 					}
@@ -578,7 +856,21 @@ namespace ScoreProcessor {
 	}
 
 	template<typename T>
-	void ProcessList<T>::process(char const* filename,SaveRules const* psr,unsigned int index,bool move,int quality,bool recurse) const
+	void ProcessList<T>::process(char const* filename,SaveRules const* psr,unsigned int index,bool move,int quality,bool recurse,int page) const
+	{
+		if(psr)
+		{
+			auto const output=psr->make_filename(std::string_view(filename),index);
+			process(filename,output.c_str(),index,move,quality,recurse,page);
+		}
+		else
+		{
+			process(filename,filename,index,move,quality,recurse,page);
+		}
+	}
+
+	template<typename T>
+	void ProcessList<T>::process(char const* filename,char const* output,unsigned int index,bool move,int quality,bool recurse,int page) const
 	{
 		size_t len=strlen(filename);
 		bool out_loud=plog&&vb>=decltype(vb)::loud;
@@ -590,11 +882,9 @@ namespace ScoreProcessor {
 			plog->log(log,index);
 		}
 		{
-			decltype(psr->make_filename(std::string_view(),index)) output;
-			output=psr?psr->make_filename(std::string_view(filename,len),index):filename;
 			try
 			{
-				process_unsafe(filename,output.c_str(),move,quality,recurse);
+				process_unsafe(filename,output,move,quality,recurse,page);
 			}
 			catch(std::exception const& ex)
 			{
@@ -639,7 +929,10 @@ namespace ScoreProcessor {
 		exlib::thread_pool tp(num_threads);
 		for(size_t i=0;i<imgs.size();++i)
 		{
-			tp.add_task<typename ProcessList<T>::ProcessTaskFName>(imgs[i],this,psr,i+starting_index,move,quality,recurse);
+			tp.push_back([name=imgs[i],psr,index=i+starting_index,move,quality,recurse,this]() noexcept
+			{
+				process(name,psr,index,move,quality,recurse);
+			});
 		}
 		tp.start();
 	}
@@ -653,13 +946,18 @@ namespace ScoreProcessor {
 		unsigned int const starting_index,
 		bool move,
 		int quality,
-		bool recurse) const
+		bool recurse,
+		std::vector<int> const* pages) const
 	{
+		auto const page_of=[pages](size_t i)
+		{
+			return pages?(*pages)[i]:-1;
+		};
 		if(num_threads<2) //avoid threadpool overhead
 		{
 			for(size_t i=0;i<imgs.size();++i)
 			{
-				process(imgs[i].data(),psr,i+starting_index,move,quality,recurse);
+				process(imgs[i].data(),psr,i+starting_index,move,quality,recurse,page_of(i));
 			}
 		}
 		else
@@ -667,9 +965,47 @@ namespace ScoreProcessor {
 			exlib::thread_pool tp(num_threads);
 			for(size_t i=0;i<imgs.size();++i)
 			{
-				tp.push_back([name=imgs[i].data(),psr,index=i+starting_index,move,quality,recurse,this]() noexcept
+				tp.push_back([name=imgs[i].data(),psr,index=i+starting_index,move,quality,recurse,page=page_of(i),this]() noexcept
 				{
-					process(name,psr,index,move,quality,recurse);
+					process(name,psr,index,move,quality,recurse,page);
+				});
+			}
+			tp.start();
+		}
+	}
+
+	template<typename T>
+	template<typename String>
+	void ProcessList<T>::process(
+		std::vector<String> const& imgs,
+		std::vector<std::string> const& outputs,
+		unsigned int const num_threads,
+		unsigned int const starting_index,
+		bool move,
+		int quality,
+		bool recurse,
+		std::vector<int> const* pages) const
+	{
+		assert(imgs.size()==outputs.size());
+		auto const page_of=[pages](size_t i)
+		{
+			return pages?(*pages)[i]:-1;
+		};
+		if(num_threads<2) //avoid threadpool overhead
+		{
+			for(size_t i=0;i<imgs.size();++i)
+			{
+				process(imgs[i].data(),outputs[i].c_str(),i+starting_index,move,quality,recurse,page_of(i));
+			}
+		}
+		else
+		{
+			exlib::thread_pool tp(num_threads);
+			for(size_t i=0;i<imgs.size();++i)
+			{
+				tp.push_back([name=imgs[i].data(),output=outputs[i].c_str(),index=i+starting_index,move,quality,recurse,page=page_of(i),this]() noexcept
+				{
+					process(name,output,index,move,quality,recurse,page);
 				});
 			}
 			tp.start();
@@ -699,14 +1035,39 @@ namespace ScoreProcessor {
 
 	inline void SaveRules::assign(char const* tmplt)
 	{
-		std::vector<part> repl;
-		bool found=false;
-		exlib::string str(20);
+		std::vector<instruction> prog;
+		std::string lits;
+		size_t fixed=0;
+		unsigned int uses=0;
+		size_t start=0;
 		auto put_string=[&]()
 		{
-			repl.emplace_back(str);
-			str.reserve(20);
+			if(lits.size()>start)
+			{
+				prog.push_back({template_symbol::string,std::uint32_t(start),std::uint32_t(lits.size()-start)});
+				fixed+=lits.size()-start;
+				start=lits.size();
+			}
+		};
+		auto put_symbol=[&](int symbol)
+		{
+			put_string();
+			prog.push_back({symbol,0,0});
+			if(symbol<=padding_max)
+			{
+				//an unsigned int has at most 10 digits
+				fixed+=std::max(symbol,10);
+			}
+			else
+			{
+				++uses;
+				if(symbol==template_symbol::p)
+				{
+					++fixed; //an empty path is written as .
+				}
+			}
 		};
+		bool found=false;
 		for(;*tmplt!=0;++tmplt)
 		{
 			if(found)
@@ -715,35 +1076,29 @@ namespace ScoreProcessor {
 				char letter=*tmplt;
 				if(letter>='0'&&letter<='9')
 				{
-					put_string();
-					repl.emplace_back(letter-'0');
+					put_symbol(letter-'0');
 				}
 				else
 				{
 					switch(letter)
 					{
 					case 'x':
-						put_string();
-						repl.emplace_back(template_symbol::x);
+						put_symbol(template_symbol::x);
 						break;
 					case 'f':
-						put_string();
-						repl.emplace_back(template_symbol::f);
+						put_symbol(template_symbol::f);
 						break;
 					case 'p':
-						put_string();
-						repl.emplace_back(template_symbol::p);
+						put_symbol(template_symbol::p);
 						break;
 					case 'c':
-						put_string();
-						repl.emplace_back(template_symbol::c);
+						put_symbol(template_symbol::c);
 						break;
 					case 'w':
-						put_string();
-						repl.emplace_back(template_symbol::w);
+						put_symbol(template_symbol::w);
 						break;
 					case '%':
-						str.push_back('%');
+						lits.push_back('%');
 						break;
 					default:
 						throw std::invalid_argument("Invalid escape character");
@@ -758,7 +1113,7 @@ namespace ScoreProcessor {
 				}
 				else
 				{
-					str.push_back(*tmplt);
+					lits.push_back(*tmplt);
 				}
 			}
 		}
@@ -766,17 +1121,31 @@ namespace ScoreProcessor {
 		{
 			throw std::invalid_argument("Trailing escape symbol");
 		}
-		if(!str.empty())
-		{
-			repl.emplace_back(str);
-		}
-		parts=std::move(repl);
+		put_string();
+		program=std::move(prog);
+		literals=std::move(lits);
+		fixed_size=fixed;
+		input_uses=uses;
+	}
+
+	inline size_t SaveRules::size_estimate(size_t input_size) const
+	{
+		return fixed_size+input_uses*input_size;
 	}
 
 	template<typename String>
 	std::string SaveRules::make_filename(String const& input,unsigned int index) const
 	{
 		std::string out;
+		make_filename(out,input,index);
+		return out;
+	}
+
+	template<typename String>
+	void SaveRules::make_filename(std::string& out,String const& input,unsigned int index) const
+	{
+		out.clear();
+		out.reserve(size_estimate(input.size()));
 		struct string_view {
 			char const* data;
 			size_t size;
@@ -818,87 +1187,83 @@ namespace ScoreProcessor {
 				path.size=exlib::find_path_end(path.data,filename.data)-path.data;
 			}
 		};
-		for(auto const& p:parts)
+		for(auto const& ins:program)
 		{
-			if(p.data)
+			if(ins.symbol==template_symbol::string)
 			{
-				out.append(p.data,p.info.size);
+				out.append(literals.data()+ins.offset,ins.size);
 			}
-			else
+			else if(ins.symbol<=padding_max)
 			{
-				if(p.info.tmplt<10)
+				char buffer[10];
+				char* const last=buffer+10;
+				char* end=last-1;
+				auto n=index;
+				while(true)
 				{
-					char buffer[10];
-					char* const last=buffer+10;
-					char* end=last-1;
-					auto n=index;
-					while(true)
-					{
-						*end=n%10+'0';
-						n/=10;
-						if(n==0) break;
-						--end;
-					}
-					char* start=last-p.info.tmplt;
-					if(start<end)
-					{
-						*start='0';
-						for(char* it=start+1;it<end;++it)
-						{
-							*it='0';
-						}
-					}
-					else
+					*end=n%10+'0';
+					n/=10;
+					if(n==0) break;
+					--end;
+				}
+				char* start=last-ins.symbol;
+				if(start<end)
+				{
+					*start='0';
+					for(char* it=start+1;it<end;++it)
 					{
-						start=end;
+						*it='0';
 					}
-					out.append(start,size_t(last-start));
 				}
 				else
 				{
-					switch(p.info.tmplt)
+					start=end;
+				}
+				out.append(start,size_t(last-start));
+			}
+			else
+			{
+				switch(ins.symbol)
+				{
+				case SaveRules::template_symbol::x:
+					check_ext();
+					out.append(ext.data,ext.size);
+					break;
+				case SaveRules::template_symbol::f:
+					check_filename();
+					out.append(filename.data,filename.size);
+					break;
+				case SaveRules::template_symbol::p:
+					check_path();
+					if(path.size==0)
 					{
-					case SaveRules::template_symbol::x:
-						check_ext();
-						out.append(ext.data,ext.size);
-						break;
-					case SaveRules::template_symbol::f:
-						check_filename();
-						out.append(filename.data,filename.size);
-						break;
-					case SaveRules::template_symbol::p:
-						check_path();
-						if(path.size==0)
-						{
-							out.append(".");
-						}
-						else
-						{
-							out.append(path.data,path.size);
-						}
-						break;
-					case SaveRules::template_symbol::w:
-						check_filename();
-						out.append(whole.data,whole.size);
-						break;
-					case SaveRules::template_symbol::c:
-						out.append(input.data(),input.size());
-						break;
+						out.push_back('.');
+					}
+					else
+					{
+						out.append(path.data,path.size);
 					}
+					break;
+				case SaveRules::template_symbol::w:
+					check_filename();
+					out.append(whole.data,whole.size);
+					break;
+				case SaveRules::template_symbol::c:
+					out.append(input.data(),input.size());
+					break;
 				}
 			}
 		}
-		return out;
 	}
 
 	inline std::string SaveRules::make_filename(char const* input,unsigned int index) const
 	{
-		return make_filename(exlib::weak_string(const_cast<char*>(input)),index);
+		return make_filename(std::string_view(input),index);
 	}
 
 	inline bool SaveRules::empty() const
 	{
-		return parts.empty();
+		return program.empty();
 	}
 
 	/*
@@ -906,24 +1271,11 @@ namespace ScoreProcessor {
 	*/
 	inline bool SaveRules::contains(SaveRules::template_symbol ts) const
 	{
-		if(ts==template_symbol::string)
-		{
-			for(auto const& prt:this->parts)
-			{
-				if(prt.data!=0)
-				{
-					return true;
-				}
-			}
-		}
-		else
+		for(auto const& ins:program)
 		{
-			for(auto const& prt:this->parts)
+			if(ins.symbol==ts)
 			{
-				if(prt.data==0&&prt.info.tmplt==ts)
-				{
-					return true;
-				}
+				return true;
 			}
 		}
 		return false;
@@ -931,25 +1283,27 @@ namespace ScoreProcessor {
 
 	inline bool SaveRules::contains_indexing() const
 	{
-		for(auto const& prt:this->parts)
+		for(auto const& ins:program)
 		{
-			if(prt.data==0&&prt.info.tmplt>=padding_min&&prt.info.tmplt<=padding_max)
+			if(ins.symbol>=padding_min&&ins.symbol<=padding_max)
 			{
 				return true;
 			}
 		}
+		return false;
 	}
 
 	template<typename String>
 	bool SaveRules::contains(String const& str) const
 	{
-		for(auto const& prt:this->parts)
+		for(auto const& ins:program)
 		{
-			if(prt.data!=0&&str==prt.data)
+			if(ins.symbol==template_symbol::string&&str==std::string_view(literals.data()+ins.offset,ins.size))
 			{
 				return true;
 			}
 		}
+		return false;
 	}
 }
 #endif
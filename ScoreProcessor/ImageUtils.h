@@ -469,11 +469,11 @@ namespace ImageUtils {
 		float r=this->r,b=this->b,g=this->g;
 		auto min=std::min(r,std::min(g,b));
 		auto max=std::max(r,std::max(g,b));
-		ret.v=unsigned char(max);
+		ret.v=static_cast<unsigned char>(max);
 		auto delta=max-min;
 		if(max!=0)
 		{
-			ret.s=unsigned char(std::round(delta/max*255));
+			ret.s=static_cast<unsigned char>(std::round(delta/max*255));
 		}
 		else
 		{
@@ -499,7 +499,7 @@ namespace ImageUtils {
 		{
 			hue+=256;
 		}
-		ret.h=unsigned char(std::round(hue));
+		ret.h=static_cast<unsigned char>(std::round(hue));
 		return ret;
 	}
 
@@ -119,7 +119,19 @@ namespace ScoreProcessor {
 	}
 
 	namespace List {
-		MakerTFull<UseTuple, Precheck> maker("Makes program list out files", "List Files", "");
+		MakerTFull<UseTuple, Precheck> maker("Makes program list out files, with the dimensions and channels read from their headers", "List Files", "");
+	}
+
+	namespace MapInput {
+		MakerTFull<UseTuple, Precheck> maker("Reads input jpegs and pngs through memory mappings instead of buffered file reads", "Map Input", "");
+	}
+
+	namespace SyncOutput {
+		MakerTFull<UseTuple, Precheck> maker("Flushes each saved file to disk before putting it in place, and the output folders once at the end", "Sync Output", "");
+	}
+
+	namespace TiffContainer {
+		MakerTFull<UseTuple, Precheck> maker("Makes cut save the pieces of each page, and splice save all of its pages, as one multi-page tiff", "Tiff Container", "");
 	}
 
 	namespace SIMaker {
@@ -287,12 +299,14 @@ namespace ScoreProcessor {
 	}
 
 	namespace SmartScale {
-		SingMaker<UseTuple, FloatParser<Ratio>, Input> maker(
+		SingMaker<UseTuple, FloatParser<Ratio>, Input, UIntParser<Batch>> maker(
 			"Scales using an neural network\n"
 			"factor tag: f\n"
-			"network_path tag: net\n",
+			"network_path tag: net\n"
+			"batch_size is how many patches go through the network at once, 0 for the default\n"
+			"batch_size tag: b, batch\n",
 			"Smart Scale",
-			"factor network_path=(search program directory for first network)");
+			"factor network_path=(search program directory for first network) batch_size=0");
 	}
 
 	namespace Cropper {
@@ -307,6 +321,16 @@ namespace ScoreProcessor {
 		decltype(maker) maker("Set the quality of the save file [0,100], only affects jpegs", "Quality", "quality");
 	}
 
+	namespace Encoding {
+		decltype(maker) maker("Sets how pngs and tiffs are encoded\n"
+			"png level: zlib level [0,9], lower is faster and larger, or -1 for the libpng default; tags: l, lvl, level\n"
+			"png filter: row filter, none, sub, up, avg, paeth, all to choose per row, or default to leave it to libpng; tags: f, flt, filter\n"
+			"tiff compression: none, lzw, deflate, or g4 for CCITT group 4, which only applies to black and white pages; tags: t, tiff\n"
+			"bilevel: whether pages that are only black and white are saved at 1 bit per pixel; tags: b, bl, bilevel",
+			"Encoding",
+			"png_level=-1 png_filter=default tiff_compression=lzw bilevel=f");
+	}
+
 	namespace RescaleAbsoluteMaker {
 		decltype(maker) maker{
 			"Rescale to an absolute width and height\n"
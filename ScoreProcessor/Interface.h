@@ -78,7 +78,12 @@ namespace ScoreProcessor {
 			bool list_files; //whether files should be listed out to the user
 			bool check_overwrite;
 			bool make_folders;
+			bool map_input; //whether input files are read through memory mappings
+			bool sync_outputs; //whether saved files are flushed to disk before being put in place
+			bool tiff_container; //whether cut and splice put their pages into one multi-page tiff
 			int quality; //[0,100] jpeg file quality
+			bool encoding_given;
+			cil::encode_options encoding; //png and tiff encoder settings
 			PMINLINE delivery():
 				starting_index(-1), //invalid values means not given by user
 				flag(do_absolutely_nothing),
@@ -88,8 +93,12 @@ namespace ScoreProcessor {
 				list_files(false),
 				check_overwrite(false),
 				make_folders(true),
+				map_input(false),
+				sync_outputs(false),
+				tiff_container(false),
 				lt(unassigned_log),
-				quality(-1)
+				quality(-1),
+				encoding_given(false)
 			{}
 			//assigns the default value of num threads if not assigned
 			//num_threads is limited by num_files if the thread_count has not been overridden by a process
@@ -495,48 +504,28 @@ namespace ScoreProcessor {
 			constexpr static bool const value=val<T>(0);
 		};
 
-		template<typename...>
-		struct count_helper;
-
-		template<typename A,typename... Rest>
-		struct count_helper<A,Rest...> {
-			typedef A type;
-			typedef count_helper<Rest...> rest;
-		};
-
-		template<>
-		struct count_helper<> {};
-
-		template<typename A>
-		constexpr static size_t _count()
-		{
-			if constexpr(!has_def_val<A::type>::value)
-			{
-				return 1+_count<A::rest>();
-			}
-			return 0;
-		}
-
-		template<>
-		constexpr static size_t _count<count_helper<>>()
-		{
-			return 0;
-		}
-
+		//the number of leading parsers without a default value
 		template<typename... A>
 		constexpr static size_t defaults()
 		{
-			return _count<count_helper<A...>>();
+			constexpr bool has_def[]={has_def_val<A>::value...,true};
+			size_t count=0;
+			while(!has_def[count])
+			{
+				++count;
+			}
+			return count;
 		}
 
 		template<typename U>
 		constexpr static auto check_parse(int) -> decltype(std::declval<U>().parse(InputType()));
 		template<typename U>
 		constexpr static auto check_parse(int) -> decltype(std::declval<U>().parse(InputType(),size_t()));
-		template<typename>
+		template<typename U>
 		constexpr static bool check_parse(...)
 		{
-			static_assert(false,"Failed to find parse function");
+			static_assert(sizeof(U)==0,"Failed to find parse function");
+			return false;
 		}
 
 		template<typename T>
@@ -556,34 +545,17 @@ namespace ScoreProcessor {
 			constexpr static bool const value=val<T>(0);
 		};
 
-		struct uses_tuple {
-		private:
-			template<typename U>
-			constexpr static auto val(int) ->
-				decltype(std::declval<U>().use_tuple(std::declval<CommandMaker::delivery>(),std::declval<MyArgs>()),bool())
-			{
-				return true;
-			}
-			template<typename>
-			constexpr static bool val(...)
-			{
-				return false;
-			}
-		public:
-			constexpr static bool const value=val<UseTuple>(0);
-		};
-
 		struct has_precheck {
 		private:
 			template<typename U>
 			constexpr static auto val(int) ->
-				decltype(std::declval<U>().check(std::declval<CommandMaker::delivery>()),int())
+				decltype(std::declval<U>().check(std::declval<CommandMaker::delivery&>()),int())
 			{
 				return 1;
 			}
 			template<typename U>
 			constexpr static auto val(int) ->
-				decltype(std::declval<U>().check(std::declval<CommandMaker::delivery>(),size_t()),int())
+				decltype(std::declval<U>().check(std::declval<CommandMaker::delivery&>(),size_t()),int())
 			{
 				return 2;
 			}
@@ -621,6 +593,23 @@ namespace ScoreProcessor {
 		using MyArgs=std::tuple<decltype(check_parse<ArgParsers>(0))...>;
 		static_assert(std::tuple_size<MyParsers>::value==MaxArgs);
 		static_assert(std::tuple_size<MyArgs>::value==MaxArgs);
+
+		struct uses_tuple {
+		private:
+			template<typename U>
+			constexpr static auto val(int) ->
+				decltype(std::declval<U>().use_tuple(std::declval<CommandMaker::delivery&>(),std::declval<MyArgs>()),bool())
+			{
+				return true;
+			}
+			template<typename>
+			constexpr static bool val(...)
+			{
+				return false;
+			}
+		public:
+			constexpr static bool const value=val<UseTuple>(0);
+		};
 	private:
 		constexpr MyParsers& as_parsers()
 		{
@@ -838,7 +827,7 @@ namespace ScoreProcessor {
 		template<size_t I>
 		constexpr auto get_def_val(...)
 		{
-			return decltype(check_parse<std::remove_reference<decltype(std::get<I>(std::declval<MyParsers>()))>::type>(0))();
+			return decltype(check_parse<typename std::remove_reference<decltype(std::get<I>(std::declval<MyParsers>()))>::type>(0))();
 		}
 		template<size_t... Is>
 		constexpr MyArgs init_args_h(std::index_sequence<Is...>)
@@ -1120,7 +1109,7 @@ namespace ScoreProcessor {
 		struct Boundary {
 			cnnm("boundary");
 			clbl("b");
-			cndf(unsigned char(128))
+			cndf(static_cast<unsigned char>(128))
 		};
 		struct Gamma {
 			cnnm("gamma");
@@ -1284,15 +1273,15 @@ namespace ScoreProcessor {
 					{
 						if(c>='a'&&c<='z')
 						{
-							return unsigned char(c-'a'+10);
+							return static_cast<unsigned char>(c-'a'+10);
 						}
 						if(c>='A'&&c<='Z')
 						{
-							return unsigned char(c-'A'+10);
+							return static_cast<unsigned char>(c-'A'+10);
 						}
 						if(c>='0'&&c<='9')
 						{
-							return unsigned char(c-'0');
+							return static_cast<unsigned char>(c-'0');
 						}
 						throw std::invalid_argument("Invalid color argument");
 					};
@@ -1630,7 +1619,7 @@ namespace ScoreProcessor {
 		struct Contrast {
 			cnnm("contrast threshold");
 			clbl("ct","c");
-			cndf(unsigned char(128))
+			cndf(static_cast<unsigned char>(128))
 		};
 		struct UseTuple {
 			static void use_tuple(CommandMaker::delivery& del,unsigned char threshold,double gamma)
@@ -1649,12 +1638,12 @@ namespace ScoreProcessor {
 		struct Max {
 			clbl("mx","max","mxv");
 			cnnm("max brightness");
-			cndf(unsigned char(255))
+			cndf(static_cast<unsigned char>(255))
 		};
 		struct Replacer {
 			clbl("r","rep");
 			cnnm("replacer");
-			cndf(unsigned char(255))
+			cndf(static_cast<unsigned char>(255))
 		};
 
 		struct UseTuple {
@@ -1736,6 +1725,66 @@ namespace ScoreProcessor {
 		extern MakerTFull<UseTuple,Precheck> maker;
 	}
 
+	namespace MapInput {
+		struct Precheck {
+			PMINLINE void check(CommandMaker::delivery const& del)
+			{
+				if(del.map_input)
+				{
+					throw std::invalid_argument("Map input command already given");
+				}
+			}
+		};
+		struct UseTuple {
+			PMINLINE void use_tuple(CommandMaker::delivery& del)
+			{
+				del.map_input=true;
+			}
+		};
+
+		extern MakerTFull<UseTuple,Precheck> maker;
+	}
+
+	namespace SyncOutput {
+		struct Precheck {
+			PMINLINE void check(CommandMaker::delivery const& del)
+			{
+				if(del.sync_outputs)
+				{
+					throw std::invalid_argument("Sync command already given");
+				}
+			}
+		};
+		struct UseTuple {
+			PMINLINE void use_tuple(CommandMaker::delivery& del)
+			{
+				del.sync_outputs=true;
+			}
+		};
+
+		extern MakerTFull<UseTuple,Precheck> maker;
+	}
+
+	namespace TiffContainer {
+		struct Precheck {
+			PMINLINE void check(CommandMaker::delivery const& del)
+			{
+				if(del.tiff_container)
+				{
+					throw std::invalid_argument("Tiff container command already given");
+				}
+			}
+		};
+		struct UseTuple {
+			PMINLINE void use_tuple(CommandMaker::delivery& del)
+			{
+				del.tiff_container=true;
+			}
+		};
+
+		extern MakerTFull<UseTuple,Precheck> maker;
+	}
+
 	namespace SIMaker {
 		struct Precheck {
 			PMINLINE static void check(CommandMaker::delivery const& del)
@@ -1936,7 +1985,7 @@ namespace ScoreProcessor {
 		struct Replacer {
 			clbl("rc");
 			cnnm("replacer");
-			cndf(unsigned char(255))
+			cndf(static_cast<unsigned char>(255))
 		};
 
 		struct EightWay {
@@ -2136,7 +2185,7 @@ namespace ScoreProcessor {
 				{
 					if(*actual=='k')
 					{
-						return pv(unsigned int(-1));
+						return pv(static_cast<unsigned int>(-1));
 					}
 					else if(*actual=='r')
 					{
@@ -2172,7 +2221,7 @@ namespace ScoreProcessor {
 				{
 					if(*actual=='k')
 					{
-						return pv(unsigned int(-1));
+						return pv(static_cast<unsigned int>(-1));
 					}
 					else if(*actual=='l')
 					{
@@ -2224,7 +2273,7 @@ namespace ScoreProcessor {
 		struct BGround {
 			cnnm("background threshold");
 			clbl("bg");
-			cndf(unsigned char(128))
+			cndf(static_cast<unsigned char>(128))
 		};
 		using BGParser=IntegerParser<unsigned char,BGround>;
 		struct UseTuple {
@@ -2262,7 +2311,7 @@ namespace ScoreProcessor {
 				{
 					if(*actual=='k')
 					{
-						return pv(unsigned int(-1));
+						return pv(static_cast<unsigned int>(-1));
 					}
 					else if(*actual=='r')
 					{
@@ -2298,7 +2347,7 @@ namespace ScoreProcessor {
 				{
 					if(*actual=='k')
 					{
-						return pv(unsigned int(-1));
+						return pv(static_cast<unsigned int>(-1));
 					}
 					else if(*actual=='l')
 					{
@@ -2394,7 +2443,7 @@ namespace ScoreProcessor {
 		struct Max {
 			clbl("mx","max");
 			cnnm("max");
-			cndf(unsigned char(255))
+			cndf(static_cast<unsigned char>(255))
 		};
 
 		struct UseTuple {
@@ -2538,7 +2587,7 @@ namespace ScoreProcessor {
 		struct BG {
 			cnnm("background");
 			clbl("bg");
-			cndf(unsigned char(128))
+			cndf(static_cast<unsigned char>(128))
 		};
 		template<typename Base>
 		struct pv_parser:public Base {
@@ -2669,8 +2718,14 @@ namespace ScoreProcessor {
 			cndf(nullptr)
 		};
 
+		struct Batch {
+			clbl("batch","b");
+			cnnm("batch_size");
+			cndf(0U)
+		};
+
 		struct UseTuple {
-			static PMINLINE void use_tuple(CommandMaker::delivery& del,float ratio,char const* network)
+			static PMINLINE void use_tuple(CommandMaker::delivery& del,float ratio,char const* network,unsigned int batch)
 			{
 				if(ratio<=0)
 				{
@@ -2681,24 +2736,22 @@ namespace ScoreProcessor {
 					del.overridden_num_threads=1;
 					if(network==nullptr)
 					{
-						std::string path;
-						path.reserve(MAX_PATH);
-						GetModuleFileNameA(NULL,path.data(),MAX_PATH);
-						auto const files=exlib::files_in_dir(path);
-						for(auto const& f:files)
+						//the first network next to the executable
+						auto const dir=exlib::executable_directory();
+						auto const files=exlib::files_in_dir(dir);
+						auto const net=std::find_if(files.begin(),files.end(),[](std::string const& f)
 						{
-							auto ext=exlib::find_extension(f.data(),f.data()+f.size());
-							if(strcmp(ext,"ssn")==0)
-							{
-								del.pl.add_process<NeuralScale>(ratio,f.data(),&del.overridden_num_threads);
-								break;
-							}
+							return strcmp(exlib::find_extension(f.data(),f.data()+f.size()),"ssn")==0;
+						});
+						if(net==files.end())
+						{
+							throw std::invalid_argument("Failed to find network data");
 						}
-						throw std::invalid_argument("Failed to find network data");
+						del.pl.add_process<NeuralScale>(ratio,(dir+*net).c_str(),&del.overridden_num_threads,batch);
 					}
 					else
 					{
-						del.pl.add_process<NeuralScale>(ratio,network,&del.overridden_num_threads);
+						del.pl.add_process<NeuralScale>(ratio,network,&del.overridden_num_threads,batch);
 					}
 				}
 				if(ratio<1)
@@ -2708,7 +2761,7 @@ namespace ScoreProcessor {
 			}
 		};
 
-		extern SingMaker<UseTuple,FloatParser<Ratio>,Input> maker;
+		extern SingMaker<UseTuple,FloatParser<Ratio>,Input,UIntParser<Batch>> maker;
 	}
 
 	namespace Cropper {
@@ -2799,6 +2852,109 @@ namespace ScoreProcessor {
 		extern MakerTFull<UseTuple,Precheck,IntParser<Value>> maker;
 	}
 
+	namespace Encoding {
+		struct Precheck {
+			static PMINLINE void check(CommandMaker::delivery const& del)
+			{
+				if(del.encoding_given)
+				{
+					throw std::invalid_argument("Encoding already set");
+				}
+			}
+		};
+		struct PngLevel {
+			cnnm("png level");
+			clbl("l","lvl","level");
+			cndf(int(-1))
+		};
+		struct PngFilter {
+			cnnm("png filter");
+			clbl("f","flt","filter");
+			cndf(int(-1))
+			//png.h is only included with cimg_use_png, so the PNG_FILTER_* flags are spelled out
+			static PMINLINE int parse(char const* sv)
+			{
+				switch(sv[0])
+				{
+					case 'n':
+						return 0x08; //PNG_FILTER_NONE
+					case 's':
+						return 0x10; //PNG_FILTER_SUB
+					case 'u':
+						return 0x20; //PNG_FILTER_UP
+					case 'p':
+						return 0x80; //PNG_FILTER_PAETH
+					case 'd':
+						return -1;
+					case 'a':
+						switch(sv[1])
+						{
+							case 'v':
+								return 0x40; //PNG_FILTER_AVG
+							case 'l':
+								return 0xF8; //PNG_ALL_FILTERS
+							case '\0':
+								throw std::invalid_argument("Ambiguous filter starting with a");
+						}
+						[[fallthrough]];
+					default:
+						std::string err("Unknown filter ");
+						err.append(sv);
+						throw std::invalid_argument(err);
+				}
+			}
+		};
+		struct TiffCompression {
+			cnnm("tiff compression");
+			clbl("t","tiff");
+			cndf(static_cast<unsigned int>(1))
+			static PMINLINE unsigned int parse(char const* sv)
+			{
+				switch(sv[0])
+				{
+					case 'n':
+						return 0;
+					case 'l':
+						return 1;
+					case 'd':
+					case 'z':
+						return 3;
+					case 'g':
+						return 4;
+					default:
+						std::string err("Unknown compression ");
+						err.append(sv);
+						throw std::invalid_argument(err);
+				}
+			}
+		};
+		struct Bilevel {
+			cnnm("bilevel");
+			clbl("b","bl","bilevel");
+			cndf(false)
+			static PMINLINE constexpr bool parse(InputType s)
+			{
+				auto const c=s[0];
+				return c=='t'||c=='1'||c=='T'||c=='\0';
+			}
+		};
+		struct UseTuple {
+			static PMINLINE void use_tuple(CommandMaker::delivery& del,int level,int filter,unsigned int tiff,bool bilevel)
+			{
+				if(level<-1||level>9)
+				{
+					throw std::invalid_argument("Png level must be an integer [0,9], or -1 for the default");
+				}
+				del.encoding.png_level=level;
+				del.encoding.png_filters=filter;
+				del.encoding.tiff_compression=tiff;
+				del.encoding.reduce_bilevel=bilevel;
+				del.encoding_given=true;
+			}
+		};
+		extern MakerTFull<UseTuple,Precheck,IntParser<PngLevel>,PngFilter,TiffCompression,Bilevel> maker;
+	}
+
 	namespace RescaleAbsoluteMaker {
 		using uint=unsigned int;
 		inline constexpr uint interpolate=-1;
@@ -3142,7 +3298,9 @@ namespace ScoreProcessor {
 		struct UseTuple {
 			static void use_tuple(CommandMaker::delivery& del,unsigned int mvs,unsigned int mh,unsigned int mv,unsigned char bg,unsigned int mhs)
 			{
-				del.pl.add_process<VertCompress>(mvs,mhs,mh,mv,bg);
+				//pages are run one at a time, and each is compressed with all of the threads
+				del.overridden_num_threads=1;
+				del.pl.add_process<VertCompress>(mvs,mhs,mh,mv,bg,&del.overridden_num_threads);
 			}
 		};
 		extern SingMaker<UseTuple,UIntParser<MinSpace>,UIntParser<MaxVerticalProtection>,UIntParser<MinHorizProtection>,HPMaker::BGParser,MinHSpace> maker;
@@ -3191,7 +3349,7 @@ namespace ScoreProcessor {
 				}
 				else
 				{
-					del.pl.add_process<ResizeToBound>(width, height, true, unsigned char(fill), mode, gamma);
+					del.pl.add_process<ResizeToBound>(width, height, true, static_cast<unsigned char>(fill), mode, gamma);
 				}
 			}
 		};
@@ -3214,12 +3372,12 @@ namespace ScoreProcessor {
 		struct LowerBound {
 			cnnm("lower bound");
 			clbl("l", "lb");
-			cndf(unsigned char(0))
+			cndf(static_cast<unsigned char>(0))
 		};
 		struct UpperBound {
 			cnnm("upper bound");
 			clbl("u", "ub");
-			cndf(unsigned char(254))
+			cndf(static_cast<unsigned char>(254))
 		};
 		struct UseTuple {
 			static void use_tuple(CommandMaker::delivery& del, unsigned int w, unsigned char lb, unsigned char ub, Rescale::rescale_mode mode, float gamma)
@@ -3236,7 +3394,7 @@ namespace ScoreProcessor {
 		struct UpperBound {
 			cnnm("upper bound");
 			clbl("u", "ub", "bg");
-			cndf(unsigned char(254))
+			cndf(static_cast<unsigned char>(254))
 		};
 		struct Left {
 			cnnm("left");
@@ -3502,6 +3660,10 @@ namespace ScoreProcessor {
 			compair("si",&SIMaker::maker),
 			compair("flt",&RgxFilter::maker),
 			compair("list",&List::maker),
+			compair("mmap",&MapInput::maker),
+			compair("sync",&SyncOutput::maker),
+			compair("tc",&TiffContainer::maker),
+			compair("enc",&Encoding::maker),
 			compair("q",&Quality::maker) };
 #endif
 
@@ -0,0 +1,135 @@
+/*
+Copyright(C) 2017-2018 Edward Xie
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "stdafx.h"
+#include "MappedFile.h"
+#include "support.h"
+#include <utility>
+#include <cstdint>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+namespace ScoreProcessor {
+
+	mapped_file::mapped_file() noexcept:_data(nullptr),_size(0)
+	{}
+
+	mapped_file::mapped_file(char const* path) noexcept:mapped_file()
+	{
+#ifdef _WIN32
+		HANDLE const file=CreateFileA(path,GENERIC_READ,FILE_SHARE_READ,nullptr,OPEN_EXISTING,FILE_FLAG_SEQUENTIAL_SCAN,nullptr);
+		if(file==INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+		LARGE_INTEGER size;
+		if(GetFileSizeEx(file,&size)&&size.QuadPart>0&&static_cast<unsigned long long>(size.QuadPart)<=SIZE_MAX)
+		{
+			if(HANDLE const mapping=CreateFileMappingA(file,nullptr,PAGE_READONLY,0,0,nullptr))
+			{
+				//the view keeps the mapping and file alive on its own
+				_data=static_cast<unsigned char const*>(MapViewOfFile(mapping,FILE_MAP_READ,0,0,0));
+				if(_data)
+				{
+					_size=static_cast<std::size_t>(size.QuadPart);
+				}
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+#else
+		int const file=open(path,O_RDONLY);
+		if(file<0)
+		{
+			return;
+		}
+		struct stat info;
+		if(fstat(file,&info)==0&&info.st_size>0)
+		{
+			void* const view=mmap(nullptr,static_cast<std::size_t>(info.st_size),PROT_READ,MAP_PRIVATE,file,0);
+			if(view!=MAP_FAILED)
+			{
+				//the decoders read front to back once, so read ahead and drop pages behind
+				madvise(view,static_cast<std::size_t>(info.st_size),MADV_SEQUENTIAL);
+				madvise(view,static_cast<std::size_t>(info.st_size),MADV_WILLNEED);
+				_data=static_cast<unsigned char const*>(view);
+				_size=static_cast<std::size_t>(info.st_size);
+			}
+		}
+		close(file);
+#endif
+	}
+
+	mapped_file::mapped_file(mapped_file&& other) noexcept:_data(other._data),_size(other._size)
+	{
+		other._data=nullptr;
+		other._size=0;
+	}
+
+	mapped_file& mapped_file::operator=(mapped_file&& other) noexcept
+	{
+		std::swap(_data,other._data);
+		std::swap(_size,other._size);
+		return *this;
+	}
+
+	mapped_file::~mapped_file()
+	{
+		if(_data)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(_data);
+#else
+			munmap(const_cast<unsigned char*>(_data),_size);
+#endif
+		}
+	}
+
+	void load_image(::cil::CImg<unsigned char>& img,char const* filename,bool map_input,int page)
+	{
+		if(page>=0)
+		{
+			img.load_tiff(filename,page,page);
+			return;
+		}
+		if(map_input)
+		{
+			auto const support=supported_path(filename);
+			if(support==support_type::jpeg||support==support_type::png)
+			{
+				mapped_file const input(filename);
+				if(input)
+				{
+					if(support==support_type::jpeg)
+					{
+						img.load_jpeg(input.data(),input.size());
+					}
+					else
+					{
+						img.load_png(input.data(),input.size());
+					}
+					return;
+				}
+			}
+		}
+		img.load(filename);
+	}
+}
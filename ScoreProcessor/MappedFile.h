@@ -0,0 +1,56 @@
+/*
+Copyright(C) 2017-2018 Edward Xie
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+#include "CImg.h"
+#include <cstddef>
+namespace ScoreProcessor {
+	/*
+		A read only view of a whole file, mapped into memory and marked for sequential access.
+		Empty if the file could not be opened or mapped, or has nothing in it.
+	*/
+	class mapped_file {
+		unsigned char const* _data;
+		std::size_t _size;
+	public:
+		mapped_file() noexcept;
+		explicit mapped_file(char const* path) noexcept;
+		mapped_file(mapped_file&& other) noexcept;
+		mapped_file& operator=(mapped_file&& other) noexcept;
+		~mapped_file();
+		unsigned char const* data() const noexcept
+		{
+			return _data;
+		}
+		std::size_t size() const noexcept
+		{
+			return _size;
+		}
+		explicit operator bool() const noexcept
+		{
+			return _data!=nullptr;
+		}
+	};
+
+	/*
+		Loads an image the same way as CImg's load, except that jpegs and pngs are decoded from a mapping of the file
+		when map_input is true. Falls back to regular reads if the file cannot be mapped.
+		page picks one page of a multi-page tiff, -1 loads a file as usual.
+	*/
+	void load_image(::cil::CImg<unsigned char>& img,char const* filename,bool map_input,int page=-1);
+}
+#endif
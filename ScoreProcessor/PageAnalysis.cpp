@@ -0,0 +1,329 @@
+/*
+Copyright(C) 2017-2018 Edward Xie
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "stdafx.h"
+#include "PageAnalysis.h"
+#if defined(__SSE2__)||defined(_M_X64)||(defined(_M_IX86_FP)&&_M_IX86_FP>=2)
+#define PAGE_ANALYSIS_SSE2
+#include <emmintrin.h>
+#endif
+namespace ScoreProcessor {
+
+	darkness_counts count_darkness(::cil::CImg<unsigned char> const& img,unsigned int limit)
+	{
+		darkness_counts counts;
+		counts.limit=limit;
+		counts.rows.resize(img._height);
+		counts.columns.resize(img._width);
+		std::size_t const width=img._width;
+		std::size_t const size=width*img._height;
+		auto const columns=counts.columns.data();
+		//row major with branchless counting so the inner loops vectorize
+		if(img._spectrum<3)
+		{
+			for(unsigned int y=0;y<img._height;++y)
+			{
+				auto const row=img._data+y*width;
+				unsigned int count=0;
+				for(std::size_t x=0;x<width;++x)
+				{
+					unsigned int const dark=row[x]<limit;
+					columns[x]+=dark;
+					count+=dark;
+				}
+				counts.rows[y]=count;
+			}
+		}
+		else
+		{
+			for(unsigned int y=0;y<img._height;++y)
+			{
+				auto const r=img._data+y*width;
+				auto const g=r+size;
+				auto const b=g+size;
+				unsigned int count=0;
+				for(std::size_t x=0;x<width;++x)
+				{
+					unsigned int const dark=(static_cast<unsigned int>(r[x])+g[x]+b[x])<limit;
+					columns[x]+=dark;
+					count+=dark;
+				}
+				counts.rows[y]=count;
+			}
+		}
+		return counts;
+	}
+
+	unsigned int find_left(darkness_counts const& counts,unsigned int tolerance)
+	{
+		unsigned int num=0;
+		auto const width=static_cast<unsigned int>(counts.columns.size());
+		for(unsigned int x=0;x<width;++x)
+		{
+			num+=counts.columns[x];
+			if(num>=tolerance)
+			{
+				return x;
+			}
+		}
+		return width-1;
+	}
+
+	unsigned int find_right(darkness_counts const& counts,unsigned int tolerance)
+	{
+		unsigned int num=0;
+		for(auto x=static_cast<unsigned int>(counts.columns.size());x>0;)
+		{
+			--x;
+			num+=counts.columns[x];
+			if(num>=tolerance)
+			{
+				return x;
+			}
+		}
+		return 0;
+	}
+
+	unsigned int find_top(darkness_counts const& counts,unsigned int tolerance)
+	{
+		unsigned int num=0;
+		auto const height=static_cast<unsigned int>(counts.rows.size());
+		for(unsigned int y=0;y<height;++y)
+		{
+			num+=counts.rows[y];
+			if(num>=tolerance)
+			{
+				return y;
+			}
+		}
+		return height-1;
+	}
+
+	unsigned int find_bottom(darkness_counts const& counts,unsigned int tolerance)
+	{
+		unsigned int num=0;
+		for(auto y=static_cast<unsigned int>(counts.rows.size());y>0;)
+		{
+			--y;
+			num+=counts.rows[y];
+			if(num>=tolerance)
+			{
+				return y;
+			}
+		}
+		return 0;
+	}
+
+	namespace {
+#ifdef PAGE_ANALYSIS_SSE2
+		//bit i is set if pixel i of the 16 is dark
+		inline unsigned int dark_mask(unsigned char const* gray,__m128i threshold)
+		{
+			__m128i const v=_mm_loadu_si128(reinterpret_cast<__m128i const*>(gray));
+			return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v,threshold),v));
+		}
+
+		inline unsigned int dark_mask(unsigned char const* r,unsigned char const* g,unsigned char const* b,__m128i limit)
+		{
+			__m128i const zero=_mm_setzero_si128();
+			__m128i const vr=_mm_loadu_si128(reinterpret_cast<__m128i const*>(r));
+			__m128i const vg=_mm_loadu_si128(reinterpret_cast<__m128i const*>(g));
+			__m128i const vb=_mm_loadu_si128(reinterpret_cast<__m128i const*>(b));
+			__m128i const lo=_mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(vr,zero),_mm_unpacklo_epi8(vg,zero)),_mm_unpacklo_epi8(vb,zero));
+			__m128i const hi=_mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(vr,zero),_mm_unpackhi_epi8(vg,zero)),_mm_unpackhi_epi8(vb,zero));
+			return _mm_movemask_epi8(_mm_packs_epi16(_mm_cmplt_epi16(lo,limit),_mm_cmplt_epi16(hi,limit)));
+		}
+#endif
+
+		/*
+			ChunkMask(offset) gives the dark mask of the 16 pixels starting at offset,
+			IsDark(offset) whether the single pixel at offset is dark.
+			Only the pixels inside region are looked at.
+		*/
+		template<typename ChunkMask,typename IsDark>
+		void trace_edges(edge_profiles& edges,unsigned int width,unsigned int height,ImageUtils::Rectangle<unsigned int> region,ChunkMask chunk_mask,IsDark is_dark)
+		{
+			auto const top=edges.top.data();
+			auto const bottom=edges.bottom.data();
+			for(unsigned int y=region.top;y<region.bottom;++y)
+			{
+				std::size_t const row=std::size_t(y)*width;
+				unsigned int left=width,right=0;
+				auto mark=[&](unsigned int x)
+				{
+					if(left==width)
+					{
+						left=x;
+					}
+					right=x;
+					if(top[x]==height)
+					{
+						top[x]=y;
+					}
+					bottom[x]=y;
+				};
+				unsigned int x=region.left;
+#ifdef PAGE_ANALYSIS_SSE2
+				for(;x+16<=region.right;x+=16)
+				{
+					for(unsigned int mask=chunk_mask(row+x),i=x;mask;++i,mask>>=1)
+					{
+						if(mask&1)
+						{
+							mark(i);
+						}
+					}
+				}
+#endif
+				for(;x<region.right;++x)
+				{
+					if(is_dark(row+x))
+					{
+						mark(x);
+					}
+				}
+				edges.left[y]=left;
+				edges.right[y]=right;
+			}
+		}
+	}
+
+	edge_profiles profile_edges(::cil::CImg<unsigned char> const& img,unsigned int limit)
+	{
+		return profile_edges(img,limit,{0,img._width,0,img._height});
+	}
+
+	edge_profiles profile_edges(::cil::CImg<unsigned char> const& img,unsigned int limit,ImageUtils::Rectangle<unsigned int> region)
+	{
+		region.right=std::min(region.right,img._width);
+		region.bottom=std::min(region.bottom,img._height);
+		edge_profiles edges;
+		edges.limit=limit;
+		edges.left.assign(img._height,img._width);
+		edges.right.assign(img._height,0);
+		edges.top.assign(img._width,img._height);
+		edges.bottom.assign(img._width,0);
+		if(limit==0||region.left>=region.right||region.top>=region.bottom)
+		{
+			return edges;
+		}
+		auto const data=img._data;
+		if(img._spectrum<3)
+		{
+#ifdef PAGE_ANALYSIS_SSE2
+			__m128i const threshold=_mm_set1_epi8(char(limit>255?255:limit-1));
+#endif
+			trace_edges(edges,img._width,img._height,region,[=](std::size_t offset)
+			{
+#ifdef PAGE_ANALYSIS_SSE2
+				return dark_mask(data+offset,threshold);
+#else
+				return 0U;
+#endif
+			},[=](std::size_t offset)
+			{
+				return data[offset]<limit;
+			});
+		}
+		else
+		{
+			std::size_t const size=std::size_t(img._width)*img._height;
+#ifdef PAGE_ANALYSIS_SSE2
+			//sums are at most 765, so the limit fits in a signed 16 bit lane
+			__m128i const threshold=_mm_set1_epi16(short(limit>766?766:limit));
+#endif
+			trace_edges(edges,img._width,img._height,region,[=](std::size_t offset)
+			{
+#ifdef PAGE_ANALYSIS_SSE2
+				return dark_mask(data+offset,data+size+offset,data+2*size+offset,threshold);
+#else
+				return 0U;
+#endif
+			},[=](std::size_t offset)
+			{
+				return static_cast<unsigned int>(data[offset])+data[size+offset]+data[2*size+offset]<limit;
+			});
+		}
+		return edges;
+	}
+
+	thread_local page_analysis* page_analysis::_current=nullptr;
+
+	page_analysis::page_analysis():_data(nullptr),_width(0),_height(0),_spectrum(0)
+	{}
+
+	page_analysis* page_analysis::current()
+	{
+		return _current;
+	}
+
+	bool page_analysis::matches(::cil::CImg<unsigned char> const& img) const
+	{
+		return _data==img._data&&_width==img._width&&_height==img._height&&_spectrum==img._spectrum;
+	}
+
+	void page_analysis::invalidate()
+	{
+		_darkness.clear();
+		_data=nullptr;
+	}
+
+	std::shared_ptr<darkness_counts const> page_analysis::darkness(::cil::CImg<unsigned char> const& img,unsigned int limit)
+	{
+		//a different buffer means a process replaced the image without the list noticing
+		if(!matches(img))
+		{
+			invalidate();
+			_data=img._data;
+			_width=img._width;
+			_height=img._height;
+			_spectrum=img._spectrum;
+		}
+		for(auto const& counts:_darkness)
+		{
+			if(counts->limit==limit)
+			{
+				return counts;
+			}
+		}
+		_darkness.push_back(std::make_shared<darkness_counts const>(count_darkness(img,limit)));
+		return _darkness.back();
+	}
+
+	page_analysis::scope::scope():_previous(_current)
+	{
+		_current=&_analysis;
+	}
+
+	page_analysis::scope::~scope()
+	{
+		_current=_previous;
+	}
+
+	void page_analysis::scope::invalidate()
+	{
+		_analysis.invalidate();
+	}
+
+	std::shared_ptr<darkness_counts const> page_darkness(::cil::CImg<unsigned char> const& img,unsigned int limit)
+	{
+		if(auto const analysis=page_analysis::current())
+		{
+			return analysis->darkness(img,limit);
+		}
+		return std::make_shared<darkness_counts const>(count_darkness(img,limit));
+	}
+}
@@ -0,0 +1,127 @@
+/*
+Copyright(C) 2017-2018 Edward Xie
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef PAGE_ANALYSIS_H
+#define PAGE_ANALYSIS_H
+#include "CImg.h"
+#include "ImageUtils.h"
+#include <memory>
+#include <vector>
+namespace ScoreProcessor {
+	/*
+		Number of dark pixels in each row and column of a page.
+		A pixel is dark if its value (gray images) or the sum of its first three channels (color images) is less than limit.
+	*/
+	struct darkness_counts {
+		unsigned int limit;
+		std::vector<unsigned int> rows;
+		std::vector<unsigned int> columns;
+	};
+
+	/*
+		Counts the dark pixels of every row and column in one pass over the image.
+	*/
+	darkness_counts count_darkness(::cil::CImg<unsigned char> const& img,unsigned int limit);
+
+	/*
+		Returns the first column, from the left, by which at least tolerance dark pixels have been seen.
+		Returns the last column if there are not enough.
+	*/
+	unsigned int find_left(darkness_counts const& counts,unsigned int tolerance);
+	/*
+		Returns the first column, from the right, by which at least tolerance dark pixels have been seen.
+		Returns 0 if there are not enough.
+	*/
+	unsigned int find_right(darkness_counts const& counts,unsigned int tolerance);
+	/*
+		Returns the first row, from the top, by which at least tolerance dark pixels have been seen.
+		Returns the last row if there are not enough.
+	*/
+	unsigned int find_top(darkness_counts const& counts,unsigned int tolerance);
+	/*
+		Returns the first row, from the bottom, by which at least tolerance dark pixels have been seen.
+		Returns 0 if there are not enough.
+	*/
+	unsigned int find_bottom(darkness_counts const& counts,unsigned int tolerance);
+
+	/*
+		Outermost dark pixels of each row and column of a page, using the same meaning of dark as darkness_counts.
+		Rows without any have left equal to the width and right equal to 0,
+		and columns without any have top equal to the height and bottom equal to 0.
+	*/
+	struct edge_profiles {
+		unsigned int limit;
+		std::vector<unsigned int> left;
+		std::vector<unsigned int> right;
+		std::vector<unsigned int> top;
+		std::vector<unsigned int> bottom;
+	};
+
+	/*
+		Finds the edges of every row and column in one row-major pass over the image.
+		Runs of 16 pixels with nothing dark are rejected with a single comparison when SSE2 is available.
+	*/
+	edge_profiles profile_edges(::cil::CImg<unsigned char> const& img,unsigned int limit);
+	/*
+		Same as above, but only looks at the pixels inside region, whose right and bottom are exclusive.
+		Rows and columns outside of it are reported as having no dark pixels.
+	*/
+	edge_profiles profile_edges(::cil::CImg<unsigned char> const& img,unsigned int limit,ImageUtils::Rectangle<unsigned int> region);
+
+	/*
+		Caches analyses of the page the current thread is processing,
+		so consecutive processes that look for the same boundaries only scan the page once.
+		ProcessList opens a scope for each page and invalidates it whenever a process reports a modification.
+	*/
+	class page_analysis {
+		unsigned char const* _data;
+		unsigned int _width,_height,_spectrum;
+		//shared so counts already handed out outlive invalidation
+		std::vector<std::shared_ptr<darkness_counts const>> _darkness;
+		static thread_local page_analysis* _current;
+		bool matches(::cil::CImg<unsigned char> const& img) const;
+	public:
+		class scope;
+		page_analysis();
+		/*
+			The cache of the innermost open scope, or nullptr if there is none.
+		*/
+		static page_analysis* current();
+		void invalidate();
+		std::shared_ptr<darkness_counts const> darkness(::cil::CImg<unsigned char> const& img,unsigned int limit);
+	};
+
+	/*
+		Makes a cache current for this thread for as long as the scope lives.
+	*/
+	class page_analysis::scope {
+		page_analysis _analysis;
+		page_analysis* _previous;
+	public:
+		scope();
+		~scope();
+		scope(scope const&)=delete;
+		scope& operator=(scope const&)=delete;
+		void invalidate();
+	};
+
+	/*
+		Darkness counts of the image, from the current page cache if one is open.
+		Without one, they are counted afresh and owned only by the caller.
+	*/
+	std::shared_ptr<darkness_counts const> page_darkness(::cil::CImg<unsigned char> const& img,unsigned int limit);
+}
+#endif
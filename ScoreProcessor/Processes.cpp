@@ -45,6 +45,21 @@ namespace ScoreProcessor {
 		}
 	}
 
+	bool FilterGray::compose(lut_set& luts, unsigned int spectrum) const
+	{
+		if(spectrum >= 3)
+		{
+			return false;
+		}
+		//replace_range covers every channel of a gray image, alpha included
+		for(unsigned int s = 0; s < spectrum; ++s)
+		{
+			auto table = lut_image(luts[s]);
+			replace_range(table, min, max, replacer);
+		}
+		return true;
+	}
+
 	bool FilterHSV::process(Img& img) const
 	{
 		if(img._spectrum >= 3)
@@ -113,19 +128,24 @@ namespace ScoreProcessor {
 		{
 			region.right--;
 			region.bottom--;
-			img = get_crop_fill(img, region, unsigned char(255));
+			img = get_crop_fill(img, region, static_cast<unsigned char>(255));
 		}
 		return true;
 	}
 
 	bool Rescale::process(Img& img) const
 	{
-		img.resize(
-			static_cast<unsigned int>(std::round(img._width * val)),
-			static_cast<unsigned int>(std::round(img._height * val)),
-			img._depth,
-			img._spectrum,
-			interpolation);
+		resize_request request;
+		requested_resize(img._width, img._height, request);
+		img.resize(request.width, request.height, img._depth, img._spectrum, request.interpolation);
+		return true;
+	}
+
+	bool Rescale::requested_resize(unsigned int width, unsigned int height, resize_request& request) const
+	{
+		request.width = static_cast<unsigned int>(std::round(width * val));
+		request.height = static_cast<unsigned int>(std::round(height * val));
+		request.interpolation = interpolation;
 		return true;
 	}
 
@@ -251,8 +271,21 @@ namespace ScoreProcessor {
 		else
 		{
 			rescale_colors(img, min, mid, max);
-			rescale_colors(img.get_shared_channel(1), min, mid, max);
-			rescale_colors(img.get_shared_channel(2), min, mid, max);
+			auto green = img.get_shared_channel(1);
+			auto blue = img.get_shared_channel(2);
+			rescale_colors(green, min, mid, max);
+			rescale_colors(blue, min, mid, max);
+		}
+		return true;
+	}
+
+	bool RescaleGray::compose(lut_set& luts, unsigned int spectrum) const
+	{
+		auto const layers = spectrum < 3 ? 1U : 3U;
+		for(unsigned int s = 0; s < layers; ++s)
+		{
+			auto table = lut_image(luts[s]);
+			rescale_colors(table, min, mid, max);
 		}
 		return true;
 	}
@@ -396,6 +429,17 @@ namespace ScoreProcessor {
 		return true;
 	}
 
+	bool Gamma::compose(lut_set& luts, unsigned int spectrum) const
+	{
+		auto const layers = spectrum < 3 ? 1U : 3U;
+		for(unsigned int s = 0; s < layers; ++s)
+		{
+			auto table = lut_image(luts[s]);
+			apply_gamma(table, gamma);
+		}
+		return true;
+	}
+
 	bool HorizontalShift::process(Img& img) const
 	{
 		horizontal_shift(img, side, direction, background_threshold);
@@ -410,6 +454,18 @@ namespace ScoreProcessor {
 
 
 	bool RescaleAbsolute::process(Img& img) const
+	{
+		resize_request request;
+		requested_resize(img._width, img._height, request);
+		if(request.width != img._width || request.height != img._height)
+		{
+			img.resize(request.width, request.height, img._depth, img._spectrum, request.interpolation);
+			return true;
+		}
+		return false;
+	}
+
+	bool RescaleAbsolute::requested_resize(unsigned int img_width, unsigned int img_height, resize_request& request) const
 	{
 		constexpr unsigned int interpolate = -1;
 		unsigned int true_width, true_height;
@@ -423,7 +479,7 @@ namespace ScoreProcessor {
 			float true_ratio;
 			if(ratio < 0)
 			{
-				true_ratio = static_cast<double>(img.width()) / img.height();
+				true_ratio = static_cast<double>(img_width) / img_height;
 			}
 			else
 			{
@@ -443,18 +499,16 @@ namespace ScoreProcessor {
 		Rescale::rescale_mode true_mode;
 		if(mode == Rescale::automatic)
 		{
-			true_mode = (true_height < img._height || true_width < img._width) ? Rescale::moving_average : Rescale::cubic;
+			true_mode = (true_height < img_height || true_width < img_width) ? Rescale::moving_average : Rescale::cubic;
 		}
 		else
 		{
 			true_mode = mode;
 		}
-		if(true_width != img._width || true_height != img._height)
-		{
-			img.resize(true_width, true_height, img._depth, img._spectrum, true_mode);
-			return true;
-		}
-		return false;
+		request.width = true_width;
+		request.height = true_height;
+		request.interpolation = true_mode;
+		return true;
 	}
 
 	bool ChangeCanvasSize::process(Img& img) const
@@ -724,7 +778,7 @@ namespace ScoreProcessor {
 
 	bool VertCompress::process(Img& img) const
 	{
-		return compress_vertical(img, background_threshold, min_vert_space, min_horiz_space, min_horizontal_protection, max_vertical_protection, 0);
+		return compress_vertical(img, background_threshold, min_vert_space, min_horiz_space, min_horizontal_protection, max_vertical_protection, 0, ThreadOverride::num_threads());
 	}
 
 	bool ResizeToBound::process(Img& img) const
@@ -741,12 +795,12 @@ namespace ScoreProcessor {
 			unsigned int new_width;
 			if(needed_ratio < img_ratio)
 			{
-				new_height = unsigned int(width / img_ratio);
+				new_height = static_cast<unsigned int>(width / img_ratio);
 				new_width = width;
 			}
 			else
 			{
-				new_width = unsigned int(img_ratio * height);
+				new_width = static_cast<unsigned int>(img_ratio * height);
 				new_height = height;
 			}
 			if(gamma != 1)
@@ -800,8 +854,8 @@ namespace ScoreProcessor {
 			}
 		}
 		auto const rescale_ratio = float(_widen_to) / float(largest_bbox.width());
-		auto const new_width = unsigned int(std::round(rescale_ratio * img._width));
-		auto const new_height = unsigned int(std::round(rescale_ratio * img._height));
+		auto const new_width = static_cast<unsigned int>(std::round(rescale_ratio * img._width));
+		auto const new_height = static_cast<unsigned int>(std::round(rescale_ratio * img._height));
 		if(new_width != img._width || new_height != img._height)
 		{
 			apply_gamma(img, _gamma);
@@ -836,6 +890,19 @@ namespace ScoreProcessor {
 		return true;
 	}
 
+	bool Invert::compose(lut_set& luts, unsigned int spectrum) const
+	{
+		auto const layers = spectrum < 3 ? 1U : 3U;
+		for(unsigned int s = 0; s < layers; ++s)
+		{
+			for(auto& value : luts[s])
+			{
+				value = ~value;
+			}
+		}
+		return true;
+	}
+
 	bool WhiteToTransparent::process(Img& img) const
 	{
 		switch(img._spectrum)
@@ -980,98 +1047,59 @@ namespace ScoreProcessor {
 
 	bool NormalizeBrightness::process(Img& img) const
 	{
-		std::vector<unsigned char> good_pixels;
-		if (_select_lower_bound == 0)
+		std::array<std::size_t, 256> histogram{};
+		auto const size = std::size_t(img._width) * img._height;
+		auto const data = img._data;
+		switch (img._spectrum)
 		{
-			switch (img._spectrum)
-			{
-			case 1:
-			case 2:
-				std::copy_if(img.begin(), img.end(), std::back_inserter(good_pixels), [this](unsigned char value)
-							 {
-								 return value <= _select_upper_bound;
-							 });
-					break;
-			case 3:
-			case 4:
+		case 1:
+		case 2:
+			for (std::size_t i = 0; i < size; ++i)
 			{
-				auto const size = std::size_t(img._width) * img._height;
-				auto const data = img._data;
-				for (std::size_t i = 0; i < size; ++i)
-				{
-					auto const brightness = ImageUtils::brightness({ data[i], data[i + size], data[i + size * 2] });
-					if (brightness <= _select_upper_bound)
-					{
-						good_pixels.push_back(brightness);
-					}
-				}
-				break;
+				++histogram[data[i]];
 			}
-			default:
-				return false;
+			break;
+		case 3:
+		case 4:
+			for (std::size_t i = 0; i < size; ++i)
+			{
+				++histogram[ImageUtils::brightness({ data[i], data[i + size], data[i + size * 2] })];
 			}
+			break;
+		default:
+			return false;
 		}
-		else
+		std::size_t selected = 0;
+		for (unsigned int i = _select_lower_bound; i <= _select_upper_bound; ++i)
 		{
-			switch (img._spectrum)
-			{
-			case 1:
-			case 2:
-			{
-				std::copy_if(img.begin(), img.end(), std::back_inserter(good_pixels), [this](unsigned char value)
-							 {
-								 return value <= _select_upper_bound && value >= _select_lower_bound;
-							 });
-				break;
-			}
-			case 3:
-			case 4:
-			{
-				auto const size = std::size_t(img._width) * img._height;
-				auto const data = img._data;
-				for (std::size_t i = 0; i < size; ++i)
-				{
-					auto const brightness = ImageUtils::brightness({ data[i], data[i + size], data[i + size * 2] });
-					if (brightness <= _select_upper_bound && brightness >= _select_lower_bound)
-					{
-						good_pixels.push_back(brightness);
-					}
-				}
-				break;
-			}
-			default:
-				return false;
-			}
+			selected += histogram[i];
 		}
-		if (good_pixels.empty())
+		if (selected == 0)
 		{
 			return false;
 		}
-		auto const median_iterator = good_pixels.begin() + good_pixels.size() / 2;
-		std::nth_element(good_pixels.begin(), median_iterator, good_pixels.end());
-		auto const median = *median_iterator;
+		//same element nth_element would place at selected/2
+		auto const target = selected / 2;
+		unsigned int median = _select_lower_bound;
+		for (std::size_t count = histogram[median]; count <= target; count += histogram[median])
+		{
+			++median;
+		}
 		auto const offset = _median - int(median);
-		auto const img_data = img._data;
-		auto const img_data_end = [&img]()
+		std::array<unsigned char, 256> lut;
+		for (unsigned int i = 0; i < lut.size(); ++i)
 		{
-			switch (img._spectrum)
+			if (i >= _select_lower_bound && i <= _select_upper_bound)
 			{
-			case 1:
-			case 2:
-				return img._data + img._width * std::size_t(img._height);
-			default:
-				return img._data + img._width * std::size_t(img._height) * 3;
+				lut[i] = exlib::clamp<unsigned char>(int(i) + offset);
 			}
-		}();
-		for (auto it = img_data; it != img_data_end; ++it)
-		{
-			if (*it >= _select_lower_bound && *it <= _select_upper_bound)
+			else
 			{
-				auto const value = *it + offset;
-				*it = exlib::clamp<unsigned char>(value);
+				lut[i] = i;
 			}
 		}
-		return true;
+		auto const layers = img._spectrum < 3 ? 1U : 3U;
+		return cil::apply_lut(data, data + size * layers, lut);
 	}
 
 	template<typename T>
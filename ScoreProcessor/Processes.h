@@ -10,6 +10,10 @@ namespace ScoreProcessor {
 	class ChangeToGrayscale:public ImageProcess<> {
 	public:
 		bool process(Img& img) const override;
+		bool discards_color() const override
+		{
+			return true;
+		}
 	};
 
 	class FillTransparency:public ImageProcess<> {
@@ -30,7 +34,7 @@ namespace ScoreProcessor {
 		bool process(Img& img) const override;
 	};
 
-	class FilterGray:public ImageProcess<> {
+	class FilterGray:public ToneMapProcess {
 		unsigned char min;
 		unsigned char max;
 		unsigned char replacer;
@@ -38,6 +42,7 @@ namespace ScoreProcessor {
 		inline FilterGray(unsigned char min,unsigned char max,unsigned char replacer):min(min),max(max),replacer(replacer)
 		{}
 		bool process(Img& img) const override;
+		bool compose(lut_set& luts,unsigned int spectrum) const override;
 	};
 
 	class FilterHSV:public ImageProcess<> {
@@ -141,11 +146,16 @@ namespace ScoreProcessor {
 			interpolation(interpolation==automatic?(val>1?cubic:moving_average):interpolation)
 		{}
 		bool process(Img& img) const override;
+		bool requested_resize(unsigned int width,unsigned int height,resize_request& request) const override;
 	};
 
 	class ExtractLayer0NoRealloc:public ImageProcess<> {
 	public:
 		bool process(Img& img) const override;
+		bool discards_color() const override
+		{
+			return true;
+		}
 	};
 
 	/*
@@ -175,12 +185,13 @@ namespace ScoreProcessor {
 		bool process(Img& img) const override;
 	};
 
-	class RescaleGray:public ImageProcess<> {
+	class RescaleGray:public ToneMapProcess {
 		unsigned char min,mid,max;
 	public:
 		inline RescaleGray(unsigned char min,unsigned char mid,unsigned char max=255):min(min),mid(mid),max(max)
 		{}
 		bool process(Img& img) const override;
+		bool compose(lut_set& luts,unsigned int spectrum) const override;
 	};
 
 	class FillRectangle:public ImageProcess<> {
@@ -243,12 +254,13 @@ namespace ScoreProcessor {
 		bool process(Img& img) const override;
 	};
 
-	class Gamma:public ImageProcess<> {
+	class Gamma:public ToneMapProcess {
 		float gamma;
 	public:
 		inline Gamma(float g):gamma(g)
 		{}
 		bool process(Img& img) const override;
+		bool compose(lut_set& luts,unsigned int spectrum) const override;
 	};
 
 	class ThreadOverride:public ImageProcess<> {
@@ -291,6 +303,7 @@ namespace ScoreProcessor {
 	public:
 		RescaleAbsolute(unsigned int width,unsigned int height,float ratio,Rescale::rescale_mode mode):width{width},height{height},ratio{ratio},mode{mode}{}
 		bool process(Img&) const override;
+		bool requested_resize(unsigned int width,unsigned int height,resize_request& request) const override;
 	};
 
 	class ChangeCanvasSize:public ImageProcess<> {
@@ -315,8 +328,14 @@ namespace ScoreProcessor {
 		ScoreProcessor::neural_scaler scaler;
 		float ratio;
 	public:
-		inline NeuralScale(float ratio,char const* network,unsigned int const* num_threads):ratio(ratio),scaler(network),ThreadOverride(num_threads)
-		{}
+		//a batch_size of 0 keeps the scaler's default
+		inline NeuralScale(float ratio,char const* network,unsigned int const* num_threads,unsigned int batch_size=0):ratio(ratio),scaler(network),ThreadOverride(num_threads)
+		{
+			if(batch_size)
+			{
+				scaler.batch_size(batch_size);
+			}
+		}
 		bool process(Img&) const override;
 	};
 
@@ -356,14 +375,14 @@ namespace ScoreProcessor {
 			return down;
 		}
 	public:
-		SlidingTemplateMatchEraseExact(decltype(tmplts) the_tmplts,unsigned int downscaling,float threshold,decltype(replacer) replacer,decltype(offsets) off,decltype(origin) or):
+		SlidingTemplateMatchEraseExact(decltype(tmplts) the_tmplts,unsigned int downscaling,float threshold,decltype(replacer) replacer,decltype(offsets) off,decltype(origin) orig):
 			tmplts(std::move(the_tmplts)),
 			downscaling{downscaling},
 			threshold{threshold},
 			downsized_tmplts(get_downsized(tmplts,downscaling)),
 			replacer{std::move(replacer)},
 			offsets{off},
-			origin{or}
+			origin{orig}
 		{
 		}
 		bool process(Img&) const override;
@@ -442,14 +461,15 @@ namespace ScoreProcessor {
 		bool process(Img&) const override;
 	 };
 
-	class VertCompress:public ImageProcess<> {
+	class VertCompress:public ThreadOverride {
 		unsigned int min_vert_space;
 		unsigned int min_horiz_space;
 		unsigned int min_horizontal_protection;
 		unsigned int max_vertical_protection;
 		unsigned char background_threshold;
 	public:
-		VertCompress(unsigned int min_vert_space,unsigned int min_horiz_space,unsigned int min_horiz_prot,unsigned int max_vert_prot,unsigned char bt):
+		VertCompress(unsigned int min_vert_space,unsigned int min_horiz_space,unsigned int min_horiz_prot,unsigned int max_vert_prot,unsigned char bt,unsigned int const* num_threads):
+			ThreadOverride(num_threads),
 			min_vert_space{min_vert_space},
 			min_horiz_space{min_horiz_space==-1?min_vert_space:min_horiz_space},
 			min_horizontal_protection{min_horiz_prot},
@@ -492,10 +512,11 @@ namespace ScoreProcessor {
 		bool process(Img&) const override;
 	};
 
-	class Invert:public ImageProcess<> {
+	class Invert:public ToneMapProcess {
 	public:
 		Invert() {}
 		bool process(Img&) const override;
+		bool compose(lut_set& luts,unsigned int spectrum) const override;
 	};
 
 	class WhiteToTransparent:public ImageProcess<> {
@@ -31,9 +31,12 @@ along with this program. If not, see <https://www.gnu.org/licenses/>.
 #include "lib/exstring/exmath.h"
 #include "lib/exstring/exalg.h"
 #include <atomic>
+#include <cstdint>
 #include <mutex>
 #include "lib/threadpool/thread_pool.h"
 #include <numeric>
+#include <optional>
+#include "PageAnalysis.h"
 using namespace std;
 using namespace ImageUtils;
 using namespace cimg_library;
@@ -146,7 +149,54 @@ namespace ScoreProcessor {
 		return changed;
 	}
 
-	bool compress_vertical(cil::CImg<unsigned char>& img,unsigned char background_threshold,unsigned int min_vert_space,unsigned int min_horiz_space,unsigned int min_horiz_protection,unsigned int max_vert_protection,unsigned int optimal_height)
+	/*
+		One bit per pixel of the compress_vertical path map, set where a path may still pass.
+		Bits are updated atomically so traces in separate bands can share a word.
+		Each row has a closed bit on either side so scans stepping off the row stop there.
+	*/
+	class path_bits {
+	public:
+		using word=std::atomic<std::uint64_t>;
+	private:
+		std::unique_ptr<word[]> _words;
+		std::size_t _row_words=0;
+	public:
+		void resize(unsigned int width,unsigned int height)
+		{
+			_row_words=(std::size_t(width)+2+63)/64;
+			auto const count=_row_words*height;
+			_words.reset(new word[count]);
+			for(std::size_t i=0;i<count;++i)
+			{
+				_words[i].store(0,std::memory_order_relaxed);
+			}
+		}
+		std::size_t row_words() const
+		{
+			return _row_words;
+		}
+		word* row(unsigned int y) const
+		{
+			return _words.get()+y*_row_words;
+		}
+		static bool test(word const* row,int x)
+		{
+			auto const i=static_cast<unsigned int>(x+1);
+			return (row[i/64].load(std::memory_order_relaxed)>>(i%64))&1;
+		}
+		static void set(word* row,int x)
+		{
+			auto const i=static_cast<unsigned int>(x+1);
+			row[i/64].fetch_or(std::uint64_t(1)<<(i%64),std::memory_order_relaxed);
+		}
+		static void reset(word* row,int x)
+		{
+			auto const i=static_cast<unsigned int>(x+1);
+			row[i/64].fetch_and(~(std::uint64_t(1)<<(i%64)),std::memory_order_relaxed);
+		}
+	};
+
+	bool compress_vertical(cil::CImg<unsigned char>& img,unsigned char background_threshold,unsigned int min_vert_space,unsigned int min_horiz_space,unsigned int min_horiz_protection,unsigned int max_vert_protection,unsigned int optimal_height,unsigned int num_threads)
 	{
 		using count_t=short;
 		constexpr auto dim_lim=std::numeric_limits<count_t>::max();
@@ -157,10 +207,40 @@ namespace ScoreProcessor {
 		enum safety {
 			safe=-1,
 			unsafe=0,
-			candidate_path_mark,
-			real_path_mark,
 		};
-		cil::CImg<char> safe_points;
+		//bands of the path map are independent, as are the rows and columns the safe points are fattened along
+		//they are spread over the shared pool, unless pages are already being processed in parallel
+		std::optional<ExclusiveThreadPool> exclusive;
+		if(num_threads>1)
+		{
+			exclusive.emplace(num_threads);
+			exclusive->set_thread_count(num_threads);
+		}
+		exlib::thread_pool* const pool=exclusive?&exclusive->pool():nullptr;
+		auto const parallel_for=[pool](unsigned int count,auto const& func)
+		{
+			if(!pool)
+			{
+				func(0U,count);
+				return;
+			}
+			auto const chunks=std::min<std::size_t>(count,pool->num_threads()*4);
+			for(std::size_t c=0;c<chunks;++c)
+			{
+				unsigned int const begin=static_cast<unsigned int>(count*c/chunks);
+				unsigned int const end=static_cast<unsigned int>(count*(c+1)/chunks);
+				pool->push_back([&func,begin,end]() noexcept
+				{
+					func(begin,end);
+				});
+			}
+			pool->wait();
+		};
+		// set where a path may pass (unsafe and not yet visited)
+		path_bits open_points;
+		// set where a finished path passes
+		path_bits removed_points;
+		unsigned int map_width,map_height;
 		{
 			auto const clusters=[&img,background_threshold]()
 			{
@@ -343,55 +423,68 @@ namespace ScoreProcessor {
 					auto const tail_space_d=size_t{tail_space}*path_counts._width;
 					std::memset(path_counts.end()-tail_space_d,-1,tail_space_d*sizeof(count_t));
 				}
-				auto const statuses=path_counts_raw.data();
-				for(unsigned int y=0;y<path_counts._height;++y)
+				parallel_for(path_counts._height,[&](unsigned int begin,unsigned int end)
 				{
-					exlib::get_fatten(&path_counts(0,y),&path_counts(0,y+1),min_horiz_space-min_horiz_space/2,&safe_points_raw(0,y));
-				}
-				{
-					//decltype(safe_points_raw) layer0(safe_points_raw,true);
-					//layer0._spectrum=1;
-					//layer0.display();
-				}
+					for(unsigned int y=begin;y<end;++y)
+					{
+						exlib::get_fatten(&path_counts(0,y),&path_counts(0,y+1),min_horiz_space-min_horiz_space/2,&safe_points_raw(0,y));
+					}
+				});
 				safe_points_raw.rotate(-90); // for cache coherency
-				safe_points.resize(path_counts._height,path_counts._width);
-				for(unsigned int x=0;x<path_counts._width;++x)
-				{
-					auto const begin=&safe_points_raw(0,x);
-					exlib::get_fatten(begin,begin+path_counts._height,head_space,&safe_points(0,x));
-				}
+				map_width=path_counts._height;
+				map_height=path_counts._width;
+				open_points.resize(map_width,map_height);
+				removed_points.resize(map_width,map_height);
+				parallel_for(map_height,[&](unsigned int begin,unsigned int end)
+				{
+					std::vector<char> fattened(map_width);
+					std::vector<std::uint64_t> bits(open_points.row_words());
+					for(unsigned int x=begin;x<end;++x)
+					{
+						auto const raw=&safe_points_raw(0,x);
+						exlib::get_fatten(raw,raw+map_width,head_space,fattened.begin());
+						std::fill(bits.begin(),bits.end(),0);
+						for(unsigned int i=0;i<map_width;++i)
+						{
+							bits[(i+1)/64]|=std::uint64_t(fattened[i]==unsafe)<<((i+1)%64);
+						}
+						auto const row=open_points.row(x);
+						for(std::size_t w=0;w<bits.size();++w)
+						{
+							row[w].store(bits[w],std::memory_order_relaxed);
+						}
+					}
+				});
 			}
 		}
 		//std::cout<<"Min space protection\n";
 		//safe_points.display();
 		{
 			// hug left path tracer
-			auto const width=count_t(safe_points._width);
-			auto const height=count_t(safe_points._height);
+			auto const width=count_t(map_width);
+			auto const height=count_t(map_height);
 			auto const last_row=height-1;
-			//std::vector<count_t> path(safe_points._height);
-			std::unique_ptr<count_t[]> path(new count_t[safe_points._height]);
-			auto trace_path_down=[&safe_points,&path,width,height,last_row](count_t x)
+			auto trace_path_down=[&open_points,&removed_points,last_row](count_t x,count_t* path)
 			{
 				{
-					auto& start=safe_points(x,0);
-					if(start!=unsafe)
+					auto const start=open_points.row(0);
+					if(!path_bits::test(start,x))
 					{
 						return;
 					}
-					start=candidate_path_mark;
+					path_bits::reset(start,x);
 				}
 				path[0]=x;
 				decltype(x) y=0;
 				while(true)
 				{
 					count_t furthest_left=x;
-					auto const current_row=&safe_points(0,y);
-					auto const next_row=current_row+safe_points._width;
+					auto const current_row=open_points.row(y);
+					auto const next_row=open_points.row(y+1);
 					for(;;)
 					{
 						auto const cand=furthest_left-1;
-						if(current_row[cand]!=unsafe)
+						if(!path_bits::test(current_row,cand))
 						{
 							break;
 						}
@@ -401,8 +494,7 @@ namespace ScoreProcessor {
 						bool found_in_left=false;
 						for(;furthest_left<=x;++furthest_left)
 						{
-							auto const pix=next_row[furthest_left];
-							if(pix==unsafe)
+							if(path_bits::test(next_row,furthest_left))
 							{
 								found_in_left=true;
 								break;
@@ -412,14 +504,15 @@ namespace ScoreProcessor {
 						{
 							for(;;++furthest_left)
 							{
-								auto const level_pix=current_row[furthest_left];
-								if(level_pix!=unsafe)
+								if(!path_bits::test(current_row,furthest_left))
 								{
-									std::fill(current_row+x+1,current_row+furthest_left,candidate_path_mark);
+									for(auto f=x+1;f<furthest_left;++f)
+									{
+										path_bits::reset(current_row,f);
+									}
 									return;
 								}
-								auto const next_pix=next_row[furthest_left];
-								if(next_pix==unsafe)
+								if(path_bits::test(next_row,furthest_left))
 								{
 									break;
 								}
@@ -429,55 +522,103 @@ namespace ScoreProcessor {
 					for(;;)
 					{
 						auto const cand=furthest_left-1;
-						if(next_row[cand]!=unsafe)
+						if(!path_bits::test(next_row,cand))
 						{
 							break;
 						}
 						furthest_left=cand;
 					}
 					++y;
-					next_row[furthest_left]=candidate_path_mark;
+					path_bits::reset(next_row,furthest_left);
 					path[y]=furthest_left;
 					if(y==last_row)
 					{
-						for(count_t r=0;r<safe_points._height;++r)
+						for(count_t r=0;r<=last_row;++r)
 						{
-							safe_points(path[r],r)=real_path_mark;
+							path_bits::set(removed_points.row(r),path[r]);
 						}
 						break;
 					}
 					x=furthest_left;
 				}
 			};
-			for(count_t x_top=0;x_top<width;++x_top)
+			// a trace only moves through open points, so columns closed in every row split the map into bands
+			// that can be traced independently, each in the same order as a serial trace
+			std::vector<std::uint64_t> any_open(open_points.row_words());
+			for(count_t y=0;y<height;++y)
+			{
+				auto const row=open_points.row(y);
+				for(std::size_t w=0;w<any_open.size();++w)
+				{
+					any_open[w]|=row[w].load(std::memory_order_relaxed);
+				}
+			}
+			auto const is_barrier=[&any_open](count_t x)
+			{
+				auto const i=static_cast<unsigned int>(x+1);
+				return !((any_open[i/64]>>(i%64))&1);
+			};
+			std::vector<std::pair<count_t,count_t>> bands;
 			{
-				trace_path_down(x_top);
-				if(x_top%100==0)
+				count_t const target=pool?std::max(1,width/int(pool->num_threads()*4)):width;
+				count_t begin=0;
+				for(count_t x=1;x<width;++x)
 				{
-					//safe_points.display();
+					if(x-begin>=target&&is_barrier(x))
+					{
+						bands.push_back({begin,x});
+						begin=x;
+					}
 				}
+				bands.push_back({begin,width});
+			}
+			auto const trace_band=[&trace_path_down,height](std::pair<count_t,count_t> band) noexcept
+			{
+				std::unique_ptr<count_t[]> path(new count_t[height]);
+				for(count_t x_top=band.first;x_top<band.second;++x_top)
+				{
+					trace_path_down(x_top,path.get());
+				}
+			};
+			if(!pool)
+			{
+				trace_band(bands.front());
+			}
+			else
+			{
+				for(auto const band:bands)
+				{
+					pool->push_back([&trace_band,band]() noexcept
+					{
+						trace_band(band);
+					});
+				}
+				pool->wait();
 			}
-			//safe_points.display();
 		}
 		img.rotate(-90);
 		//img.display();
-		unsigned int new_width=0;
-		for(unsigned int y=0;y<img._height;++y)
+		std::vector<unsigned int> widths(img._height);
+		parallel_for(img._height,[&](unsigned int begin,unsigned int end)
 		{
-			auto* img_row=&img(0,y);
-			auto const* safe_row=&safe_points(0,y);
-			unsigned int write_head=0;
-			auto const width=img._width;
-			for(unsigned int read_head=0;read_head<width;++read_head)
+			for(unsigned int y=begin;y<end;++y)
 			{
-				if(safe_row[read_head]!=real_path_mark)
+				auto* img_row=&img(0,y);
+				auto const removed_row=removed_points.row(y);
+				unsigned int write_head=0;
+				auto const width=img._width;
+				for(unsigned int read_head=0;read_head<width;++read_head)
 				{
-					img_row[write_head]=img_row[read_head];
-					++write_head;
+					if(!path_bits::test(removed_row,read_head))
+					{
+						img_row[write_head]=img_row[read_head];
+						++write_head;
+					}
 				}
+				widths[y]=write_head;
 			}
-			new_width=std::max(new_width,write_head);
-		}
+		});
+		unsigned int const new_width=*std::max_element(widths.begin(),widths.end());
 		img.crop(0,new_width-1);
 		//img.display();
 		img.rotate(90);
@@ -840,8 +981,10 @@ namespace ScoreProcessor {
 		}
 		else
 		{
-			left=find_left(image,Grayscale::WHITE,tolerance);
-			right=find_right(image,Grayscale::WHITE,tolerance);
+			//gray_diff from white is over 0.5 exactly for values under 75
+			auto const counts=page_darkness(image,75);
+			left=find_left(*counts,tolerance+1);
+			right=find_right(*counts,tolerance+1);
 		}
 
 		unsigned int center=image._width/2;
@@ -966,8 +1109,10 @@ namespace ScoreProcessor {
 		}
 		else
 		{
-			top=find_top(image,Grayscale::WHITE,tolerance);
-			bottom=find_bottom(image,Grayscale::WHITE,tolerance);
+			//gray_diff from white is over 0.5 exactly for values under 75
+			auto const counts=page_darkness(image,75);
+			top=find_top(*counts,tolerance+1);
+			bottom=find_bottom(*counts,tolerance+1);
 		}
 		unsigned int center=image._height/2;
 		int shift=static_cast<int>(center-((top+bottom)/2));
@@ -1106,22 +1251,21 @@ namespace ScoreProcessor {
 		}
 		return container;
 	}
+	//gray_diff is over 0.5 when the pixel is more than 180 darker than the background
+	unsigned int gray_edge_limit(Grayscale const background)
+	{
+		return background>180?background-180U:0U;
+	}
 	std::vector<unsigned int> build_left_profile(CImg<unsigned char> const& image,Grayscale const background)
 	{
 		assert(image._spectrum==1);
 		unsigned int limit=image._width/2;
+		//ink past the middle is clamped anyway, so only the left half is read
+		auto const edges=profile_edges(image,gray_edge_limit(background),{0,limit,0,image._height});
 		std::vector<unsigned int> container(image._height);
 		for(unsigned int y=0;y<image._height;++y)
 		{
-			container[y]=limit;
-			for(unsigned int x=0;x<limit;++x)
-			{
-				if(gray_diff(image(x,y),background)>0.5f)
-				{
-					container[y]=x;
-					break;
-				}
-			}
+			container[y]=std::min(edges.left[y],limit);
 		}
 		return container;
 	}
@@ -1152,101 +1296,54 @@ namespace ScoreProcessor {
 	{
 		assert(image._spectrum==1);
 		unsigned int limit=image._width/2;
+		auto const edges=profile_edges(image,gray_edge_limit(background),{limit,image._width,0,image._height});
 		std::vector<unsigned int> container(image._height);
-		container.resize(image._height);
 		for(unsigned int y=0;y<image._height;++y)
 		{
-			container[y]=limit;
-			for(unsigned int x=image._width-1;x>=limit;--x)
-			{
-				if(gray_diff(image(x,y),background)>0.5f)
-				{
-					container[y]=x;
-					break;
-				}
-			}
+			container[y]=std::max(edges.right[y],limit);
 		}
 		return container;
 	}
-	std::vector<unsigned int> build_top_profile(CImg<unsigned char> const& image,ColorRGB const background)
+	std::vector<unsigned int> top_profile(CImg<unsigned char> const& image,unsigned int dark_limit)
 	{
-		assert(image._spectrum==3||image._spectrum==4);
-		std::vector<unsigned int> container(image._width);
 		unsigned int limit=image._height/2;
-		unsigned int color=static_cast<unsigned int>(background.r)+background.g+background.b;
-		for(unsigned int x=0;x<image._width;++x)
+		//ink past the middle is clamped anyway, so only the top half is read
+		auto edges=profile_edges(image,dark_limit,{0,image._width,0,limit});
+		for(auto& top:edges.top)
 		{
-			container[x]=limit;
-			for(unsigned int y=0;y<limit;++y)
-			{
-				ColorRGB pixel={image(x,y,0),image(x,y,1),image(x,y,2)};
-				if(static_cast<unsigned int>(pixel.r)+pixel.g+pixel.b<=color)
-				{
-					container[x]=y;
-					break;
-				}
-			}
+			top=std::min(top,limit);
 		}
-		return container;
+		return std::move(edges.top);
 	}
-	std::vector<unsigned int> build_top_profile(CImg<unsigned char> const& image,Grayscale const background)
+	std::vector<unsigned int> bottom_profile(CImg<unsigned char> const& image,unsigned int dark_limit)
 	{
-		assert(image._spectrum==1);
-		std::vector<unsigned int> container(image._width);
 		unsigned int limit=image._height/2;
-		for(unsigned int x=0;x<image._width;++x)
+		auto edges=profile_edges(image,dark_limit,{0,image._width,limit,image._height});
+		for(auto& bottom:edges.bottom)
 		{
-			container[x]=limit;
-			for(unsigned int y=0;y<limit;++y)
-			{
-				if(image(x,y)<=background)
-				{
-					container[x]=y;
-					break;
-				}
-			}
+			bottom=std::max(bottom,limit);
 		}
-		return container;
+		return std::move(edges.bottom);
+	}
+	std::vector<unsigned int> build_top_profile(CImg<unsigned char> const& image,ColorRGB const background)
+	{
+		assert(image._spectrum==3||image._spectrum==4);
+		return top_profile(image,static_cast<unsigned int>(background.r)+background.g+background.b+1);
+	}
+	std::vector<unsigned int> build_top_profile(CImg<unsigned char> const& image,Grayscale const background)
+	{
+		assert(image._spectrum==1);
+		return top_profile(image,background+1U);
 	}
 	std::vector<unsigned int> build_bottom_profile(CImg<unsigned char> const& image,ColorRGB const background)
 	{
 		assert(image._spectrum==3||image._spectrum==4);
-		std::vector<unsigned int> container(image._width);
-		unsigned int color=static_cast<unsigned int>(background.r)+background.g+background.b;
-		unsigned int limit=image._height/2;
-		for(unsigned int x=0;x<image._width;++x)
-		{
-			container[x]=limit;
-			for(unsigned int y=image._height-1;y>=limit;--y)
-			{
-				ColorRGB pixel={image(x,y,0),image(x,y,1),image(x,y,2)};
-				if(static_cast<unsigned int>(pixel.r)+pixel.g+pixel.b<=color)
-				{
-					container[x]=y;
-					break;
-				}
-			}
-		}
-		return container;
+		return bottom_profile(image,static_cast<unsigned int>(background.r)+background.g+background.b+1);
 	}
 	std::vector<unsigned int> build_bottom_profile(CImg<unsigned char> const& image,Grayscale const background)
 	{
 		assert(image._spectrum==1);
-		std::vector<unsigned int> container(image._width);
-		unsigned int limit=image._height/2;
-		for(unsigned int x=0;x<image._width;++x)
-		{
-			container[x]=limit;
-			for(unsigned int y=image._height-1;y>limit;--y)
-			{
-				if(image(x,y)<background)
-				{
-					container[x]=y;
-					break;
-				}
-			}
-		}
-		return container;
+		return bottom_profile(image,background);
 	}
 
 	::cimg_library::CImg<float> create_vertical_energy(::cimg_library::CImg<unsigned char> const& refImage,float const vec,unsigned int min_vertical_space,unsigned char background);
@@ -1448,9 +1545,10 @@ namespace ScoreProcessor {
 			}
 		}
 	}
-	unsigned int cut_page(CImg<unsigned char> const& image,char const* filename,cut_heuristics const& ch,int quality)
+	//cuts the page and hands each piece to save with its number, counting from 1, or 0 if the page was left whole
+	template<typename Save>
+	unsigned int cut_page_pieces(CImg<unsigned char> const& image,cut_heuristics const& ch,Save save)
 	{
-		auto const support=validate_path(filename);
 		/*
 		bool isRGB;
 		switch(image._spectrum)
@@ -1518,7 +1616,7 @@ namespace ScoreProcessor {
 		}
 		if(paths.size()==0)
 		{
-			cil::save_image(image,filename,support,quality);
+			save(image,0);
 			return 1;
 		}
 		/*std::sort(paths.begin(),paths.end(),[](auto const& a,auto const& b)
@@ -1601,8 +1699,7 @@ namespace ScoreProcessor {
 					}
 				}
 			}
-			auto const save_name=cil::number_filename(filename,++num_images,3U);
-			cil::save_image(new_image,save_name.c_str(),support,quality);
+			save(new_image,++num_images);
 			bottom_of_old=highest_in_path;
 		}
 		CImg<unsigned char> new_image(image._width,image._height-bottom_of_old);
@@ -1620,11 +1717,35 @@ namespace ScoreProcessor {
 				new_image(x,y)=image(x,y+bottom_of_old);
 			}
 		}
-		auto const save_name=cil::number_filename(filename,++num_images,3U);
-		cil::save_image(new_image,save_name.c_str(),support,quality);
+		save(new_image,++num_images);
 		return num_images;
 	}
 
+	unsigned int cut_page(CImg<unsigned char> const& image,char const* filename,cut_heuristics const& ch,int quality)
+	{
+		auto const support=validate_path(filename);
+		return cut_page_pieces(image,ch,[=](CImg<unsigned char> const& piece,unsigned int number)
+		{
+			if(number==0)
+			{
+				cil::save_image(piece,filename,support,quality);
+			}
+			else
+			{
+				auto const save_name=cil::number_filename(filename,number,3U);
+				cil::save_image(piece,save_name.c_str(),support,quality);
+			}
+		});
+	}
+
+	unsigned int cut_page(CImg<unsigned char> const& image,cil::tiff_stack<unsigned char>& output,cut_heuristics const& ch)
+	{
+		return cut_page_pieces(image,ch,[&output](CImg<unsigned char> const& piece,unsigned int number)
+		{
+			output.add(number==0?0:number-1,piece);
+		});
+	}
+
 	float auto_rotate(CImg<unsigned char>& image,double pixel_prec,double min_angle,double max_angle,double angle_prec,unsigned char boundary)
 	{
 		assert(angle_prec>0);
@@ -1679,8 +1800,8 @@ namespace ScoreProcessor {
 				{
 					auto const ptop=&img(x,y);
 					auto const pbottom=&img(x,y+1);
-					auto const top=unsigned int(*ptop)+*(ptop+size)+*(ptop+2*size);
-					auto const bottom=unsigned int(*pbottom)+*(pbottom+size)+*(pbottom+2*size);
+					auto const top=static_cast<unsigned int>(*ptop)+*(ptop+size)+*(ptop+2*size);
+					auto const bottom=static_cast<unsigned int>(*pbottom)+*(pbottom+size)+*(pbottom+2*size);
 					return
 						//(top<=boundary&&bottom>boundary)||
 						(top>boundary&& bottom<=boundary);
@@ -1694,8 +1815,8 @@ namespace ScoreProcessor {
 				{
 					auto const ptop=&img(x,y);
 					auto const pbottom=&img(x+1,y);
-					auto const top=unsigned int(*ptop)+*(ptop+size)+*(ptop+2*size);
-					auto const bottom=unsigned int(*pbottom)+*(pbottom+size)+*(pbottom+2*size);
+					auto const top=static_cast<unsigned int>(*ptop)+*(ptop+size)+*(ptop+2*size);
+					auto const bottom=static_cast<unsigned int>(*pbottom)+*(pbottom+size)+*(pbottom+2*size);
 					return
 						//(top<=boundary&&bottom>boundary)||
 						(top>boundary&& bottom<=boundary);
@@ -1830,35 +1951,11 @@ namespace ScoreProcessor {
 	}
 	bool auto_padding(CImg<unsigned char>& image,unsigned int const vertical_padding,unsigned int const horizontal_padding_max,unsigned int const horizontal_padding_min,signed int horiz_offset,float optimal_ratio,unsigned int tolerance,unsigned char background)
 	{
-		unsigned int left,right,top,bottom;
-		switch(image._spectrum)
-		{
-		case 1:
-		case 2:
-		{
-			auto selector=[=](auto color)
-			{
-				return color[0]<background;
-			};
-			left=find_left<3>(image,tolerance,selector);
-			right=find_right<3>(image,tolerance,selector)+1;
-			top=find_top<3>(image,tolerance,selector);
-			bottom=find_bottom<3>(image,tolerance,selector)+1;
-			break;
-		}
-		default:
-		{
-			auto selector=[bg=3*float(background)](auto color)
-			{
-				return float(color[0])+color[1]+color[2]<bg;
-			};
-			left=find_left<3>(image,tolerance,selector);
-			right=find_right<3>(image,tolerance,selector)+1;
-			top=find_top<3>(image,tolerance,selector);
-			bottom=find_bottom<3>(image,tolerance,selector)+1;
-			break;
-		}
-		}
+		auto const counts=page_darkness(image,image._spectrum<3?background:3U*background);
+		unsigned int const left=find_left(*counts,tolerance);
+		unsigned int const right=find_right(*counts,tolerance)+1;
+		unsigned int const top=find_top(*counts,tolerance);
+		unsigned int const bottom=find_bottom(*counts,tolerance)+1;
 		if(left>right) return false;
 		if(top>bottom) return false;
 
@@ -1893,7 +1990,7 @@ namespace ScoreProcessor {
 		image=get_crop_fill(
 			image,
 			{x1,x2,y1,y2},
-			unsigned char(255)
+			static_cast<unsigned char>(255)
 		);
 		return true;
 	}
@@ -1903,30 +2000,18 @@ namespace ScoreProcessor {
 	}
 	bool horiz_padding(CImg<unsigned char>& image,unsigned int const left_pad,unsigned int const right_pad,unsigned int tolerance,unsigned char background)
 	{
-		signed int x1,x2;
-		switch(image._spectrum)
+		signed int x1=0,x2=image.width()-1;
+		if(left_pad!=-1||right_pad!=-1)
 		{
-		case 1:
-		case 2:
-		{
-			auto selector=[=](auto color)
+			auto const counts=page_darkness(image,image._spectrum<3?background+1U:3U*background+1U);
+			if(left_pad!=-1)
 			{
-				return color[0]<=background;
-			};
-			x1=left_pad==-1?0:find_left<1>(image,tolerance,selector)-left_pad;
-			x2=right_pad==-1?image.width()-1:find_right<1>(image,tolerance,selector)+right_pad;
-			break;
-		}
-		default:
-		{
-			auto selector=[bg=3U*unsigned int(background)](auto color)
+				x1=find_left(*counts,tolerance)-left_pad;
+			}
+			if(right_pad!=-1)
 			{
-				return unsigned int(color[0])+color[1]+color[2]<=bg;
-			};
-			x1=left_pad==-1?0:find_left<3>(image,tolerance,selector)-left_pad;
-			x2=right_pad==-1?image.width()-1:find_right<3>(image,tolerance,selector)+right_pad;
-			break;
-		}
+				x2=find_right(*counts,tolerance)+right_pad;
+			}
 		}
 		if(x1>x2)
 		{
@@ -1945,30 +2030,18 @@ namespace ScoreProcessor {
 	}
 	bool vert_padding(CImg<unsigned char>& image,unsigned int const tp,unsigned int const bp,unsigned int tolerance,unsigned char background)
 	{
-		signed int y1,y2;
-		switch(image._spectrum)
+		signed int y1=0,y2=image.height()-1;
+		if(tp!=-1||bp!=-1)
 		{
-		case 1:
-		case 2:
-		{
-			auto selector=[=](auto color)
+			auto const counts=page_darkness(image,image._spectrum<3?background+1U:3U*background+1U);
+			if(tp!=-1)
 			{
-				return color[0]<=background;
-			};
-			y1=tp==-1?0:find_top<1>(image,tolerance,selector)-tp;
-			y2=bp==-1?image.height()-1:find_bottom<1>(image,tolerance,selector)+bp;
-			break;
-		}
-		default:
-		{
-			auto selector=[bg=3U*unsigned int(background)](auto color)
+				y1=find_top(*counts,tolerance)-tp;
+			}
+			if(bp!=-1)
 			{
-				return unsigned int(color[0])+color[1]+color[2]<=bg;
-			};
-			y1=tp==-1?0:find_top<3>(image,tolerance,selector)-tp;
-			y2=bp==-1?image.height()-1:find_bottom<3>(image,tolerance,selector)+bp;
-			break;
-		}
+				y2=find_bottom(*counts,tolerance)+bp;
+			}
 		}
 		if(y1>y2)
 		{
@@ -1991,9 +2064,9 @@ namespace ScoreProcessor {
 		unsigned char bt)
 	{
 		auto selections=img._spectrum>2?
-			global_select<3>(img,[threshold=3U*unsigned short(bt)](auto color)
+			global_select<3>(img,[threshold=3U*static_cast<unsigned short>(bt)](auto color)
 		{
-			return unsigned short(color[0])+color[1]+color[2]<=threshold;
+			return static_cast<unsigned short>(color[0])+color[1]+color[2]<=threshold;
 		}):
 			global_select<1>(img,[bt](auto color)
 				{
@@ -2289,27 +2362,62 @@ namespace ScoreProcessor {
 		}
 	}
 
+	/*
+		Profiles bands of the image from one side until a band has ink, so only the margin and the first band with ink are read.
+		Bands are of columns if horizontal, of rows otherwise, and start from the right or bottom if from_end.
+	*/
+	edge_profiles profile_outer_band(cil::CImg<unsigned char> const& img,unsigned int limit,bool horizontal,bool from_end)
+	{
+		constexpr unsigned int band=64;
+		unsigned int const length=horizontal?img._width:img._height;
+		edge_profiles edges;
+		for(unsigned int done=0;done<length;done+=band)
+		{
+			unsigned int const size=std::min(band,length-done);
+			unsigned int const begin=from_end?length-done-size:done;
+			if(horizontal)
+			{
+				edges=profile_edges(img,limit,{begin,begin+size,0,img._height});
+				if(std::any_of(edges.left.begin(),edges.left.end(),[&img](unsigned int left){ return left<img._width; }))
+				{
+					break;
+				}
+			}
+			else
+			{
+				edges=profile_edges(img,limit,{0,img._width,begin,begin+size});
+				if(std::any_of(edges.top.begin(),edges.top.end(),[&img](unsigned int top){ return top<img._height; }))
+				{
+					break;
+				}
+			}
+		}
+		return edges;
+	}
+
 	void horizontal_shift(cil::CImg<unsigned char>& img,bool eval_right_side,bool eval_from_bottom,unsigned char background_threshold)
 	{
+		//start from the outermost ink of the evaluated side
+		auto const edges=profile_outer_band(img.get_shared_channel(0),background_threshold,true,eval_right_side);
+		unsigned int x;
+		if(eval_right_side)
+		{
+			x=*std::max_element(edges.right.begin(),edges.right.end());
+		}
+		else
+		{
+			x=*std::min_element(edges.left.begin(),edges.left.end());
+		}
+		if(x>=img._width||edges.top[x]==img._height)
+		{
+			return;
+		}
+		unsigned int y=eval_from_bottom?edges.bottom[x]:edges.top[x];
 		std::vector<int> shifts(img._height);
 		if(eval_right_side)
 		{
 			if(eval_from_bottom)
 			{
-				unsigned int x,y;
-				for(x=img._width;x>0;)
-				{
-					--x;
-					for(y=img._height;y>0;)
-					{
-						--y;
-						if(img(x,y)<background_threshold)
-						{
-							goto end_loop1;
-						}
-					}
-				}
-			end_loop1:
 				int shift=img._width-1-x;
 				for(unsigned int y_f=img._height;y_f>y;)
 				{
@@ -2328,19 +2436,6 @@ namespace ScoreProcessor {
 			}
 			else
 			{
-				unsigned int x,y;
-				for(x=img._width;x>0;)
-				{
-					--x;
-					for(y=0;y<img._height;++y)
-					{
-						if(img(x,y)<background_threshold)
-						{
-							goto end_loop2;
-						}
-					}
-				}
-			end_loop2:
 				int shift=img._width-1-x;
 				for(unsigned int y_f=0;y_f<=y;++y_f)
 				{
@@ -2360,19 +2455,6 @@ namespace ScoreProcessor {
 		{
 			if(eval_from_bottom)
 			{
-				unsigned int x,y;
-				for(x=0;x<img._width;++x)
-				{
-					for(y=img._height;y>0;)
-					{
-						--y;
-						if(img(x,y)<background_threshold)
-						{
-							goto end_loop3;
-						}
-					}
-				}
-			end_loop3:
 				for(unsigned int y_f=img._height;y_f>y;)
 				{
 					--y_f;
@@ -2390,18 +2472,6 @@ namespace ScoreProcessor {
 			}
 			else
 			{
-				unsigned int x,y;
-				for(x=0;x<img._width;++x)
-				{
-					for(y=0;y<img._height;++y)
-					{
-						if(img(x,y)<background_threshold)
-						{
-							goto end_loop4;
-						}
-					}
-				}
-			end_loop4:
 				for(unsigned int y_f=0;y_f<=y;++y_f)
 				{
 					shifts[y_f]=-x;
@@ -2432,26 +2502,27 @@ namespace ScoreProcessor {
 	}
 	void vertical_shift(cil::CImg<unsigned char>& img,bool eval_bottom,bool from_right,unsigned char background_threshold)
 	{
-
+		//start from the outermost ink of the evaluated side
+		auto const edges=profile_outer_band(img.get_shared_channel(0),background_threshold,false,eval_bottom);
+		unsigned int y;
+		if(eval_bottom)
+		{
+			y=*std::max_element(edges.bottom.begin(),edges.bottom.end());
+		}
+		else
+		{
+			y=*std::min_element(edges.top.begin(),edges.top.end());
+		}
+		if(y>=img._height||edges.left[y]==img._width)
+		{
+			return;
+		}
+		unsigned int x=from_right?edges.right[y]:edges.left[y];
 		std::vector<int> shifts(img._width);
 		if(eval_bottom)
 		{
 			if(from_right)
 			{
-				unsigned int x,y;
-				for(y=img._height;y>0;)
-				{
-					--y;
-					for(x=img._width;x>0;)
-					{
-						--x;
-						if(img(x,y)<background_threshold)
-						{
-							goto end_loop1;
-						}
-					}
-				}
-			end_loop1:
 				int shift=img._height-1-y;
 				for(unsigned int x_f=img._width;x_f>x;)
 				{
@@ -2470,19 +2541,6 @@ namespace ScoreProcessor {
 			}
 			else
 			{
-				unsigned int x,y;
-				for(y=img._height;y>0;)
-				{
-					--y;
-					for(x=0;x<img._width;++x)
-					{
-						if(img(x,y)<background_threshold)
-						{
-							goto end_loop2;
-						}
-					}
-				}
-			end_loop2:
 				int shift=img._height-1-y;
 				for(unsigned int x_f=0;x_f<=x;++x_f)
 				{
@@ -2502,19 +2560,6 @@ namespace ScoreProcessor {
 		{
 			if(from_right)
 			{
-				unsigned int x,y;
-				for(y=0;y<img._height;++y)
-				{
-					for(x=img._width;x>0;)
-					{
-						--x;
-						if(img(x,y)<background_threshold)
-						{
-							goto end_loop3;
-						}
-					}
-				}
-			end_loop3:
 				for(unsigned int x_f=img._width;x_f>x;)
 				{
 					--x_f;
@@ -2532,18 +2577,6 @@ namespace ScoreProcessor {
 			}
 			else
 			{
-				unsigned int x=0,y;
-				for(y=0;y<img._height;++y)
-				{
-					for(x=0;x<img._width;++x)
-					{
-						if(img(x,y)<background_threshold)
-						{
-							goto end_loop4;
-						}
-					}
-				}
-			end_loop4:
 				for(unsigned int x_f=0;x_f<=x;++x_f)
 				{
 					shifts[x_f]=-y;
@@ -18,6 +18,7 @@ along with this program. If not, see <https://www.gnu.org/licenses/>.
 #define SCORE_PROCESSES_H
 #include "CImg.h"
 #include "ImageUtils.h"
+#include "ImageMath.h"
 #include <vector>
 #include <memory>
 #include "Cluster.h"
@@ -66,6 +67,7 @@ namespace ScoreProcessor {
 		min_horiz_protection - regions of the largest cluster through which a horizontal path can be traced at least this length are protected
 		max_vertical_protection - regions of the largest cluster through which a vertical can be be traced less at least this length are treated like background
 		protection has higher authority over mark for removal
+		num_threads - threads of the shared pool to use, 1 to run serially when pages are already processed in parallel
 	*/
 	bool compress_vertical(
 		cil::CImg<unsigned char>& img,
@@ -74,7 +76,8 @@ namespace ScoreProcessor {
 		unsigned int min_horizontal_space,
 		unsigned int min_horiz_protection,
 		unsigned int max_vertical_protection,
-		unsigned int min_height);
+		unsigned int min_height,
+		unsigned int num_threads=1);
 
 	template<typename T>
 	cil::CImg<T> to_rgb(cil::CImg<T> const& img)
@@ -339,8 +342,8 @@ namespace ScoreProcessor {
 			return (v._top-v2._top)/v._width;
 		}
 #define vertical_operator_comp_op(op)\
-		template<typename T, typename U>\
-		friend bool operator op(vertical_iterator<T> const& a,vertical_iterator<U> const& b) noexcept\
+		template<typename A, typename B>\
+		friend bool operator op(vertical_iterator<A> const& a,vertical_iterator<B> const& b) noexcept\
 		{\
 			assert(a._width==b._width);\
 			return a._top op b._top;\
@@ -601,7 +604,7 @@ namespace ScoreProcessor {
 		bool did_something=false;
 		auto const size=size_t{height}*width;
 		auto const spectrum=img._spectrum;
-		auto copy{img};
+		auto copy(img);
 		for(unsigned int y=0;y<hm1;++y) //scan for horizontal edge
 		{
 			T* const row=img.data()+y*width;
@@ -817,6 +820,9 @@ namespace ScoreProcessor {
 		return 0;
 	}
 
+	template<typename T>
+	void fill_selection(::cimg_library::CImg<T>& img,ImageUtils::Rectangle<unsigned int> const sel,T const* color);
+
 	template<typename T>
 	cil::CImg<T> get_crop_fill(cil::CImg<T> const& img,ImageUtils::Rectangle<signed int> region,T fill=255)
 	{
@@ -874,7 +880,7 @@ namespace ScoreProcessor {
 			{
 				auto const x_min=wradius>x?0:x-wradius;
 				auto const x_max=std::min(x+wradius,width);
-				auto const area=y_dist*(x_max-m_min);
+				auto const area=y_dist*(x_max-x_min);
 				auto get_point=[&](auto& img)
 				{
 					return ThresholdCalcType(img(x_max-1,y_max-1)-img(x_min,y_min))/area;
@@ -1111,6 +1117,12 @@ namespace ScoreProcessor {
 	*/
 	unsigned int cut_page(::cimg_library::CImg<unsigned char> const& image,char const* filename,cut_heuristics const& ch={1000,80,20,0,128},int quality=100);
 
+	/*
+		Cuts a specified score page the same way, but adds the pieces as pages of a multi-page tiff, from top to bottom
+		@return the number of images created
+	*/
+	unsigned int cut_page(::cimg_library::CImg<unsigned char> const& image,::cimg_library::tiff_stack<unsigned char>& output,cut_heuristics const& ch={1000,80,20,0,128});
+
 	/*
 		Finds the line that is the top of the score image
 		@param image
@@ -1202,7 +1214,7 @@ namespace ScoreProcessor {
 		};
 
 		template<typename Img,typename Selector,typename DoWithLine>
-		void flood_operation(Img& img,ImageUtils::PointUINT start,Selector& selector,DoWithLine& dwl,std::vector<scan_range>& scan_ranges)
+		void flood_operation(Img& img,ImageUtils::PointUINT start,Selector&& selector,DoWithLine&& dwl,std::vector<scan_range>& scan_ranges)
 		{
 			using point=ImageUtils::PointUINT;
 			using line=ImageUtils::horizontal_line<unsigned int>;
@@ -1517,7 +1529,7 @@ namespace ScoreProcessor {
 		{
 			return false;
 		}
-		img=cil::get_crop_fill(img,ImageUtils::Rectangle<int>({left,right,top,bottom}));
+		img=get_crop_fill(img,ImageUtils::Rectangle<int>({left,right,top,bottom}));
 		return true;
 	}
 
@@ -1652,11 +1664,11 @@ namespace ScoreProcessor {
 			select.top-=destloc.y;
 			destloc.y=0;
 		}
-		if(unsigned int(destloc.x)+select.width()>=dest._width)
+		if(static_cast<unsigned int>(destloc.x)+select.width()>=dest._width)
 		{
 			select.right=dest._width;
 		}
-		if(unsigned int(destloc.y)+select.height()>=dest._height)
+		if(static_cast<unsigned int>(destloc.y)+select.height()>=dest._height)
 		{
 			select.bottom=dest._height;
 		}
@@ -7,11 +7,23 @@
 #include "Logs.h"
 #include <assert.h>
 #include <unordered_set>
+#include <unordered_map>
+#include <atomic>
+#include <cstdint>
 #include "Splice.h"
+#include "ImageProbe.h"
+#include "MappedFile.h"
 #include "lib/exstring/exiterator.h"
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
 #ifdef MAKE_README
 #include <fstream>
 #endif
+#ifdef BENCHMARK
+#include <chrono>
+#include <algorithm>
+#endif
 using namespace ScoreProcessor;
 
 using Input = char*;
@@ -200,14 +212,31 @@ void help_output(CommandMaker const& cm)
 	std::cout << cm.help_message() << '\n';
 }
 
-//lists out the files in files
+//lists out the files in files, with the dimensions from their headers
 void list_files(std::vector<std::string> const& files)
 {
 	{
 		std::cout << '\n';
 		for(auto const& file : files)
 		{
-			std::cout << file << '\n';
+			std::cout << file;
+			if(auto const info = probe_image(file.c_str()))
+			{
+				std::cout << "  (" << info->width << 'x' << info->height << ", " << info->spectrum << (info->spectrum == 1 ? " channel" : " channels");
+				if(info->format == support_type::tiff)
+				{
+					if(auto const pages = count_pages(file.c_str()); pages > 1)
+					{
+						std::cout << ", " << pages << " pages";
+					}
+				}
+				std::cout << ')';
+			}
+			else
+			{
+				std::cout << "  (unreadable header)";
+			}
+			std::cout << '\n';
 		}
 		auto const n = files.size();
 		std::cout << '\n' << n << (n == 1 ? " file was found.\n" : " files were found.\n");
@@ -215,6 +244,46 @@ void list_files(std::vector<std::string> const& files)
 	std::cout << '\n';
 }
 
+//repeats each multi-page tiff in files once for each of its pages, and returns which page every entry stands for
+//returns nothing if no file has more than one page
+std::vector<int> expand_pages(std::vector<std::string>& files)
+{
+	std::vector<unsigned int> counts(files.size(), 1);
+	bool any_pages = false;
+	for(size_t i = 0; i < files.size(); ++i)
+	{
+		if(supported_path(files[i].c_str()) == support_type::tiff)
+		{
+			counts[i] = count_pages(files[i].c_str());
+			any_pages |= counts[i] > 1;
+		}
+	}
+	if(!any_pages)
+	{
+		return {};
+	}
+	std::vector<std::string> expanded;
+	std::vector<int> pages;
+	for(size_t i = 0; i < files.size(); ++i)
+	{
+		if(counts[i] == 1)
+		{
+			expanded.push_back(std::move(files[i]));
+			pages.push_back(-1);
+		}
+		else
+		{
+			for(unsigned int page = 0; page < counts[i]; ++page)
+			{
+				expanded.push_back(files[i]);
+				pages.push_back(page);
+			}
+		}
+	}
+	files = std::move(expanded);
+	return pages;
+}
+
 //finds each command key between arg_start and end, and calls the appropriate commands to change del
 void parse_commands(CommandMaker::delivery& del, InputIter arg_start, InputIter end)
 {
@@ -313,7 +382,11 @@ std::string& append_trailing_slash(std::string& path)
 {
 	if(path.back() != '/' && path.back() != '\\')
 	{
+#ifdef _WIN32
 		path += '\\';
+#else
+		path += '/';
+#endif
 	}
 	return path;
 }
@@ -351,7 +424,7 @@ std::vector<std::string> glob_search(std::string& path)
 	else
 	{
 		path = fixed_path;
-		return exlib::files_in_dir(fixed_path, std::string(), 0, FILE_ATTRIBUTE_DIRECTORY);
+		return exlib::files_in_dir(fixed_path, std::string(), 0, exlib::directory_attribute);
 	}
 }
 
@@ -419,8 +492,7 @@ std::vector<std::string> get_files(InputIter begin, InputIter end)
 				{
 					path = root_path + path;
 				}
-				auto file_attr = GetFileAttributesA(path.c_str());
-				if(file_attr & FILE_ATTRIBUTE_DIRECTORY)
+				if(exlib::is_directory(path.c_str()))
 				{
 					append_trailing_slash(path);
 					auto fid = do_recursive ? exlib::files_in_dir_rec(path) : exlib::files_in_dir(path);
@@ -471,17 +543,20 @@ InputIter find_file_list(InputIter begin, InputIter end)
 }
 
 //applies the single image processes
-void do_single(CommandMaker::delivery const& del, std::vector<std::string> const& files)
+//pages is empty or holds the page of a multi-page tiff each file stands for
+//outputs holds the output name of each file
+void do_single(CommandMaker::delivery const& del, std::vector<std::string> const& files, std::vector<std::string> const& outputs, std::vector<int> const& pages)
 {
-	del.pl.process(files, &del.sr, del.num_threads, del.starting_index, del.do_move, del.quality, del.make_folders);
+	del.pl.process(files, outputs, del.num_threads, del.starting_index, del.do_move, del.quality, del.make_folders, pages.empty() ? nullptr : &pages);
 }
 
 //applies the cut process to the images
-void do_cut(CommandMaker::delivery const& del, std::vector<std::string> const& files)
+//pages is empty or holds the page of a multi-page tiff each file stands for
+//outputs holds the output name of each file
+void do_cut(CommandMaker::delivery const& del, std::vector<std::string> const& files, std::vector<std::string> const& outputs, std::vector<int> const& pages)
 {
 	using pv = decltype(CommandMaker::delivery::cut_args.min_width);
 	struct cut_args {
-		SaveRules const* output;
 		int verbosity;
 		unsigned char background;
 		pv min_width;
@@ -494,12 +569,16 @@ void do_cut(CommandMaker::delivery const& del, std::vector<std::string> const& f
 	class CutProcess {
 	private:
 		std::string const* input;
+		std::string const* output;
 		unsigned int index;
+		int page;
 		CommandMaker::delivery const* del;
 	public:
-		CutProcess(std::string const* input, unsigned int index, CommandMaker::delivery const& del):
+		CutProcess(std::string const* input, std::string const* output, unsigned int index, int page, CommandMaker::delivery const& del):
 			input(input),
+			output(output),
 			index(index),
+			page(page),
 			del(&del)
 		{}
 		void execute(cut_args const* ca) const
@@ -513,12 +592,12 @@ void do_cut(CommandMaker::delivery const& del, std::vector<std::string> const& f
 					coutput.append(1, '\n');
 					ca->log->log(coutput.c_str(), index);
 				}
-				auto out = ca->output->make_filename(*input, index);
+				auto const& out = *output;
 				if (del->make_folders)
 				{
 					try
 					{
-						std::filesystem::create_directories(std::filesystem::path(out).parent_path());
+						exlib::create_parent_directories(out);
 					}
 					catch (std::exception const& err)
 					{
@@ -527,7 +606,8 @@ void do_cut(CommandMaker::delivery const& del, std::vector<std::string> const& f
 				}
 				auto ext = exlib::find_extension(out.begin(), out.end());
 				auto const s = validate_extension(ext);
-				cil::CImg<unsigned char> in(input->c_str());
+				cil::CImg<unsigned char> in;
+				load_image(in, input->c_str(), del->map_input, page);
 				cut_heuristics cut_args;
 				cut_args.background = ca->background;
 				cut_args.horizontal_energy_weight = ca->horiz_weight;
@@ -535,7 +615,21 @@ void do_cut(CommandMaker::delivery const& del, std::vector<std::string> const& f
 				cut_args.min_height = (ca->min_height)(bases);
 				cut_args.min_width = ca->min_width(bases);
 				cut_args.minimum_vertical_space = ca->min_vert_space(bases);
-				auto num_pages = ScoreProcessor::cut_page(in, out.c_str(), cut_args, ca->quality);
+				unsigned int num_pages;
+				if(del->tiff_container)
+				{
+					if(s != support_type::tiff)
+					{
+						throw std::invalid_argument("Tiff container needs a tiff output");
+					}
+					cil::tiff_stack<unsigned char> stack(out.c_str());
+					num_pages = ScoreProcessor::cut_page(in, stack, cut_args);
+					stack.commit();
+				}
+				else
+				{
+					num_pages = ScoreProcessor::cut_page(in, out.c_str(), cut_args, ca->quality);
+				}
 				if(ca->verbosity > ProcessList<>::verbosity::errors_only)
 				{
 					std::string coutput("Finished ");
@@ -558,7 +652,6 @@ void do_cut(CommandMaker::delivery const& del, std::vector<std::string> const& f
 		}
 	};
 	cut_args ca{
-	&del.sr,
 	del.pl.get_verbosity(),
 	del.cut_args.background,
 	del.cut_args.min_width,
@@ -571,7 +664,7 @@ void do_cut(CommandMaker::delivery const& del, std::vector<std::string> const& f
 	exlib::thread_pool_a<cut_args const*> tp(del.num_threads, &ca);
 	for(size_t i = 0; i < files.size(); ++i)
 	{
-		tp.push_back([process = CutProcess{&files[i],static_cast<unsigned int>(i + del.starting_index),del}](cut_args const* ca) noexcept {
+		tp.push_back([process = CutProcess{&files[i],&outputs[i],static_cast<unsigned int>(i + del.starting_index),pages.empty() ? -1 : pages[i],del}](cut_args const* ca) noexcept {
 			process.execute(ca);
 		});
 	}
@@ -586,7 +679,7 @@ void do_splice(CommandMaker::delivery const& del, std::vector<std::string> const
 		// auto ext = exlib::find_extension(save.begin(), save.end());
 		// validate_extension(ext);
 		Splice::standard_heuristics sh;
-		Splice::options const options{ del.starting_index, del.num_threads, del.quality, del.make_folders };
+		Splice::options const options{ del.starting_index, del.num_threads, del.quality, del.make_folders, del.map_input, del.tiff_container };
 		auto num = del.splice_divider.data() ?
 			splice_pages_parallel(files, del.sr, options, del.splice_args, del.splice_divider) :
 			splice_pages_parallel(files, del.sr, options, del.splice_args);
@@ -598,17 +691,63 @@ void do_splice(CommandMaker::delivery const& del, std::vector<std::string> const
 	}
 }
 
+//not every standard library specializes std::hash for paths yet
+struct path_hash {
+	template<typename Path>
+	std::size_t operator()(Path const& path) const noexcept
+	{
+		return hash_value(path);
+	}
+};
+
+//what a directory is on disk, so that different spellings of the same directory compare equal
+struct directory_key {
+	std::uint64_t device;
+	std::uint64_t file;
+	std::string missing; //normalized path of a directory that does not exist yet, then device and file are 0
+	bool operator==(directory_key const& other) const noexcept
+	{
+		return device == other.device && file == other.file && missing == other.missing;
+	}
+};
+
 namespace std {
 	template<>
-	struct hash<std::filesystem::path> {
-		template<typename Path>
-		std::size_t operator()(Path const& path) const noexcept
+	struct hash<directory_key> {
+		std::size_t operator()(directory_key const& key) const noexcept
 		{
-			return hash_value(path);
+			auto const h = std::hash<std::uint64_t>()(key.device * 0x9E3779B97F4A7C15ULL ^ key.file);
+			return key.missing.empty() ? h : h ^ std::hash<std::string>()(key.missing);
 		}
 	};
 }
 
+directory_key find_directory_key(std::filesystem::path const& dir)
+{
+#ifdef _WIN32
+	HANDLE const handle = CreateFileW(dir.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+	if(handle != INVALID_HANDLE_VALUE)
+	{
+		BY_HANDLE_FILE_INFORMATION info;
+		bool const found = GetFileInformationByHandle(handle, &info);
+		CloseHandle(handle);
+		if(found)
+		{
+			return {info.dwVolumeSerialNumber, (std::uint64_t(info.nFileIndexHigh) << 32) | info.nFileIndexLow, {}};
+		}
+	}
+#else
+	struct stat info;
+	if(stat(dir.c_str(), &info) == 0)
+	{
+		return {std::uint64_t(info.st_dev), std::uint64_t(info.st_ino), {}};
+	}
+#endif
+	std::error_code ec;
+	auto normal = std::filesystem::weakly_canonical(dir, ec);
+	return {0, 0, (ec ? dir.lexically_normal() : normal).string()};
+}
+
 template<typename PathS = void, typename Iter, typename Sentinal>
 bool find_collisions(Iter begin, Sentinal end)
 {
@@ -616,8 +755,25 @@ bool find_collisions(Iter begin, Sentinal end)
 		std::is_void<PathS>::value,
 		typename std::decay<decltype(*begin)>::type,
 		PathS>::type;
-	std::vector<std::pair<Path, std::unordered_set<Path>>> collisions;
 	using PathRef = typename std::remove_cv<typename exlib::remove_rvalue_reference<decltype(*begin)>::type>::type;
+	//outputs usually share a handful of directories, so each distinct spelling is only looked up once
+	std::unordered_map<Path, std::size_t, path_hash> directory_ids;
+	std::unordered_map<directory_key, std::size_t> keys;
+	struct output_name {
+		std::size_t directory;
+		Path filename;
+		bool operator==(output_name const& other) const
+		{
+			return directory == other.directory && filename == other.filename;
+		}
+	};
+	struct output_hash {
+		std::size_t operator()(output_name const& name) const noexcept
+		{
+			return path_hash()(name.filename) ^ (name.directory * 0x9E3779B97F4A7C15ULL);
+		}
+	};
+	std::unordered_map<output_name, Path, output_hash> outputs;
 	for(; begin != end; ++begin)
 	{
 		PathRef entry = *begin;
@@ -626,81 +782,185 @@ bool find_collisions(Iter begin, Sentinal end)
 		{
 			dir = ".";
 		}
-		auto filename = entry.filename();
-		bool found = false;
-		for(auto& known_dir : collisions)
+		auto it = directory_ids.find(dir);
+		if(it == directory_ids.end())
 		{
-			if(known_dir.first == dir || equivalent(known_dir.first, dir))
-			{
-				found = true;
-				auto res = known_dir.second.insert(std::move(filename));
-				if(!res.second)
-				{
-					std::cout << "Collision between \"" + entry.string() + "\" and \"" + (known_dir.first / *res.first).string() + "\"\n";
-					return true;
-				}
-			}
+			auto const id = keys.emplace(find_directory_key(dir), keys.size()).first->second;
+			it = directory_ids.emplace(std::move(dir), id).first;
 		}
-		if(!found)
+		auto res = outputs.emplace(output_name{it->second, entry.filename()}, entry);
+		if(!res.second)
 		{
-			collisions.push_back({std::move(dir),{}});
-			collisions.back().second.insert(std::move(filename));
+			std::cout << "Collision between \"" + entry.string() + "\" and \"" + res.first->second.string() + "\"\n";
+			return true;
 		}
 	}
 	return false;
 }
 
-template<typename PathsIter>
-bool has_collisions(PathsIter begin, PathsIter end, SaveRules const& rules, unsigned int si)
+//the output name of each file, numbered from si
+std::vector<std::string> make_output_names(std::vector<std::string> const& files, SaveRules const& rules, unsigned int si)
 {
-	auto transformer = [&rules, &si](std::string const& input)
+	std::vector<std::string> outputs(files.size());
+	for(std::size_t i = 0; i < files.size(); ++i)
 	{
-		auto path = rules.make_filename(input, si++);
-		return std::filesystem::path(path);
+		rules.make_filename(outputs[i], files[i], static_cast<unsigned int>(si + i));
+	}
+	return outputs;
+}
+
+bool has_collisions(std::vector<std::string> const& outputs)
+{
+	auto transformer = [](std::string const& output)
+	{
+		return std::filesystem::path(output);
 	};
-	auto tbegin = exlib::transform_iterator{begin, transformer};
-	auto tend = decltype(tbegin){end, transformer};
+	auto tbegin = exlib::transform_iterator{outputs.begin(), transformer};
+	auto tend = decltype(tbegin){outputs.end(), transformer};
 	return find_collisions(tbegin, tend);
 }
 
 template<typename PathS = void, typename Iter, typename Sentinal>
-bool find_overwrites(Iter begin,Sentinal end)
+bool find_overwrites(Iter begin,Sentinal end,unsigned int num_threads)
 {
 	using Path=typename std::conditional<
 		std::is_void<PathS>::value,
 		typename std::decay<decltype(*begin)>::type,
 		PathS>::type;
-	using PathRef=typename std::remove_cv<typename exlib::remove_rvalue_reference<decltype(*begin)>::type>::type;
+	std::vector<Path> paths;
 	for(;begin!=end;++begin)
 	{
-		PathRef path=*begin;
-		if(exists(path))
+		paths.emplace_back(*begin);
+	}
+	//the checks are independent and mostly waiting on the file system, report the first existing file in input order
+	std::atomic<std::size_t> first=paths.size();
+	{
+		std::size_t const chunk=std::max<std::size_t>(64,paths.size()/(std::size_t(num_threads)*8+1));
+		exlib::thread_pool pool(std::max(1U,num_threads));
+		for(std::size_t start=0;start<paths.size();start+=chunk)
 		{
-			std::cout<<"Cannot overwrite "+path.string()+"\n";
-			return true;
+			pool.push_back([&,start,stop=std::min(start+chunk,paths.size())]() noexcept
+			{
+				for(auto i=start;i<stop&&i<first.load(std::memory_order_relaxed);++i)
+				{
+					std::error_code ec;
+					if(exists(paths[i],ec))
+					{
+						auto known=first.load(std::memory_order_relaxed);
+						while(i<known&&!first.compare_exchange_weak(known,i,std::memory_order_relaxed));
+						return;
+					}
+				}
+			});
 		}
+		pool.wait();
+	}
+	if(first<paths.size())
+	{
+		std::cout<<"Cannot overwrite "+paths[first].string()+"\n";
+		return true;
 	}
 	return false;
 }
 
-bool find_overwrites(std::vector<std::string> const& files, SaveRules const& rules, unsigned int si)
+bool find_overwrites(std::vector<std::string> const& outputs, unsigned int num_threads)
 {
-	auto transformer=[&rules,&si](std::string const& input)
+	auto transformer=[](std::string const& output)
 	{
-		auto path=rules.make_filename(input,si++);
-		return std::filesystem::path(path);
+		return std::filesystem::path(output);
 	};
-	auto tbegin=exlib::transform_iterator{files.begin(), transformer};
-	auto tend=decltype(tbegin){files.end(),transformer};
-	return find_overwrites(tbegin,tend);
+	auto tbegin=exlib::transform_iterator{outputs.begin(), transformer};
+	auto tend=decltype(tbegin){outputs.end(),transformer};
+	return find_overwrites(tbegin,tend,num_threads);
+}
+
+#ifdef BENCHMARK
+//returns the best and median of repeated timings of f, in milliseconds
+//setup is run before each repetition, outside of the timing
+template<unsigned int Repetitions, typename Setup, typename F>
+std::pair<double, double> time_repeated(Setup setup, F f)
+{
+	using ms = std::chrono::duration<double, std::milli>;
+	std::array<double, Repetitions> times;
+	for(auto& time : times)
+	{
+		setup();
+		auto const start = std::chrono::steady_clock::now();
+		f();
+		time = ms(std::chrono::steady_clock::now() - start).count();
+	}
+	std::sort(times.begin(), times.end());
+	return {times.front(), times[Repetitions / 2]};
+}
+
+template<unsigned int Repetitions, typename F>
+std::pair<double, double> time_repeated(F f)
+{
+	return time_repeated<Repetitions>([] {}, f);
 }
 
+//times the single page operations given on the command line on every file, without saving
+//jpegs and pngs are also timed loading through buffered reads and through memory mappings
+//usage is the same as a normal run, e.g. ScoreProcessor pages -vc 20 40 10
+int run_benchmark(InputIter begin, InputIter end)
+{
+	constexpr unsigned int repetitions = 5;
+	CommandMaker::delivery del;
+	std::vector<std::string> files;
+	try
+	{
+		auto const file_end = find_file_list(begin, end);
+		parse_commands(del, file_end, end);
+		files = get_files(begin, file_end);
+		//processes that override the thread count get -nt threads, as in a normal run
+		del.fix_values(files.size());
+	}
+	catch(std::exception const& ex)
+	{
+		std::cout << ex.what() << '\n';
+		return 1;
+	}
+	if(del.flag != del.do_single)
+	{
+		std::cout << "Only single page operations can be benchmarked\n";
+		return 1;
+	}
+	cil::cimg::exception_mode(0);
+	for(auto const& file : files)
+	{
+		try
+		{
+			cil::CImg<unsigned char> const page(file.c_str());
+			cil::CImg<unsigned char> img;
+			auto const processed = time_repeated<repetitions>([&] { img = page; }, [&] { del.pl.process_unsafe(img, nullptr); });
+			std::cout << file << " (" << page._width << 'x' << page._height << "): best " << processed.first << " ms, median " << processed.second << " ms\n";
+			auto const format = supported_path(file.c_str());
+			if(format == support_type::jpeg || format == support_type::png)
+			{
+				//the page load above has already warmed the file cache for both
+				auto const buffered = time_repeated<repetitions>([&] { load_image(img, file.c_str(), false); });
+				auto const mapped = time_repeated<repetitions>([&] { load_image(img, file.c_str(), true); });
+				std::cout << "  load: buffered best " << buffered.first << " ms, median " << buffered.second << " ms; mapped best " << mapped.first << " ms, median " << mapped.second << " ms\n";
+			}
+		}
+		catch(std::exception const& ex)
+		{
+			std::cout << file << ": " << ex.what() << '\n';
+		}
+	}
+	return 0;
+}
+#endif
+
 int main(int argc, InputIter argv)
 {
 #ifdef MAKE_README
 	if(argc > 1)
 		make_readme(argv[1]);
 	return 0;
+#endif
+#ifdef BENCHMARK
+	return run_benchmark(argv + 1, argv + argc);
 #endif
 	std::ios::sync_with_stdio(false);
 	if(argc == 1)
@@ -752,20 +1012,24 @@ int main(int argc, InputIter argv)
 	{
 		list_files(files);
 	}
+	//splices take whole files, everything else fans the pages of a multi-page tiff out as separate inputs
+	auto const pages = del.flag == del.do_splice ? std::vector<int>() : expand_pages(files);
 	del.fix_values(files.size());
-	if(has_collisions(files.begin(), files.end(), del.sr, del.starting_index))
+#if OPTION_RESTRICTED
+	del.lt = del.errors_only;
+	del.sr.assign("%p/output/%w");
+#endif
+	//the same names are checked and then written to
+	auto const outputs = make_output_names(files, del.sr, del.starting_index);
+	if(has_collisions(outputs))
 	{
 		std::cout << "Collision in output names\n";
 		return 1;
 	}
-	if(del.check_overwrite&&find_overwrites(files,del.sr,del.starting_index))
+	if(del.check_overwrite&&find_overwrites(outputs,del.num_threads))
 	{
 		return 1;
 	}
-#if OPTION_RESTRICTED
-	del.lt = del.errors_only;
-	del.sr.assign("%p/output/%w");
-#endif
 	std::optional<Loggers::AmountLog> al;
 	Loggers::CoutLog cl;
 	switch(del.lt)
@@ -788,6 +1052,9 @@ int main(int argc, InputIter argv)
 		del.pl.set_log(&cl);
 		del.pl.set_verbosity(del.pl.loud);
 	}
+	del.pl.set_mapped_input(del.map_input);
+	cil::encoding()=del.encoding;
+	cil::sync_outputs()=del.sync_outputs;
 	switch(del.flag)
 	{
 	case del.do_absolutely_nothing:
@@ -796,14 +1063,18 @@ int main(int argc, InputIter argv)
 	case del.do_nothing:
 		[[fallthrough]];
 	case del.do_single:
-		do_single(del, files);
+		do_single(del, files, outputs, pages);
 		break;
 	case del.do_cut:
-		do_cut(del, files);
+		do_cut(del, files, outputs, pages);
 		break;
 	case del.do_splice:
 		do_splice(del, files);
 		break;
 	}
+	if(del.sync_outputs)
+	{
+		cil::sync_output_directories();
+	}
 	return 0;
 }
\ No newline at end of file
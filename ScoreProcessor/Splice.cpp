@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "Splice.h"
 #include "ScoreProcesses.h"
+#include "PageAnalysis.h"
 #ifdef HSPROC
 #include "Processes.h"
 #endif
@@ -206,34 +207,11 @@ namespace ScoreProcessor {
 	unsigned int splice_find_top(cil::CImg<unsigned char> const& img,unsigned char bg)
 	{
 		unsigned int min=img._height/2;
-		if(img._spectrum<3)
+		//ink below the middle cannot lower the minimum, so only the top half is read
+		auto const edges=profile_edges(img,img._spectrum<3?bg+1U:3U*bg+1U,{0,img._width,0,min});
+		for(auto const top:edges.top)
 		{
-			for(unsigned int x=0;x<img._width;++x)
-			{
-				for(unsigned int y=0;y<min;++y)
-				{
-					if(img(x,y)<=bg)
-					{
-						min=y;
-						break;
-					}
-				}
-			}
-		}
-		else
-		{
-			unsigned int limit=3U*bg;
-			for(unsigned int x=0;x<img._width;++x)
-			{
-				for(unsigned int y=0;y<min;++y)
-				{
-					if(static_cast<unsigned int>(img(x,y))+img(x,y,1)+img(x,y,2)<=limit)
-					{
-						min=y;
-						break;
-					}
-				}
-			}
+			min=std::min(min,top);
 		}
 		return min;
 	}
@@ -241,34 +219,10 @@ namespace ScoreProcessor {
 	unsigned int splice_find_bottom(cil::CImg<unsigned char> const& img,unsigned char bg)
 	{
 		unsigned int max=img._height/2;
-		if(img._spectrum<3)
+		auto const edges=profile_edges(img,img._spectrum<3?bg+1U:3U*bg+1U,{0,img._width,max,img._height});
+		for(auto const bottom:edges.bottom)
 		{
-			for(unsigned int x=0;x<img._width;++x)
-			{
-				for(unsigned int y=img._height-1;y>max;--y)
-				{
-					if(img(x,y)<=bg)
-					{
-						max=y;
-						break;
-					}
-				}
-			}
-		}
-		else
-		{
-			unsigned int limit=3U*bg;
-			for(unsigned int x=0;x<img._width;++x)
-			{
-				for(unsigned int y=img._height-1;y>max;--y)
-				{
-					if(static_cast<unsigned int>(img(x,y))+img(x,y,1)+img(x,y,2)<=limit)
-					{
-						max=y;
-						break;
-					}
-				}
-			}
+			max=std::max(max,bottom);
 		}
 		return max;
 	}
@@ -301,6 +255,25 @@ namespace ScoreProcessor {
 		return height_cost+padding_cost;
 	};
 
+	//opens the multi-page tiff every page goes into if the options ask for one, null otherwise
+	std::unique_ptr<cil::tiff_stack<unsigned char>> open_container(std::vector<std::string> const& filenames,SaveRules const& output_rule,Splice::options const& options)
+	{
+		if(!options.tiff_container)
+		{
+			return nullptr;
+		}
+		auto const name=output_rule.make_filename(filenames[0],options.starting_index);
+		if(supported_path(name.c_str())!=support_type::tiff)
+		{
+			throw std::invalid_argument("Tiff container needs a tiff output");
+		}
+		if(options.make_folders)
+		{
+			exlib::create_parent_directories(name);
+		}
+		return std::make_unique<cil::tiff_stack<unsigned char>>(name.c_str());
+	}
+
 	unsigned int splice_pages_parallel(
 		std::vector<std::string> const& filenames,
 		SaveRules const& output_rule,
@@ -315,6 +288,7 @@ namespace ScoreProcessor {
 		for(size_t i=0;i<filenames.size();++i)
 		{
 			managers[i].fname(filenames[i].c_str());
+			managers[i].map_input(options.map_input);
 		}
 		managers[0].load();
 		unsigned int horiz_padding,min_pad,opt_pad,opt_height;
@@ -392,14 +366,15 @@ namespace ScoreProcessor {
 			}
 			else
 			{
-				return Splice::page_layout{unsigned int((opt_height-total_height)/(n+1)),opt_height};
+				return Splice::page_layout{static_cast<unsigned int>((opt_height-total_height)/(n+1)),opt_height};
 			}
 		};
 		auto cost=[=](Splice::page_layout const p)
 		{
 			return layout_cost(p,sh,horiz_padding,opt_pad,opt_height);
 		};
-		auto saver = [quality = options.quality, width = sh.optimal_height, make_folders = options.make_folders](auto const& image, char const* name)
+		auto const container=open_container(filenames,output_rule,options);
+		auto saver = [quality = options.quality, width = sh.optimal_height, make_folders = options.make_folders, stack = container.get()](auto const& image, char const* name, unsigned int page_number)
 		{
 			auto support = supported_path(name);
 			if(support==decltype(support)::no)
@@ -415,11 +390,15 @@ namespace ScoreProcessor {
 #else
 			auto const& save=image;
 #endif
+			if (stack)
+			{
+				return stack->add(page_number, save);
+			}
 			if (make_folders)
 			{
 				try
 				{
-					std::filesystem::create_directories(std::filesystem::path(name).parent_path());
+					exlib::create_parent_directories(name);
 				}
 				catch (std::exception const& err)
 				{
@@ -428,7 +407,12 @@ namespace ScoreProcessor {
 			}
 			return cil::save_image(save, name, support, quality);
 		};
-		return splice_pages_parallel(managers,output_rule,options.starting_index,options.num_threads,pe,create_layout,cost,&splice_images, saver);
+		auto const num=splice_pages_parallel(managers,output_rule,options.starting_index,options.num_threads,pe,create_layout,cost,&splice_images, saver);
+		if (container)
+		{
+			container->commit();
+		}
+		return num;
 	}
 
 	unsigned int splice_pages_parallel(
@@ -463,7 +447,7 @@ namespace ScoreProcessor {
 		{
 			try
 			{
-				desc.img.load(name.c_str());
+				load_image(desc.img,name.c_str(),options.map_input);
 				get_dims(desc);
 				get_optimal_values(sh,desc.img,horiz_padding,min_pad,opt_pad,opt_height);
 				desc.img=cil::CImg<unsigned char>{};
@@ -482,7 +466,7 @@ namespace ScoreProcessor {
 			{
 				try
 				{
-					desc.img.load(name.c_str());
+					load_image(desc.img,name.c_str(),options.map_input);
 					get_dims(desc);
 					desc.img=cil::CImg<unsigned char>{};
 				}
@@ -514,7 +498,7 @@ namespace ScoreProcessor {
 			}
 			else
 			{
-				return Splice::page_layout{unsigned int((opt_height-total_height)/(2*n)),opt_height};
+				return Splice::page_layout{static_cast<unsigned int>((opt_height-total_height)/(2*n)),opt_height};
 			}
 		};
 		auto breaks=nongreedy_break(
@@ -526,6 +510,7 @@ namespace ScoreProcessor {
 			});
 		unsigned int num_digs=exlib::num_digits(breaks.size()+options.starting_index);
 		num_digs=num_digs<3?3:num_digs;
+		auto const container=open_container(filenames,output_rule,options);
 		unsigned int num_imgs=0;
 		auto start=0;
 		for(size_t i=breaks.size()-1;;)
@@ -536,6 +521,8 @@ namespace ScoreProcessor {
 			pool.push_back(
 				[&,
 				filename_index=start+options.starting_index,
+				page_number=num_imgs-1,
+				stack=container.get(),
 				fbegin=filenames.data()+start,
 				ibegin=descriptions.data()+start,
 				num_pages=s,
@@ -545,7 +532,7 @@ namespace ScoreProcessor {
 				try
 				{
 					std::vector<Splice::page> imgs(num_pages*2-1);
-					imgs[0].img.load(fbegin->c_str());
+					load_image(imgs[0].img,fbegin->c_str(),options.map_input);
 					imgs[0].top=ibegin->top;
 					imgs[0].bottom=ibegin->bottom;
 					for(size_t i=1;i<num_pages;++i)
@@ -553,10 +540,15 @@ namespace ScoreProcessor {
 						imgs[2*i-1].img=cil::CImg{divider,true};
 						imgs[2*i-1].top=divider_desc.top;
 						imgs[2*i-1].bottom=divider_desc.bottom;
-						imgs[2*i].img.load(fbegin[i].c_str());
+						load_image(imgs[2*i].img,fbegin[i].c_str(),options.map_input);
 						imgs[2*i].top=ibegin[i].top;
 						imgs[2*i].bottom=ibegin[i].bottom;
 					}
+					if(stack)
+					{
+						stack->add(page_number,splice_images(imgs.data(),imgs.size(),padding));
+						return;
+					}
 					auto const output=output_rule.make_filename(fbegin[0],filename_index);
 					auto support=supported_path(output.c_str());
 					if(support==decltype(support)::no)
@@ -568,7 +560,7 @@ namespace ScoreProcessor {
 					{
 						try
 						{
-							std::filesystem::create_directories(std::filesystem::path(filename).parent_path());
+							exlib::create_parent_directories(filename);
 						}
 						catch (std::exception const& err)
 						{
@@ -598,6 +590,10 @@ namespace ScoreProcessor {
 		{
 			throw std::runtime_error(error_log);
 		}
+		if(container)
+		{
+			container->commit();
+		}
 		return num_imgs;
 	}
 }
\ No newline at end of file
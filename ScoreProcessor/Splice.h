@@ -9,6 +9,7 @@
 #include "lib/exstring/exmath.h"
 #include <array>
 #include "ImageProcess.h"
+#include "MappedFile.h"
 namespace ScoreProcessor {
 
 	//Anything in namespace Splice, except standard_heurstics, you should not access directly
@@ -20,6 +21,7 @@ namespace ScoreProcessor {
 			cil::CImg<unsigned char> _img;
 			char const* filename;
 			unsigned int times_used=0;
+			bool mapped_input=false;
 			std::mutex guard;
 		public:
 			[[nodiscard]]
@@ -36,12 +38,17 @@ namespace ScoreProcessor {
 			{
 				filename=fn;
 			}
+			//whether jpegs and pngs are decoded from a memory mapping of the file
+			inline void map_input(bool map)
+			{
+				mapped_input=map;
+			}
 			inline void load()
 			{
 				std::lock_guard<std::mutex> locker(guard);
 				if(_img._data==0)
 				{
-					_img.load(filename);
+					load_image(_img,filename,mapped_input);
 					if(_img._spectrum==2)
 					{
 						cil::CImg<unsigned char> temp(_img._width,_img._height,1,4);
@@ -298,6 +305,7 @@ namespace ScoreProcessor {
 			pool.push_back(
 				[&output_rule,
 				filename_index=start+starting_index,
+				page_number=num_imgs-1,
 				fbegin=files.data()+start,
 				ibegin=page_descs.data()+start,
 				num_pages=s,
@@ -318,7 +326,7 @@ namespace ScoreProcessor {
 					auto const last=num_pages-1;
 					imgs[last].bottom=ibegin[last].bottom.raw;
 					auto const filename=output_rule.make_filename(fbegin[0].fname(),filename_index);
-					saver(splicer(imgs.data(),num_pages,padding),filename.c_str());
+					saver(splicer(imgs.data(),num_pages,padding),filename.c_str(),page_number);
 				}
 				catch(std::exception const& ex)
 				{
@@ -361,25 +369,6 @@ namespace ScoreProcessor {
 		return splice_pages_parallel(managers,output,starting_index,num_threads,ep,cl,c,quality);
 	}
 
-	template<typename EvalPage,typename CreateLayout,typename Cost>
-	unsigned int splice_pages(
-		std::vector<std::string> const& filenames,
-		char const* output,
-		unsigned int starting_index,
-		unsigned int num_threads,
-		EvalPage ep,
-		CreateLayout cl,
-		Cost c)
-	{
-		auto const c=files.size();
-		if(c<2)
-		{
-			throw std::invalid_argument("Need multiple pages to splice");
-		}
-		std::vector<Splice::page_desc> page_descs(c);
-		page_descs.front().top=ep.eval_middle()
-	}
-
 	namespace Splice {
 		using pv=exlib::maybe_fixed<unsigned int>;
 		struct standard_heuristics {
@@ -396,6 +385,8 @@ namespace ScoreProcessor {
 			unsigned int num_threads;
 			int quality;
 			bool make_folders;
+			bool map_input;
+			bool tiff_container; //all pages go into one multi-page tiff named by the output of the first
 		};
 	}
 
@@ -16,12 +16,40 @@ along with this program. If not, see <https://www.gnu.org/licenses/>.
 */
 #ifndef EXFILES_H
 #define EXFILES_H
+#include <filesystem>
+#include <string>
 #include <vector>
 #ifdef _WINDOWS
 #include <Windows.h>
+#else
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "../threadpool/thread_pool.h"
 #endif
 #include <stdio.h>
 namespace exlib {
+#ifdef _WINDOWS
+	using file_attributes=DWORD;
+	constexpr file_attributes directory_attribute=FILE_ATTRIBUTE_DIRECTORY;
+#else
+	//only whether an entry is a directory is tracked outside of Windows
+	using file_attributes=unsigned int;
+	constexpr file_attributes directory_attribute=1;
+#endif
+
+	/*
+	Returns whether the path names a directory.
+	*/
+	inline bool is_directory(char const* path);
 	/*
 	Returns a String with any consecutive slashes replaced by a single slash.
 	*/
@@ -40,6 +68,28 @@ namespace exlib {
 	template<typename T>
 	size_t remove_multislashes(T* input);
 
+	/*
+	Returns an iterator to the start of the filename, after the last slash.
+	*/
+	template<typename Iter>
+	Iter find_filename(Iter begin,Iter end);
+
+	/*
+	Returns the directory of the running executable, ending in a slash, or an empty string if it cannot be found.
+	*/
+	inline std::string executable_directory();
+
+	/*
+	Creates the directories leading up to the file at path, if it names any.
+	*/
+	inline void create_parent_directories(std::filesystem::path const& path)
+	{
+		if(path.has_parent_path())
+		{
+			std::filesystem::create_directories(path.parent_path());
+		}
+	}
+
 #ifdef _WINDOWS
 
 	/*
@@ -127,6 +177,314 @@ namespace exlib {
 		}
 		return files;
 	}
+
+	inline bool is_directory(char const* path)
+	{
+		return GetFileAttributesA(path)&FILE_ATTRIBUTE_DIRECTORY;
+	}
+
+	inline std::string executable_directory()
+	{
+		char path[MAX_PATH];
+		auto const len=GetModuleFileNameA(NULL,path,MAX_PATH);
+		if(len==0||len==MAX_PATH)
+		{
+			return {};
+		}
+		return std::string(path,find_filename(path,path+len));
+	}
+#else
+	namespace files_detail {
+		/*
+		Calls f(name,type) for every entry of the open directory other than . and ..,
+		where type is the d_type reported by the file system, and may be DT_UNKNOWN.
+		*/
+		template<typename F>
+		void for_each_entry(int dir,F&& f)
+		{
+#ifdef __linux__
+			//getdents64 hands back a buffer of entries at once, readdir would copy them out one by one
+			struct linux_dirent64 {
+				ino64_t d_ino;
+				off64_t d_off;
+				unsigned short d_reclen;
+				unsigned char d_type;
+				char d_name[1];
+			};
+			alignas(linux_dirent64) char buffer[1<<15];
+			for(;;)
+			{
+				auto const read=syscall(SYS_getdents64,dir,buffer,sizeof(buffer));
+				if(read<=0)
+				{
+					return;
+				}
+				for(long pos=0;pos<read;)
+				{
+					auto const entry=reinterpret_cast<linux_dirent64 const*>(buffer+pos);
+					pos+=entry->d_reclen;
+					auto const name=entry->d_name;
+					if(name[0]=='.'&&(name[1]=='\0'||(name[1]=='.'&&name[2]=='\0')))
+					{
+						continue;
+					}
+					f(name,entry->d_type);
+				}
+			}
+#else
+			int const copy=dup(dir);
+			if(copy<0)
+			{
+				return;
+			}
+			DIR* const stream=fdopendir(copy);
+			if(!stream)
+			{
+				close(copy);
+				return;
+			}
+			while(dirent const* const entry=readdir(stream))
+			{
+				auto const name=entry->d_name;
+				if(name[0]=='.'&&(name[1]=='\0'||(name[1]=='.'&&name[2]=='\0')))
+				{
+					continue;
+				}
+				f(name,entry->d_type);
+			}
+			closedir(stream);
+#endif
+		}
+
+		//only stats when the file system did not say what the entry is, or it is a link
+		inline bool entry_is_directory(int dir,char const* name,unsigned char type)
+		{
+			if(type==DT_DIR)
+			{
+				return true;
+			}
+			if(type!=DT_UNKNOWN&&type!=DT_LNK)
+			{
+				return false;
+			}
+			struct stat info;
+			return fstatat(dir,name,&info,0)==0&&S_ISDIR(info.st_mode);
+		}
+
+		//closes the directory it was opened with when it goes out of scope
+		class directory_handle {
+			int _fd;
+		public:
+			explicit directory_handle(char const* path) noexcept:
+				_fd(openat(AT_FDCWD,*path?path:".",O_RDONLY|O_DIRECTORY|O_CLOEXEC))
+			{}
+			directory_handle(directory_handle const&)=delete;
+			directory_handle& operator=(directory_handle const&)=delete;
+			~directory_handle()
+			{
+				if(_fd>=0)
+				{
+					close(_fd);
+				}
+			}
+			explicit operator bool() const noexcept
+			{
+				return _fd>=0;
+			}
+			int get() const noexcept
+			{
+				return _fd;
+			}
+		};
+
+		template<typename String>
+		void sort_files(std::vector<String>& files)
+		{
+			std::sort(files.begin(),files.end(),[](auto const& a,auto const& b)
+			{
+				return exlib::strncmp_wind(a.c_str(),b.c_str())<0;
+			});
+		}
+
+		template<typename String>
+		struct directory_node {
+			String path;
+			std::vector<String> files;
+			std::vector<String> subdirectories;
+			std::vector<directory_node> children;
+			std::exception_ptr error;
+
+			//lists this directory, then queues its subdirectories on the pool
+			//an error is kept for collect to rethrow, and stops the rest of the search
+			void scan(thread_pool::parent_ref parent) noexcept
+			{
+				try
+				{
+					directory_handle const handle(path.c_str());
+					if(!handle)
+					{
+						return;
+					}
+					int const dir=handle.get();
+					for_each_entry(dir,[&](char const* name,unsigned char type)
+					{
+						if(type==DT_UNKNOWN)
+						{
+							struct stat info;
+							if(fstatat(dir,name,&info,AT_SYMLINK_NOFOLLOW)==0)
+							{
+								type=S_ISDIR(info.st_mode)?DT_DIR:S_ISLNK(info.st_mode)?DT_LNK:DT_REG;
+							}
+						}
+						if(type==DT_DIR)
+						{
+							subdirectories.emplace_back(name);
+						}
+						//linked directories are left out so that links cannot make the search loop
+						else if(type!=DT_LNK||!entry_is_directory(dir,name,type))
+						{
+							files.emplace_back(name);
+						}
+					});
+					sort_files(subdirectories);
+					sort_files(files);
+					children.resize(subdirectories.size());
+					for(std::size_t i=0;i<children.size();++i)
+					{
+						subdirectories[i].push_back('/');
+						children[i].path=path+subdirectories[i];
+					}
+					//children is not resized again, so the tasks can hold on to its elements
+					for(auto& child:children)
+					{
+						parent.push_back([&child](thread_pool::parent_ref parent) noexcept
+						{
+							child.scan(parent);
+						});
+					}
+				}
+				catch(...)
+				{
+					error=std::current_exception();
+					parent.stop();
+				}
+			}
+
+			//same order as the Windows version, the contents of subdirectories and then the files
+			//rethrows the first error met by scan
+			void collect(String const& prefix,std::vector<String>& out)
+			{
+				if(error)
+				{
+					std::rethrow_exception(error);
+				}
+				for(std::size_t i=0;i<children.size();++i)
+				{
+					children[i].collect(prefix+subdirectories[i],out);
+				}
+				for(auto& f:files)
+				{
+					out.emplace_back(prefix+f);
+				}
+			}
+		};
+	}
+
+	/*
+	Returns a vector containing the filenames of all files in the first level of the given directory.
+	The filename part of path+wildcard is matched with fnmatch, and *.* matches everything as it does on Windows.
+	*/
+	template<typename String>
+	std::vector<String> files_in_dir(String path,String const& wildcard="*.*",file_attributes banned_attributes=directory_attribute,file_attributes required_attributes=0)
+	{
+		String search=std::move(path)+wildcard;
+		auto const name_start=find_filename(search.begin(),search.end());
+		String pattern(name_start,search.end());
+		search.erase(name_start,search.end());
+		if(pattern=="*.*")
+		{
+			pattern="*";
+		}
+		std::vector<String> files;
+		files_detail::directory_handle const handle(search.c_str());
+		if(!handle)
+		{
+			return files;
+		}
+		int const dir=handle.get();
+		auto const accept=[&](char const* name,unsigned char type)
+		{
+			if(banned_attributes|required_attributes)
+			{
+				file_attributes const attributes=files_detail::entry_is_directory(dir,name,type)?directory_attribute:0;
+				if((attributes&banned_attributes)||(attributes&required_attributes)!=required_attributes)
+				{
+					return;
+				}
+			}
+			files.emplace_back(name);
+		};
+		if(pattern.find_first_of("*?[")==String::npos)
+		{
+			//a plain name can be looked up directly instead of listing the whole directory
+			struct stat info;
+			if(!pattern.empty()&&pattern!="."&&pattern!=".."&&fstatat(dir,pattern.c_str(),&info,0)==0)
+			{
+				accept(pattern.c_str(),S_ISDIR(info.st_mode)?DT_DIR:DT_REG);
+			}
+		}
+		else
+		{
+			files_detail::for_each_entry(dir,[&](char const* name,unsigned char type)
+			{
+				if(fnmatch(pattern.c_str(),name,0)==0)
+				{
+					accept(name,type);
+				}
+			});
+		}
+		files_detail::sort_files(files);
+		return files;
+	}
+
+	/*
+	Returns the paths, relative to the given directory, of all files in it and its subdirectories.
+	Subdirectories are listed in parallel. Links to directories are not followed.
+	*/
+	template<typename String>
+	std::vector<String> files_in_dir_rec(String const& path)
+	{
+		files_detail::directory_node<String> root;
+		root.path=path;
+		{
+			thread_pool pool;
+			pool.push_back([&root](thread_pool::parent_ref parent) noexcept
+			{
+				root.scan(parent);
+			});
+			pool.wait();
+		}
+		std::vector<String> files;
+		root.collect(String(),files);
+		return files;
+	}
+
+	inline bool is_directory(char const* path)
+	{
+		struct stat info;
+		return stat(path,&info)==0&&S_ISDIR(info.st_mode);
+	}
+
+	inline std::string executable_directory()
+	{
+		char path[4096];
+		auto const len=readlink("/proc/self/exe",path,sizeof(path));
+		if(len<=0||static_cast<size_t>(len)==sizeof(path))
+		{
+			return {};
+		}
+		return std::string(path,find_filename(path,path+len));
+	}
 #endif
 
 	template<typename String,typename U>
@@ -220,18 +220,18 @@ namespace exlib {
 	template<typename T>
 	struct iterator:iterator_base<T,iterator<T>> {
 		using iterator_base<T,iterator<T>>::iterator_base;
-		iterator(const_iterator<T> ci):iterator_base(ci.base())
+		iterator(const_iterator<T> ci):iterator_base<T,iterator<T>>(ci.base())
 		{}
 	};
 
 	template<typename T>
-	struct const_reverse_iterator:iterator_base<T const,const_reverse_iterator<T>> {
+	struct const_reverse_iterator:riterator_base<T const,const_reverse_iterator<T>> {
 		using riterator_base<T const,const_reverse_iterator<T>>::riterator_base;
 	};
 	template<typename T>
 	struct reverse_iterator:riterator_base<T,reverse_iterator<T>> {
 		using riterator_base<T,reverse_iterator<T>>::riterator_base;
-		reverse_iterator(const_reverse_iterator<T> cri):riterator_base(cri.base())
+		reverse_iterator(const_reverse_iterator<T> cri):riterator_base<T,reverse_iterator<T>>(cri.base())
 		{}
 	};
 
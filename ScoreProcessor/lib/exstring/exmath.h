@@ -757,7 +757,7 @@ namespace exlib {
 				auto const range_end=get_end_swap_if(it,end,radius,current_min,c);
 				if(current_min<range_begin)
 				{
-					current_min=min_element(range_begin,range_end,c);
+					current_min=detail::min_element(range_begin,range_end,c);
 				}
 				*out=*current_min;
 			}
@@ -787,7 +787,7 @@ namespace exlib {
 					if(el==range_begin)
 					{
 						++range_begin;
-						el=min_element(range_begin,range_end,c);
+						el=detail::min_element(range_begin,range_end,c);
 					}
 					else
 					{
@@ -865,20 +865,20 @@ namespace exlib {
 	private:
 		using Base=std::vector<T,Alloc>;
 	public:
-		using Base::iterator;
-		using Base::allocator_type;
-		using Base::size_type;
-		using Base::difference_type;
-		using Base::const_reference;
-		using Base::const_pointer;
-		using Base::const_iterator;
-		using Base::const_reverse_iterator;
+		using typename Base::iterator;
+		using typename Base::allocator_type;
+		using typename Base::size_type;
+		using typename Base::difference_type;
+		using typename Base::const_reference;
+		using typename Base::const_pointer;
+		using typename Base::const_iterator;
+		using typename Base::const_reverse_iterator;
 	private:
 		size_t _max_size;
 	public:
 		LimitedSet(size_t s):_max_size(s)
 		{
-			_data.reserve(s);
+			Base::reserve(s+1);
 		}
 		LimitedSet():LimitedSet(0)
 		{}
@@ -902,15 +902,15 @@ namespace exlib {
 		}
 		const_iterator end() const
 		{
-			return Base::begin();
+			return Base::end();
 		}
-		const_iterator rbegin() const
+		const_reverse_iterator rbegin() const
 		{
 			return Base::rbegin();
 		}
-		const_iterator rend() const
+		const_reverse_iterator rend() const
 		{
-			return Base::rbegin();
+			return Base::rend();
 		}
 		using Base::empty;
 		using Base::clear;
@@ -920,7 +920,7 @@ namespace exlib {
 		template<typename U,typename Comp>
 		void _insert(U&& in,Comp comp)
 		{
-			if(max_size)
+			if(_max_size)
 			{
 				auto const loc=std::lower_bound(Base::begin(),Base::end(),in,comp);
 				if(size()>=max_size())
@@ -62,13 +62,13 @@ namespace exlib {
 	template<typename T=char,typename CharT=std::char_traits<T>>
 	class string_alg {
 	public:
-		typedef typename T value_type;
-		typedef typename T* pointer;
-		typedef typename T const* const_pointer;
-		typedef typename T& reference;
-		typedef typename T const& const_reference;
-		typedef typename std::size_t size_type;
-		typedef typename std::ptrdiff_t difference_type;
+		typedef T value_type;
+		typedef T* pointer;
+		typedef T const* const_pointer;
+		typedef T& reference;
+		typedef T const& const_reference;
+		typedef std::size_t size_type;
+		typedef std::ptrdiff_t difference_type;
 
 		typedef pointer iterator;
 		typedef const_pointer const_iterator;
@@ -187,7 +187,7 @@ namespace exlib {
 		string_base(size_type capacity);
 		string_base(string_base&&) noexcept;
 
-		template<typename String,typename>
+		template<typename String,typename=typename std::enable_if<!std::is_integral<String>::value>::type>
 		string_base(String const&);
 		string_base(string_base const& other);
 
@@ -253,8 +253,8 @@ namespace exlib {
 		typedef typename string_alg<T,CharT>::const_iterator const_iterator;
 		typedef typename string_alg<T,CharT>::reverse_iterator reverse_iterator;
 		typedef typename string_alg<T,CharT>::const_reverse_iterator const_reverse_iterator;
-		weak_string_base(T* data):string_alg(data,exlib::strlen(data)) {}
-		weak_string_base(T* data,size_t size):string_alg(data,size) {}
+		weak_string_base(T* data):string_alg<T,CharT>(data,exlib::strlen(data)) {}
+		weak_string_base(T* data,size_t size):string_alg<T,CharT>(data,size) {}
 	};
 	typedef weak_string_base<char> weak_string;
 	typedef weak_string_base<wchar_t> weak_wstring;
@@ -274,8 +274,8 @@ namespace exlib {
 		typedef typename string_alg<T,CharT>::const_iterator const_iterator;
 		typedef typename string_alg<T,CharT>::reverse_iterator reverse_iterator;
 		typedef typename string_alg<T,CharT>::const_reverse_iterator const_reverse_iterator;
-		string_manager_base(T* data):string_alg(data,exlib::strlen(data)) {}
-		string_manager_base(T* data,size_t size):string_alg(data,size) {}
+		string_manager_base(T* data):string_alg<T,CharT>(data,exlib::strlen(data)) {}
+		string_manager_base(T* data,size_t size):string_alg<T,CharT>(data,size) {}
 		~string_manager_base() { delete[] this->_data; }
 	};
 	typedef string_manager_base<char> string_manager;
@@ -322,7 +322,7 @@ namespace exlib {
 	string_base<T,CharT,Alloc>::string_base():string_alg<T,CharT>(nullptr,0),_capacity(0) {}
 
 	template<typename T,typename CharT,typename Alloc>
-	template<typename String,typename=std::enable_if<!std::is_integral<String>::value>::type>
+	template<typename String,typename>
 	string_base<T,CharT,Alloc>::string_base(String const& other):string_base(other.data(),other.size()) {}
 
 	template<typename T,typename CharT,typename Alloc>
@@ -762,7 +762,7 @@ namespace exlib {
 		unsigned int alphabet_size=26,
 		size_t buffer_size=15,
 		typename N,
-		typename=std::enable_if<std::is_integral<N>::value&&std::is_unsigned<N>::value>::type
+		typename=typename std::enable_if<std::is_integral<N>::value&&std::is_unsigned<N>::value>::type
 	>
 		String ordinal_lettering(N n)
 	{
@@ -922,7 +922,7 @@ namespace exlib {
 					{
 						make_worker_t maker{this};
 						struct count_iter {
-							using iterator_category=std::random_access_iterator_tag;
+							using iterator_category=std::forward_iterator_tag;
 							using difference_type=std::ptrdiff_t;
 							using value_type=size_t;
 							using reference=value_type;
@@ -945,12 +945,6 @@ namespace exlib {
 								++_count;
 								return *this;
 							}
-							count_iter operator--()
-							{
-								auto copy{*this};
-								++_count;
-								return *this;
-							}
 							bool operator==(count_iter o) const
 							{
 								return _count==o._count;
@@ -960,9 +954,9 @@ namespace exlib {
 								return _count!=o._count;
 							}
 						};
-						auto begin=thread_pool_detail::make_transform_iterator(count_iter{0},maker);
-						decltype(begin) end{count_iter{this->_workers.size()}};
-						_workers.insert(_workers.end(),begin,end);
+						auto begin=thread_pool_detail::make_transform_iterator(count_iter{this->_workers.size()},maker);
+						decltype(begin) end{count_iter{size},maker};
+						this->_workers.insert(this->_workers.end(),begin,end);
 					}
 					else
 					{
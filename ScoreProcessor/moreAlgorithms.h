@@ -122,7 +122,7 @@ namespace misc_alg {
 	}
 	template<typename T,typename alloc> ::std::vector<unsigned int> min_n_ind(::std::vector<T,alloc> const& values,size_t const num_values)
 	{
-		vector<unsigned int> mins;
+		::std::vector<unsigned int> mins;
 		if(values.size()==0)
 		{
 			return mins;
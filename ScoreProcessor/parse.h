@@ -17,6 +17,9 @@ along with this program. If not, see <https://www.gnu.org/licenses/>.
 #ifndef SCORE_PARSE_H
 #define SCORE_PARSE_H
 #include <numeric>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
 #include <cctype>
 #include <charconv>
 #include <optional>
@@ -55,7 +58,7 @@ namespace ScoreProcessor {
 		return errno_ref||str==end||(*end!='\0'&&!std::isspace(*end));
 	}
 #define make_parse_str_signed(type)\
-	inline int parse_str(##type##& out,char const* str){\
+	inline int parse_str(type& out,char const* str){\
 		int& errno_ref=errno;\
 		errno_ref=0;\
 		char* end;\
@@ -64,7 +67,7 @@ namespace ScoreProcessor {
 		{\
 			return errno_ref;\
 		}\
-		if(end==str||(*end!='\0'&&!std::isspace(*end))||temp>std::numeric_limits<##type##>::max()||temp<std::numeric_limits<##type>::min())\
+		if(end==str||(*end!='\0'&&!std::isspace(*end))||temp>std::numeric_limits<type>::max()||temp<std::numeric_limits<type>::min())\
 		{\
 			return 1;\
 		}\
@@ -76,7 +79,7 @@ namespace ScoreProcessor {
 		make_parse_str_signed(int)
 #undef make_parse_str_signed
 #define make_parse_str_unsigned(type)\
-	inline int parse_str(##type##& out,char const* str){\
+	inline int parse_str(type& out,char const* str){\
 		int& errno_ref=errno;\
 		errno_ref=0;\
 		char* end;\
@@ -85,7 +88,7 @@ namespace ScoreProcessor {
 		{\
 			return errno_ref;\
 		}\
-		if(end==str||(*end!='\0'&&!std::isspace(*end))||*str=='-'||temp>std::numeric_limits<##type##>::max())\
+		if(end==str||(*end!='\0'&&!std::isspace(*end))||*str=='-'||temp>std::numeric_limits<type>::max())\
 		{\
 			return 1;\
 		}\
@@ -1,8 +1,8 @@
 #ifndef SUPPORT_H
 #define SUPPORT_H
-#include "lib\exstring\exstring.h"
-#include "lib\exstring\exfiles.h"
-#include "lib\exstring\exalg.h"
+#include "lib/exstring/exstring.h"
+#include "lib/exstring/exfiles.h"
+#include "lib/exstring/exalg.h"
 enum class support_type {
 	no,png,jpeg,bmp,tiff
 };